@@ -0,0 +1,357 @@
+// Benchmarks for function evaluations, Newton and the time steppers.
+//
+//   bench [--filter=substring] [--json=file] [--min_time=seconds]
+//
+// For every benchmark the per-iteration wall time, heap allocations and
+// allocated bytes are reported, the JSON output follows the layout of
+// Google Benchmark so the usual comparison tools can be used.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <nonlinfunc.hpp>
+#include <timestepper.hpp>
+#include <implicitRK.hpp>
+
+#include "mass_spring.hpp"
+#include "Newmark.hpp"
+
+
+// global allocation counters
+static std::atomic<size_t> alloc_count{0};
+static std::atomic<size_t> alloc_bytes{0};
+
+void * operator new (size_t size)
+{
+  alloc_count.fetch_add (1, std::memory_order_relaxed);
+  alloc_bytes.fetch_add (size, std::memory_order_relaxed);
+  if (void * p = std::malloc (size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+void * operator new[] (size_t size) { return operator new (size); }
+void operator delete (void * p) noexcept { std::free (p); }
+void operator delete[] (void * p) noexcept { std::free (p); }
+void operator delete (void * p, size_t) noexcept { std::free (p); }
+void operator delete[] (void * p, size_t) noexcept { std::free (p); }
+
+
+
+class BenchState
+{
+  size_t m_iterations;
+public:
+  double items_per_iteration = 0;    // e.g. degrees of freedom per step
+
+  BenchState (size_t iterations) : m_iterations(iterations) { }
+  size_t iterations() const { return m_iterations; }
+};
+
+class Benchmark
+{
+public:
+  std::string name;
+  // set up the problem, return the timed kernel
+  std::function<std::function<void()>(BenchState&)> setup;
+};
+
+class BenchResult
+{
+public:
+  std::string name;
+  size_t iterations;
+  double ns_per_iter, cpu_ns_per_iter, allocs_per_iter, bytes_per_iter, items_per_second;
+};
+
+std::vector<Benchmark> & registry()
+{
+  static std::vector<Benchmark> benchmarks;
+  return benchmarks;
+}
+
+void addBenchmark (std::string name, std::function<std::function<void()>(BenchState&)> setup)
+{
+  registry().push_back ( { name, setup } );
+}
+
+
+BenchResult runBenchmark (const Benchmark & bm, double min_time)
+{
+  using clock = std::chrono::steady_clock;
+  size_t iterations = 1;
+  while (true)
+    {
+      BenchState state(iterations);
+      auto kernel = bm.setup(state);
+
+      size_t count0 = alloc_count, bytes0 = alloc_bytes;
+      auto start = clock::now();
+      std::clock_t cpustart = std::clock();
+      for (size_t i = 0; i < iterations; i++)
+        kernel();
+      double seconds = std::chrono::duration<double>(clock::now()-start).count();
+      double cpuseconds = double(std::clock()-cpustart) / CLOCKS_PER_SEC;
+      size_t count = alloc_count-count0, bytes = alloc_bytes-bytes0;
+
+      if (seconds >= min_time || iterations >= (size_t(1) << 30))
+        return { bm.name, iterations, 1e9*seconds/iterations, 1e9*cpuseconds/iterations,
+                 double(count)/iterations, double(bytes)/iterations,
+                 state.items_per_iteration*iterations/seconds };
+
+      // aim for 1.4 * min_time, grow at most 10x per round
+      double factor = seconds > 0 ? 1.4*min_time/seconds : 10;
+      iterations = std::max (iterations+1, size_t(iterations*std::min(factor, 10.0)));
+    }
+}
+
+
+
+// scalable models: a chain of n masses hanging from a fix, and a k x k
+// lattice with springs between horizontal and vertical neighbours,
+// whose top row is fixed
+
+MassSpringSystem<2> chainModel (size_t n)
+{
+  MassSpringSystem<2> mss;
+  mss.setGravity ( { 0, -9.81 } );
+  Connector prev = mss.addFix ( { { 0.0, 0.0 } } );
+  for (size_t i = 0; i < n; i++)
+    {
+      Connector m = mss.addMass ( { 1, { double(i+1), 0.0 } } );
+      mss.addSpring ( { 1, 100, { prev, m } } );
+      prev = m;
+    }
+  return mss;
+}
+
+MassSpringSystem<2> latticeModel (size_t k)
+{
+  MassSpringSystem<2> mss;
+  mss.setGravity ( { 0, -9.81 } );
+  std::vector<Connector> nodes;
+  for (size_t i = 0; i < k; i++)
+    for (size_t j = 0; j < k; j++)
+      if (i == 0)
+        nodes.push_back (mss.addFix ( { { double(j), 0.0 } } ));
+      else
+        nodes.push_back (mss.addMass ( { 1, { double(j), -double(i) } } ));
+
+  for (size_t i = 0; i < k; i++)
+    for (size_t j = 0; j < k; j++)
+      {
+        if (j+1 < k && i > 0)
+          mss.addSpring ( { 1, 100, { nodes[i*k+j], nodes[i*k+j+1] } } );
+        if (i+1 < k)
+          mss.addSpring ( { 1, 100, { nodes[i*k+j], nodes[(i+1)*k+j] } } );
+      }
+  return mss;
+}
+
+class Model
+{
+public:
+  std::string name;
+  std::function<MassSpringSystem<2>()> create;
+};
+
+
+
+void registerBenchmarks()
+{
+  std::vector<Model> models;
+  for (size_t n : { 8, 32, 96 })
+    models.push_back ( { "chain/"+std::to_string(n), [n] { return chainModel(n); } } );
+  for (size_t k : { 4, 6, 10 })
+    models.push_back ( { "lattice/"+std::to_string(k), [k] { return latticeModel(k); } } );
+
+  for (auto model : models)
+    {
+      // mass-spring systems are referenced by MSS_Function and have to
+      // stay alive with the kernel
+      auto makeSystem = [model] { return std::make_shared<MassSpringSystem<2>>(model.create()); };
+
+      addBenchmark ("MSS_Function::evaluate/"+model.name, [makeSystem] (BenchState & state)
+      {
+        auto mss = makeSystem();
+        auto func = std::make_shared<MSS_Function<2>>(*mss);
+        auto x = std::make_shared<Vector<>>(func->dimX());
+        auto f = std::make_shared<Vector<>>(func->dimF());
+        Vector<> dummy(func->dimX());
+        mss->getState (*x, dummy, dummy);
+        state.items_per_iteration = func->dimX();
+        return [mss, func, x, f] { func->evaluate (*x, *f); };
+      });
+
+      addBenchmark ("MSS_Function::evaluateDeriv/"+model.name, [makeSystem] (BenchState & state)
+      {
+        auto mss = makeSystem();
+        auto func = std::make_shared<MSS_Function<2>>(*mss);
+        auto x = std::make_shared<Vector<>>(func->dimX());
+        auto df = std::make_shared<Matrix<>>(func->dimF(), func->dimX());
+        Vector<> dummy(func->dimX());
+        mss->getState (*x, dummy, dummy);
+        state.items_per_iteration = func->dimX();
+        return [mss, func, x, df] { func->evaluateDeriv (*x, *df); };
+      });
+
+      // one Newton iteration: residual, Jacobian, factorization and update for
+      // the implicit Euler equation y - yold - tau f(y) = 0, as NewtonSolver
+      // does it
+      addBenchmark ("NewtonSolver/iteration/"+model.name, [makeSystem] (BenchState & state)
+      {
+        auto mss = makeSystem();
+        auto rhs = FirstOrderSystem (std::make_shared<MSS_Function<2>>(*mss));
+        size_t n = rhs->dimX();
+        auto yold = std::make_shared<ConstantFunction>(n);
+        auto equ = std::make_shared<IdentityFunction>(n) - yold - 1e-3*rhs;
+        auto y = std::make_shared<Vector<>>(n);
+        Vector<> dummy(n/2);
+        mss->getState (y->range(0, n/2), dummy, dummy);
+        yold->set (*y);
+        auto res = std::make_shared<Vector<>>(n);
+        auto fprime = std::make_shared<Matrix<>>(n, n);
+        std::shared_ptr<SparseMatrix> sjac = SparseJacobian (equ);
+        state.items_per_iteration = n;
+        return [mss, equ, y, yold, res, fprime, sjac]
+        {
+          *y = yold->get();
+          equ->evaluate (*y, *res);
+          NewtonStep (equ, *y, *res, *fprime, sjac.get());
+        };
+      });
+
+      auto addStepper = [&] (std::string name, auto make)
+      {
+        addBenchmark (name+"::doStep/"+model.name, [makeSystem, make] (BenchState & state)
+        {
+          auto mss = makeSystem();
+          auto rhs = FirstOrderSystem (std::make_shared<MSS_Function<2>>(*mss));
+          size_t n = rhs->dimX();
+          std::shared_ptr<TimeStepper> stepper = make(rhs);
+          auto y = std::make_shared<Vector<>>(n);
+          Vector<> dummy(n/2);
+          mss->getState (y->range(0, n/2), dummy, dummy);
+          state.items_per_iteration = n;
+          return [mss, stepper, y] { stepper->doStep (1e-3, *y); };
+        });
+      };
+
+      addStepper ("ExplicitEuler", [] (auto rhs) { return std::make_shared<ExplicitEuler>(rhs); });
+      addStepper ("ImprovedEuler", [] (auto rhs) { return std::make_shared<ImprovedEuler>(rhs); });
+      addStepper ("ImplicitEuler", [] (auto rhs) { return std::make_shared<ImplicitEuler>(rhs); });
+      addStepper ("CrankNicolson", [] (auto rhs) { return std::make_shared<CrankNicolson>(rhs); });
+      addStepper ("ImplicitRungeKutta/Gauss2", [] (auto rhs)
+                  { return std::make_shared<ImplicitRungeKutta>(rhs, Gauss2a, Gauss2b, Gauss2c); });
+
+      // one call per step, including the setup of the equations
+      addBenchmark ("SolveODE_Newmark/step/"+model.name, [makeSystem] (BenchState & state)
+      {
+        auto mss = makeSystem();
+        auto func = std::make_shared<MSS_Function<2>>(*mss);
+        size_t n = func->dimX();
+        auto x = std::make_shared<Vector<>>(n);
+        auto dx = std::make_shared<Vector<>>(n);
+        Vector<> ddx(n);
+        mss->getState (*x, *dx, ddx);
+        auto mass = std::make_shared<IdentityFunction>(n);
+        state.items_per_iteration = n;
+        return [mss, func, mass, x, dx] { SolveODE_Newmark (1e-3, 1, *x, *dx, func, mass); };
+      });
+
+      addBenchmark ("SolveODE_Alpha/step/"+model.name, [makeSystem] (BenchState & state)
+      {
+        auto mss = makeSystem();
+        auto func = std::make_shared<MSS_Function<2>>(*mss);
+        size_t n = func->dimX();
+        auto alpha = std::make_shared<AlphaState>(n);
+        alpha->dt = 1e-3;
+        mss->getState (alpha->x, alpha->v, alpha->a);
+        auto mass = std::make_shared<IdentityFunction>(n);
+        state.items_per_iteration = n;
+        return [mss, func, mass, alpha] { SolveODE_Alpha (*alpha, 1, func, mass); };
+      });
+    }
+}
+
+
+
+void writeJSON (const std::string & filename, const std::vector<BenchResult> & results)
+{
+  std::ofstream out(filename);
+  out << std::setprecision(10);
+  out << "{\n  \"context\": {\n    \"executable\": \"bench\",\n"
+      << "    \"library_build_type\": "
+#ifdef NDEBUG
+      << "\"release\""
+#else
+      << "\"debug\""
+#endif
+      << "\n  },\n  \"benchmarks\": [\n";
+  for (size_t i = 0; i < results.size(); i++)
+    {
+      auto & r = results[i];
+      out << "    {\n"
+          << "      \"name\": \"" << r.name << "\",\n"
+          << "      \"run_type\": \"iteration\",\n"
+          << "      \"iterations\": " << r.iterations << ",\n"
+          << "      \"real_time\": " << r.ns_per_iter << ",\n"
+          << "      \"cpu_time\": " << r.cpu_ns_per_iter << ",\n"
+          << "      \"time_unit\": \"ns\",\n"
+          << "      \"allocs_per_iter\": " << r.allocs_per_iter << ",\n"
+          << "      \"bytes_per_iter\": " << r.bytes_per_iter << ",\n"
+          << "      \"items_per_second\": " << r.items_per_second << "\n"
+          << "    }" << (i+1 < results.size() ? "," : "") << "\n";
+    }
+  out << "  ]\n}\n";
+}
+
+
+int main (int argc, char ** argv)
+{
+  std::string filter, jsonfile;
+  double min_time = 0.2;
+  for (int i = 1; i < argc; i++)
+    {
+      std::string arg = argv[i];
+      if (arg.rfind("--filter=", 0) == 0) filter = arg.substr(9);
+      else if (arg.rfind("--json=", 0) == 0) jsonfile = arg.substr(7);
+      else if (arg.rfind("--min_time=", 0) == 0) min_time = std::stod(arg.substr(11));
+      else
+        {
+          std::cerr << "usage: " << argv[0] << " [--filter=substring] [--json=file] [--min_time=seconds]" << std::endl;
+          return 1;
+        }
+    }
+
+  registerBenchmarks();
+
+  std::vector<BenchResult> results;
+  std::cout << std::left << std::setw(52) << "benchmark"
+            << std::right << std::setw(14) << "ns/iter"
+            << std::setw(12) << "allocs/iter" << std::setw(14) << "bytes/iter"
+            << std::setw(14) << "items/s" << std::endl;
+  for (auto & bm : registry())
+    {
+      if (bm.name.find(filter) == std::string::npos) continue;
+      auto r = runBenchmark (bm, min_time);
+      results.push_back (r);
+      std::cout << std::left << std::setw(52) << r.name << std::right << std::fixed
+                << std::setprecision(1) << std::setw(14) << r.ns_per_iter
+                << std::setw(12) << r.allocs_per_iter << std::setw(14) << r.bytes_per_iter
+                << std::scientific << std::setprecision(3) << std::setw(14) << r.items_per_second
+                << std::defaultfloat << std::endl;
+    }
+
+  if (!jsonfile.empty())
+    writeJSON (jsonfile, results);
+  return 0;
+}
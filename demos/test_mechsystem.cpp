@@ -0,0 +1,255 @@
+#include <iostream>
+#include <cmath>
+
+#include <nonlinfunc.hpp>
+#include <Newton.hpp>
+#include <imex.hpp>
+#include <colored_jacobian.hpp>
+
+#include "mass_spring.hpp"
+
+using namespace ASC_ode;
+
+
+bool Check (const char * what, bool ok)
+{
+  std::cout << what << ": " << (ok ? "ok" : "FAILED") << std::endl;
+  return ok;
+}
+
+// a chain of masses from a fix in the plane, every third spring stiff
+MassSpringSystem<2> Chain (size_t n)
+{
+  MassSpringSystem<2> mss;
+  mss.setGravity ( { 0, -9.81 } );
+  Connector prev = mss.addFix ( { { 0, 0 } } );
+  for (size_t i = 0; i < n; i++)
+    {
+      Connector m = mss.addMass ( { 1, { double(i+1), 0 } } );
+      mss.addSpring ( { 1, i % 3 == 2 ? 1e4 : 100, { prev, m } } );
+      prev = m;
+    }
+  return mss;
+}
+
+// a k x k lattice below a fixed row, springs between horizontal and
+// vertical neighbours
+MassSpringSystem<2> Lattice (size_t k)
+{
+  MassSpringSystem<2> mss;
+  mss.setGravity ( { 0, -9.81 } );
+  std::vector<Connector> nodes;
+  for (size_t i = 0; i < k; i++)
+    for (size_t j = 0; j < k; j++)
+      if (i == 0)
+        nodes.push_back (mss.addFix ( { { double(j), 0 } } ));
+      else
+        nodes.push_back (mss.addMass ( { 1, { double(j) + 0.1*std::sin (i*k+j), -double(i) } } ));
+  for (size_t i = 0; i < k; i++)
+    for (size_t j = 0; j < k; j++)
+      {
+        if (j+1 < k && i > 0)
+          mss.addSpring ( { 1, 100, { nodes[i*k+j], nodes[i*k+j+1] } } );
+        if (i+1 < k)
+          mss.addSpring ( { 1, 100, { nodes[i*k+j], nodes[(i+1)*k+j] } } );
+      }
+  return mss;
+}
+
+// largest entry of a x - b
+double Residual (const SparseMatrix & a, VectorView<double> x, VectorView<double> b)
+{
+  Matrix<> dense(a.rows(), a.cols());
+  a.toDense (dense);
+  Vector<> r = dense*x;
+  double err = 0;
+  for (size_t i = 0; i < r.size(); i++)
+    err = std::max (err, std::fabs (r(i) - b(i)));
+  return err;
+}
+
+// largest difference of the sparse Jacobian to the dense one on its pattern
+double JacobianError (std::shared_ptr<NonlinearFunction> func, VectorView<double> x,
+                      SparseMatrix & jac)
+{
+  Matrix<> dense(func->dimF(), func->dimX());
+  func->evaluateDeriv (x, dense);
+  func->evaluateDerivSparse (x, jac);
+  auto & p = jac.pattern();
+  double err = 0;
+  for (size_t i = 0; i < p.rows(); i++)
+    for (size_t k = p.first(i); k < p.next(i); k++)
+      err = std::max (err, std::fabs (jac.value(k) - dense(i, p.col(k))));
+  return err;
+}
+
+
+int main()
+{
+  bool ok = true;
+
+  // springs break and are added after the patterns were taken: the
+  // combined functions fill the old patterns by row and column, and IMEX
+  // continues like a stepper set up for the changed system
+  {
+    auto mss = Chain (9);
+    size_t n = 2*mss.masses().size();
+    auto [stiff, soft] = SplitStiffSprings (mss, 1e3);
+    auto fimp = FirstOrderSystem (stiff);
+    auto full = FirstOrderSystem (std::make_shared<MSS_Function<2>>(mss));
+    auto imex = ARS232 (FirstOrderSystem (soft, false), fimp);
+
+    Vector<> y(2*n), dummy(n);
+    y = 0.0;
+    mss.getState (y.range(0, n), dummy, dummy);
+    for (int i = 0; i < 20; i++)
+      imex->doStep (1e-3, y);
+
+    SparseMatrix jacfull(full->sparsity()), jacimp(fimp->sparsity());
+    size_t version = fimp->sparsityVersion();
+    mss.removeSpring (2);                   // stiff, the last one takes its place
+    mss.removeSpring (4);
+    ok &= Check ("removed springs: version", fimp->sparsityVersion() != version);
+    ok &= Check ("removed springs: first order Jacobian",
+                 JacobianError (full, y, jacfull) < 1e-10 && JacobianError (fimp, y, jacimp) < 1e-10);
+
+    mss.addSpring ( { 2, 1e4, { Connector { Connector::MASS, 0 }, Connector { Connector::MASS, 8 } } } );
+    ok &= Check ("added spring: first order Jacobian",
+                 JacobianError (full, y, jacfull) < 1e-10 && JacobianError (fimp, y, jacimp) < 1e-10);
+
+    auto [stiff2, soft2] = SplitStiffSprings (mss, 1e3);
+    auto fresh = ARS232 (FirstOrderSystem (soft2, false), FirstOrderSystem (stiff2));
+    Vector<> y2 = y;
+    for (int i = 0; i < 20; i++)
+      {
+        imex->doStep (1e-3, y);
+        fresh->doStep (1e-3, y2);
+      }
+    double diff = 0;
+    for (size_t i = 0; i < 2*n; i++)
+      diff = std::max (diff, std::fabs (y(i) - y2(i)));
+    std::cout << "IMEX after topology changes: diff " << diff << std::endl;
+    ok &= Check ("IMEX after topology changes", diff == 0);
+  }
+
+  // the implicit Euler equation of a chain: Newton takes the pattern cached
+  // by the equation and factors in compressed storage
+  {
+    auto mss = Chain (30);
+    auto rhs = FirstOrderSystem (std::make_shared<MSS_Function<2>>(mss));
+    size_t n = rhs->dimX();
+    auto equ = std::make_shared<IdentityFunction>(n) - 1e-2*rhs;
+    Vector<> y(n), dummy(n/2);
+    y = 0.0;
+    mss.getState (y.range(0, n/2), dummy, dummy);
+
+    auto jac = SparseJacobian (equ);
+    ok &= Check ("cached pattern", jac && jac->sharedPattern() == equ->sharedSparsity());
+    equ->evaluateDerivSparse (y, *jac);
+    Vector<> b(n), x(n);
+    for (size_t i = 0; i < n; i++)
+      b(i) = std::sin (i+1.0);
+    x = b;
+    SparseLU lu(*jac);
+    lu.solve (x);
+    std::cout << "sparse LU: " << jac->nnz() << " entries, " << lu.nnz() << " in the factors" << std::endl;
+    ok &= Check ("sparse LU", Residual (*jac, x, b) < 1e-12 && lu.nnz() < 3*jac->nnz());
+
+    auto pattern = equ->sharedSparsity();
+    mss.removeSpring (5);
+    ok &= Check ("cached pattern after a removed spring",
+                 equ->sharedSparsity() != pattern && equ->sharedSparsity() == equ->sharedSparsity()
+                 && equ->sharedSparsity()->nnz() < pattern->nnz());
+  }
+
+  // a saddle point matrix as of joints, the constraints first so that the
+  // first rows have zero diagonals: ( 0 B ; B^T A ) with A tridiagonal and
+  // B the differences of neighbours
+  {
+    size_t n = 10, m = 4;
+    std::vector<std::vector<size_t>> rows(m+n);
+    for (size_t i = 0; i < n; i++)
+      for (size_t j = (i > 0 ? i-1 : 0); j < std::min (n, i+2); j++)
+        rows[m+i].push_back(m+j);
+    for (size_t k = 0; k < m; k++)
+      {
+        rows[k] = { m+2*k, m+2*k+1 };
+        rows[m+2*k].push_back(k);
+        rows[m+2*k+1].push_back(k);
+      }
+    SparseMatrix a(SparsityPattern(m+n, rows));
+    auto & p = a.pattern();
+    for (size_t i = 0; i < m+n; i++)
+      for (size_t k = p.first(i); k < p.next(i); k++)
+        {
+          size_t j = p.col(k);
+          if (i >= m && j >= m)
+            a.value(k) = (i == j) ? 2 : -1;
+          else
+            a.value(k) = (std::max (i, j) % 2) ? -1 : 1;
+        }
+    Vector<> b(m+n), x(m+n);
+    for (size_t i = 0; i < m+n; i++)
+      b(i) = 1.0 + i;
+    x = b;
+    SparseLU(a).solve (x);
+    ok &= Check ("sparse LU, zero diagonal", Residual (a, x, b) < 1e-12);
+  }
+
+  // colored Jacobians of a lattice with a joint and contacts: forward AD
+  // with a few colors per evaluation gives the Jacobian of AD seeding all
+  // directions, the pattern covers all its nonzeros. Colored differences
+  // agree up to their truncation error.
+  {
+    auto mss = Lattice (7);
+    mss.addJoint ( { 1.5, { Connector { Connector::MASS, 3 }, Connector { Connector::MASS, 10 } } } );
+    ContactParameters contact;
+    contact.radius = 0.55;
+    contact.stiffness = 1e3;
+    mss.setContact (contact);
+    auto func = std::make_shared<MSS_Function<2>>(mss);
+    size_t n = func->dimX();
+    Vector<> x(n), dummy(n);
+    x = 0.3;
+    mss.getState (x.range(0, n-1), dummy.range(0, n-1), dummy.range(0, n-1));
+
+    Vector<AutoDiffDynamic<double>> xad(n), fad(n);
+    for (size_t j = 0; j < n; j++)
+      {
+        xad(j) = AutoDiffDynamic<double>(x(j), n);
+        xad(j).deriv()[j] = 1;
+      }
+    func->evaluateGeneric (xad, fad);
+    Matrix<> ref(n, n);
+    double scale = 0;
+    for (size_t i = 0; i < n; i++)
+      for (size_t j = 0; j < n; j++)
+        {
+          ref(i,j) = j < fad(i).deriv().size() ? fad(i).deriv()[j] : 0.0;
+          scale = std::max (scale, std::fabs (ref(i,j)));
+        }
+
+    SparseMatrix jac(func->sharedSparsity()), jacfd(func->sharedSparsity());
+    func->evaluateDerivSparse (x, jac);
+    ColoredFDFunction fd(func);
+    fd.evaluateDerivSparse (x, jacfd);
+
+    Matrix<> dense(n, n), densefd(n, n);
+    jac.toDense (dense);
+    jacfd.toDense (densefd);
+    double errad = 0, errfd = 0;
+    for (size_t i = 0; i < n; i++)
+      for (size_t j = 0; j < n; j++)
+        {
+          errad = std::max (errad, std::fabs (dense(i,j) - ref(i,j)));
+          errfd = std::max (errfd, std::fabs (densefd(i,j) - ref(i,j)));
+        }
+    size_t colors = fd.coloring().numColors();
+    std::cout << "colored Jacobian: " << n << " columns, " << colors << " colors, AD error "
+              << errad/scale << ", differences error " << errfd/scale << std::endl;
+    ok &= Check ("colored AD Jacobian", errad <= 1e-14*scale && colors < n/3);
+    ok &= Check ("colored difference Jacobian", errfd < 1e-6*scale);
+  }
+
+  return ok ? 0 : 1;
+}
@@ -13,9 +13,20 @@ const char* outpath_improved = "output_test_ode_improved.txt";
 const char* outpath_explicit = "output_test_ode_explicit.txt";
 #endif
 
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <string>
+
 #include <nonlinfunc.hpp>
 #include <timestepper.hpp>
 #include <implicitRK.hpp>
+#include <explicitRK.hpp>
+#include <rosenbrock.hpp>
+#include <bdf.hpp>
+#include <exponential.hpp>
+#include <fixed_stepper.hpp>
+#include <batch_stepper.hpp>
 
 using namespace ASC_ode;
 
@@ -47,6 +58,68 @@ public:
 };
 
 
+// the cubic force of a Duffing oscillator x'' = -x - x^3, without the linear part
+class Cubic : public NonlinearFunction
+{
+public:
+  size_t dimX() const override { return 2; }
+  size_t dimF() const override { return 2; }
+
+  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    f(0) = 0;
+    f(1) = -x(0)*x(0)*x(0);
+  }
+
+  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    df = 0.0;
+    df(1,0) = -3*x(0)*x(0);
+  }
+};
+
+
+// acceleration of the pendulum x'' = -sin x
+class Pendulum : public NonlinearFunction
+{
+public:
+  size_t dimX() const override { return 1; }
+  size_t dimF() const override { return 1; }
+
+  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    f(0) = -std::sin(x(0));
+  }
+
+  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    df(0,0) = -std::cos(x(0));
+  }
+};
+
+
+// error at t = tend of the oscillator x'' = -x, x(0) = 1, x'(0) = 0
+double OscillatorError (std::shared_ptr<TimeStepper> stepper, double tend, int steps)
+{
+  Vector<> y = { 1, 0 };
+  for (int i = 0; i < steps; i++)
+    stepper->doStep (tend/steps, y);
+  return std::hypot (y(0) - std::cos(tend), y(1) + std::sin(tend));
+}
+
+// observed order log2(e(n)/e(2n)), at most 0.3 below the expected one
+bool CheckOrder (const std::string & name, int expected, std::function<double(int)> error,
+                 int steps = 20)
+{
+  double e1 = error(steps), e2 = error(2*steps);
+  double order = std::log2 (e1/e2);
+  bool ok = order > expected - 0.3;
+  std::cout << name << ": error " << e1 << " -> " << e2 << ", order " << order
+            << " (expected " << expected << ")" << (ok ? "" : "  FAILED") << std::endl;
+  return ok;
+}
+
+
 int main()
 {
   double tend = 40*M_PI;
@@ -179,5 +252,240 @@ int main()
     }
   }
 
-  return 0;
+
+
+  // convergence orders on the oscillator up to t = 2
+  bool ok = true;
+  auto oscillator = std::make_shared<MassSpring>(1.0, 1.0);
+  auto osc = [&] (auto make)
+  {
+    return [=] (int steps) { return OscillatorError (make(oscillator), 2, steps); };
+  };
+
+  // the fixed size steppers agree with the dynamic ones, with analytic and
+  // numeric Jacobian
+  {
+    auto f = [] (const Vec<2> & x, Vec<2> & fx) { fx(0) = x(1); fx(1) = -x(0); };
+    auto df = [] (const Vec<2> &, fixed::SmallMatrix<2> & j)
+    {
+      j(0,0) = 0; j(0,1) = 1;
+      j(1,0) = -1; j(1,1) = 0;
+    };
+    auto compare = [&] (const char * name, const auto & fixedstepper, TimeStepper && stepper)
+    {
+      Vec<2> yfixed { 1, 0 };
+      Vector<> y = { 1, 0 };
+      fixed::SolveODE<2> (fixedstepper, 2, 100, yfixed);
+      for (int i = 0; i < 100; i++)
+        stepper.doStep (2.0/100, y);
+      double diff = std::hypot (yfixed(0)-y(0), yfixed(1)-y(1));
+      bool fixedok = diff < 1e-12;
+      std::cout << "fixed " << name << ": difference " << diff << (fixedok ? "" : "  FAILED") << std::endl;
+      return fixedok;
+    };
+    ok &= compare ("ExplicitEuler", fixed::MakeExplicitEuler<2>(f), ExplicitEuler(oscillator));
+    ok &= compare ("ImprovedEuler", fixed::MakeImprovedEuler<2>(f), ImprovedEuler(oscillator));
+    ok &= compare ("ImplicitEuler", fixed::MakeImplicitEuler<2>(f, df), ImplicitEuler(oscillator));
+    ok &= compare ("CrankNicolson", fixed::MakeCrankNicolson<2>(f, df), CrankNicolson(oscillator));
+
+    Vec<2> ynum { 1, 0 }, yexact { 1, 0 };
+    fixed::SolveODE<2> (fixed::MakeImplicitEuler<2>(f), 2, 100, ynum);
+    fixed::SolveODE<2> (fixed::MakeImplicitEuler<2>(f, df), 2, 100, yexact);
+    double diff = std::hypot (ynum(0)-yexact(0), ynum(1)-yexact(1));
+    std::cout << "fixed numeric Jacobian: difference " << diff << (diff < 1e-8 ? "" : "  FAILED") << std::endl;
+    ok &= diff < 1e-8;
+
+    // the elimination pivots past the zero a(0,0)
+    fixed::SmallMatrix<3> a(0.0);
+    a(0,1) = 2; a(0,2) = 1;
+    a(1,0) = 1; a(1,1) = 1; a(1,2) = 1;
+    a(2,0) = 4; a(2,2) = 1;
+    Vec<3> b { 3, 3, 5 };
+    fixed::SolveInPlace (a, b);
+    bool solveok = std::fabs(b(0)-1) + std::fabs(b(1)-1) + std::fabs(b(2)-1) < 1e-14;
+    std::cout << "fixed SolveInPlace: " << (solveok ? "ok" : "FAILED") << std::endl;
+    ok &= solveok;
+  }
+
+  // batched evaluation and stepping agree with the single states
+  {
+    auto rhs = FirstOrderSystem (std::make_shared<Pendulum>());
+    Vector<> diag = { 2, 3 };
+    auto combined = std::make_shared<MultipleFunc>
+      (Compose (2.0*rhs - std::make_shared<IdentityFunction>(2), std::make_shared<DiagMatrixFunction>(diag)), 3);
+    size_t nb = 5;
+    double diff = 0;
+    for (auto func : { rhs, std::shared_ptr<NonlinearFunction>(combined) })
+      {
+        size_t n = func->dimX();
+        Matrix<> x(n, nb), f(func->dimF(), nb);
+        for (size_t i = 0; i < n; i++)
+          for (size_t j = 0; j < nb; j++)
+            x(i,j) = 0.1*i + 0.3*j - 0.2;
+        func->evaluateBatch (x, f);
+        Vector<> xj(n), fj(func->dimF());
+        for (size_t j = 0; j < nb; j++)
+          {
+            xj = x.col(j);
+            func->evaluate (xj, fj);
+            for (size_t i = 0; i < fj.size(); i++)
+              diff = std::max (diff, std::fabs (fj(i) - f(i,j)));
+          }
+      }
+    std::cout << "evaluateBatch: difference " << diff << (diff == 0 ? "" : "  FAILED") << std::endl;
+    ok &= diff == 0;
+
+    auto compare = [&] (const char * name, BatchTimeStepper && batch, TimeStepper && single)
+    {
+      single.setPredictor (false);
+      Matrix<> y(2, nb);
+      for (size_t j = 0; j < nb; j++)
+        {
+          y(0,j) = 0.3*j;
+          y(1,j) = 0.1;
+        }
+      Matrix<> y0 = y;
+      for (int k = 0; k < 100; k++)
+        batch.doStep (0.05, y);
+      double diff = 0;
+      Vector<> yj(2);
+      for (size_t j = 0; j < nb; j++)
+        {
+          yj = y0.col(j);
+          for (int k = 0; k < 100; k++)
+            single.doStep (0.05, yj);
+          diff = std::max (diff, std::hypot (yj(0)-y(0,j), yj(1)-y(1,j)));
+        }
+      bool batchok = diff < 1e-12;
+      std::cout << "batch " << name << ": difference " << diff << (batchok ? "" : "  FAILED") << std::endl;
+      return batchok;
+    };
+    ok &= compare ("ExplicitEuler", BatchExplicitEuler(rhs), ExplicitEuler(rhs));
+    ok &= compare ("ImprovedEuler", BatchImprovedEuler(rhs), ImprovedEuler(rhs));
+    ok &= compare ("ImplicitEuler", BatchImplicitEuler(rhs), ImplicitEuler(rhs));
+  }
+
+  // the chain rule scales by diagonal factors (inner, outer, both, a zero
+  // one) instead of multiplying, it has to give the dense product
+  {
+    auto rhs = FirstOrderSystem (std::make_shared<Pendulum>());
+    Vector<> diag = { 2, -3 }, zero = { 0, 0 };
+    std::shared_ptr<NonlinearFunction> d = std::make_shared<DiagMatrixFunction>(diag);
+    std::shared_ptr<NonlinearFunction> z = std::make_shared<DiagMatrixFunction>(zero);
+    std::shared_ptr<NonlinearFunction> spring = std::make_shared<MassSpring>(1.0, 2.0);
+    std::pair<std::shared_ptr<NonlinearFunction>, std::shared_ptr<NonlinearFunction>> factors[] =
+      { { rhs, d }, { rhs, z }, { d, rhs }, { d, 3.0*d }, { rhs, spring }, { Compose (rhs, d), 2.0*d + d } };
+    Vector<> x = { 0.7, -0.4 };
+    double diff = 0;
+    for (auto & [fa, fb] : factors)
+      {
+        Matrix<> jaca(2, 2), jacb(2, 2), df(2, 2), dfw(2, 2);
+        Vector<> tmp(2), fref(2), f(2);
+        fb->evaluate (x, tmp);
+        fb->evaluateDeriv (x, jacb);
+        fa->evaluate (tmp, fref);
+        fa->evaluateDeriv (tmp, jaca);
+        Matrix<> ref = jaca*jacb;
+
+        auto composed = Compose (fa, fb);
+        composed->evaluateDeriv (x, df);
+        composed->evaluateWithDeriv (x, f, dfw);
+        for (size_t i = 0; i < 2; i++)
+          {
+            diff = std::max (diff, std::fabs (f(i) - fref(i)));
+            for (size_t j = 0; j < 2; j++)
+              diff = std::max ({ diff, std::fabs (df(i,j) - ref(i,j)), std::fabs (dfw(i,j) - ref(i,j)) });
+          }
+      }
+    bool chainok = diff < 1e-14;
+    std::cout << "chain rule: difference " << diff << (chainok ? "" : "  FAILED") << std::endl;
+    ok &= chainok;
+  }
+
+  ok &= CheckOrder ("RK4", 4, osc(RK4));
+  ok &= CheckOrder ("SSPRK3", 3, osc(SSPRK3));
+  ok &= CheckOrder ("DormandPrince5", 5, osc(DormandPrince5));
+  ok &= CheckOrder ("Verner6", 6, osc(Verner6), 10);
+  ok &= CheckOrder ("Williamson3", 3, osc(Williamson3));
+  ok &= CheckOrder ("CarpenterKennedy4", 4, osc(CarpenterKennedy4));
+
+  ok &= CheckOrder ("ROS2", 2, osc(ROS2));
+  ok &= CheckOrder ("ROS3P", 3, osc(ROS3P));
+  ok &= CheckOrder ("RODAS4", 4, osc(RODAS4));
+
+  // every tableau of the registry has the order it claims
+  struct { ButcherTableau::Family family; const char * name; int minstages, maxstages; } families[] =
+    {
+      { ButcherTableau::GAUSS, "Gauss", 1, 4 },
+      { ButcherTableau::RADAU_IIA, "RadauIIA", 1, 4 },
+      { ButcherTableau::LOBATTO_IIIC, "LobattoIIIC", 2, 4 },
+      { ButcherTableau::SDIRK, "SDIRK", 2, 3 },
+      { ButcherTableau::ESDIRK, "ESDIRK", 3, 3 },
+    };
+  for (auto & f : families)
+    for (int stages = f.minstages; stages <= f.maxstages; stages++)
+      {
+        auto & tableau = Tableau (f.family, stages);
+        ok &= CheckOrder (f.name + std::to_string(stages), tableau.order,
+                          osc([&] (auto rhs) { return std::make_shared<ImplicitRungeKutta>(rhs, tableau); }),
+                          tableau.order > 6 ? 5 : 10);
+      }
+
+  // BDF chooses its steps, the error has to follow the tolerance
+  double bdferror = 0;
+  for (double tol : { 1e-4, 1e-6, 1e-8 })
+    {
+      BDFOptions opts;
+      opts.rtol = opts.atol = tol;
+      double err = OscillatorError (std::make_shared<BDF>(oscillator, opts), 2, 1);
+      bool bdfok = err < 100*tol && (bdferror == 0 || err < bdferror/10);
+      std::cout << "BDF tol " << tol << ": error " << err << (bdfok ? "" : "  FAILED") << std::endl;
+      ok &= bdfok;
+      bdferror = err;
+    }
+
+  // linear problems are integrated exactly, up to rounding
+  {
+    double err = OscillatorError (std::make_shared<LinearExponential>(oscillator), 2, 3);
+    double errkrylov = OscillatorError (std::make_shared<ExponentialEuler>(oscillator, 2), 2, 3);
+    bool linok = err < 1e-13 && errkrylov < 1e-13;
+    std::cout << "LinearExponential: error " << err << ", Krylov ExponentialEuler: error "
+              << errkrylov << (linok ? "" : "  FAILED") << std::endl;
+    ok &= linok;
+  }
+
+  // exponential integrators on the Duffing oscillator, exact for the linear part
+  {
+    Matrix<> a(2, 2);
+    a = 0.0;
+    a(0,1) = 1;
+    a(1,0) = -1;
+    auto cubic = std::make_shared<Cubic>();
+    auto duffing = std::make_shared<MatVecFunc>(a, 1) + cubic;
+
+    Vector<> yref = { 1, 0 };
+    auto [refa, refb] = computeABfromC (Gauss3c);
+    ImplicitRungeKutta reference(duffing, refa, refb, Gauss3c);
+    for (int i = 0; i < 2000; i++)
+      reference.doStep (2.0/2000, yref);
+
+    auto error = [&] (auto make)
+    {
+      return [=] (int steps)
+      {
+        Vector<> y = { 1, 0 };
+        auto stepper = make();
+        for (int i = 0; i < steps; i++)
+          stepper->doStep (2.0/steps, y);
+        return std::hypot (y(0) - yref(0), y(1) - yref(1));
+      };
+    };
+    ok &= CheckOrder ("ExponentialEuler", 2,
+                      error([=] { return std::make_shared<ExponentialEuler>(duffing); }));
+    ok &= CheckOrder ("ETD2RK", 2, error([=] { return std::make_shared<ETDRungeKutta>(a, cubic, 2); }));
+    ok &= CheckOrder ("ETDRK4", 4, error([=] { return std::make_shared<ETDRungeKutta>(a, cubic, 4); }));
+  }
+
+  std::cout << (ok ? "all orders ok" : "order check FAILED") << std::endl;
+  return ok ? 0 : 1;
 }
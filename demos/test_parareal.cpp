@@ -0,0 +1,148 @@
+#include <iostream>
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+
+#include <nonlinfunc.hpp>
+#include <timestepper.hpp>
+#include <parareal.hpp>
+
+using namespace ASC_ode;
+
+
+class Oscillator : public NonlinearFunction
+{
+public:
+  size_t dimX() const override { return 2; }
+  size_t dimF() const override { return 2; }
+
+  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    f(0) = x(1);
+    f(1) = -x(0);
+  }
+
+  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    df = 0.0;
+    df(0,1) = 1;
+    df(1,0) = -1;
+  }
+};
+
+
+// y' = y^2, y(0) = 1 blows up at t = 1
+class BlowUp : public NonlinearFunction
+{
+public:
+  size_t dimX() const override { return 1; }
+  size_t dimF() const override { return 1; }
+
+  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    f(0) = x(0)*x(0);
+  }
+
+  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    df(0,0) = 2*x(0);
+  }
+};
+
+
+bool Check (const char * what, bool ok)
+{
+  std::cout << what << ": " << (ok ? "ok" : "FAILED") << std::endl;
+  return ok;
+}
+
+
+int main()
+{
+  bool ok = true;
+  auto coarse = [] { return std::make_shared<ImplicitEuler>(std::make_shared<Oscillator>()); };
+  auto fine = [] { return std::make_shared<ImprovedEuler>(std::make_shared<Oscillator>()); };
+  double tend = 10;
+
+  PararealOptions opts;
+  opts.slices = 16;
+  opts.coarsesteps = 2;
+  opts.finesteps = 100;
+
+  // the serial fine solution
+  Vector<> yfine = { 1, 0 };
+  {
+    auto stepper = fine();
+    double dT = tend / opts.slices;
+    for (size_t i = 0; i < opts.slices; i++)
+      for (int s = 0; s < opts.finesteps; s++)
+        stepper->doStep (dT/opts.finesteps, yfine);
+  }
+
+  {
+    // without a tolerance, all iterations give the fine solution
+    PararealOptions o = opts;
+    o.tol = 0;
+    o.threads = 4;
+    Vector<> y = { 1, 0 };
+    auto report = SolveODE_Parareal (coarse, fine, tend, y, o);
+    ok &= Check ("all iterations", report.converged && report.iterations == int(o.slices)
+                 && std::hypot (y(0)-yfine(0), y(1)-yfine(1)) < 1e-12);
+  }
+
+  {
+    // with a tolerance it stops early, close to the fine solution
+    PararealOptions o = opts;
+    o.tol = 1e-10;
+    o.threads = 4;
+    Vector<> y = { 1, 0 };
+    auto report = SolveODE_Parareal (coarse, fine, tend, y, o);
+    std::cout << report.iterations << " iterations, changes";
+    for (double c : report.changes)
+      std::cout << " " << c;
+    std::cout << std::endl;
+    ok &= Check ("tolerance", report.converged && report.iterations < int(o.slices)
+                 && report.changes.size() == size_t(report.iterations)
+                 && std::hypot (y(0)-yfine(0), y(1)-yfine(1)) < 1e-8);
+
+    // the result does not depend on the number of threads
+    o.threads = 1;
+    Vector<> y1 = { 1, 0 };
+    auto report1 = SolveODE_Parareal (coarse, fine, tend, y1, o);
+    ok &= Check ("threads", report1.iterations == report.iterations && y1(0) == y(0) && y1(1) == y(1));
+  }
+
+  {
+    // the fine Newton fails beyond the blow up, the caller gets the exception
+    auto coarse = [] { return std::make_shared<ExplicitEuler>(std::make_shared<BlowUp>()); };
+    auto fine = [] { return std::make_shared<ImplicitEuler>(std::make_shared<BlowUp>()); };
+    PararealOptions o;
+    o.slices = 16;
+    o.finesteps = 5;
+    o.threads = 4;
+    Vector<> y = { 1 };
+    bool thrown = false;
+    try
+      {
+        SolveODE_Parareal (coarse, fine, 3, y, o);
+      }
+    catch (std::exception &) { thrown = true; }
+    ok &= Check ("fine solve exception", thrown);
+  }
+
+  {
+    // a pool stays usable after a task threw
+    ThreadPool pool(3);
+    bool thrown = false;
+    try
+      {
+        pool.run (10, [] (size_t i, size_t) { if (i == 4) throw std::runtime_error("task 4"); });
+      }
+    catch (std::runtime_error &) { thrown = true; }
+    std::atomic<int> count{0};
+    pool.run (10, [&] (size_t, size_t) { count++; });
+    ok &= Check ("pool exception", thrown && count == 10);
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+#include <iostream>
+#include <cmath>
+#include <functional>
+#include <string>
+
+#include <nonlinfunc.hpp>
+#include <timestepper.hpp>
+#include <implicitRK.hpp>
+#include <adjoint.hpp>
+#include "mass_spring.hpp"
+#include "Newmark.hpp"
+
+using namespace ASC_ode;
+
+
+// two masses hanging from a fix, parameters: the two stiffnesses, the two masses
+MassSpringSystem<2> Pendulum (VectorView<double> p)
+{
+  MassSpringSystem<2> mss;
+  mss.setGravity ({ 0, -9.81 });
+  auto fix = mss.addFix ({ { 0, 0 } });
+  auto m1 = mss.addMass ({ p(2), { 1, 0 } });
+  auto m2 = mss.addMass ({ p(3), { 1, -1.2 } });
+  mss.addSpring ({ 1, p(0), { fix, m1 } });
+  mss.addSpring ({ 1, p(1), { m1, m2 } });
+  return mss;
+}
+
+using Stepper = std::function<std::shared_ptr<TimeStepper>(std::shared_ptr<NonlinearFunction>)>;
+
+// the first order system up to t = 1, with sensitivities if s is given
+Vector<> Run (Stepper make, VectorView<double> p, int steps, Matrix<> * s)
+{
+  auto mss = Pendulum(p);
+  auto stepper = make (FirstOrderSystem (std::make_shared<MSS_Function<2>>(mss)));
+  Vector<> x(4), v(4), a(4), y(8);
+  mss.getState (x, v, a);
+  y.range(0, 4) = x;
+  y.range(4, 8) = v;
+  for (int i = 0; i < steps; i++)
+    if (s)
+      stepper->doStepSensitivity (1.0/steps, y, *s);
+    else
+      stepper->doStep (1.0/steps, y);
+  return y;
+}
+
+// generalized alpha up to t = 1, with sensitivities if sens is given
+Vector<> RunAlpha (VectorView<double> p, int steps, AlphaSensitivity * sens)
+{
+  auto mss = Pendulum(p);
+  auto rhs = std::make_shared<MSS_Function<2>>(mss);
+  AlphaState state(4);
+  state.dt = 1.0/steps;
+  mss.getState (state.x, state.v, state.a);
+  rhs->evaluate (state.x, state.a);
+  if (sens)
+    rhs->evaluateParamDeriv (state.x, sens->a);
+  SolveODE_Alpha (state, sens, steps, rhs, std::make_shared<IdentityFunction>(4));
+  return state.x;
+}
+
+// largest deviation of the sensitivities s from central differences of run
+double SensitivityError (std::function<Vector<>(VectorView<double>)> run,
+                         VectorView<double> p, const Matrix<> & s)
+{
+  double err = 0;
+  for (size_t k = 0; k < p.size(); k++)
+    {
+      double h = 1e-6 * p(k);
+      Vector<> pp = p, pm = p;
+      pp(k) += h;
+      pm(k) -= h;
+      Vector<> yp = run(pp), ym = run(pm);
+      for (size_t i = 0; i < yp.size(); i++)
+        err = std::max (err, std::fabs ((yp(i)-ym(i))/(2*h) - s(i,k)));
+    }
+  return err;
+}
+
+
+// J = sum_k g_k(y_k) with g_k = 1/2 sum_i w_i y_k(i)^2 on the positions, every 7th step
+double Objective (size_t k, VectorView<double> y, VectorView<double> dgdy)
+{
+  if (k % 7) return 0;
+  double g = 0;
+  for (size_t i = 0; i < 4; i++)
+    {
+      double w = 0.3 + 0.1*i;
+      g += 0.5 * w * y(i)*y(i);
+      dgdy(i) += w * y(i);
+    }
+  return g;
+}
+
+AdjointResult RunAdjoint (Stepper make, VectorView<double> p, int steps, size_t checkpoints)
+{
+  auto mss = Pendulum(p);
+  auto stepper = make (FirstOrderSystem (std::make_shared<MSS_Function<2>>(mss)));
+  Vector<> x(4), v(4), a(4), y(8);
+  mss.getState (x, v, a);
+  y.range(0, 4) = x;
+  y.range(4, 8) = v;
+  return SolveAdjoint (*stepper, 1.0, steps, y, Objective, checkpoints);
+}
+
+AdjointResult RunAdjointAlpha (VectorView<double> p, int steps, size_t checkpoints)
+{
+  auto mss = Pendulum(p);
+  auto rhs = std::make_shared<MSS_Function<2>>(mss);
+  AlphaState state(4);
+  state.dt = 1.0/steps;
+  mss.getState (state.x, state.v, state.a);
+  rhs->evaluate (state.x, state.a);
+  auto res = SolveAdjoint_Alpha (state, steps, rhs, std::make_shared<IdentityFunction>(4),
+                                 Objective, checkpoints);
+  // the initial acceleration f(x_0; p)
+  rhs->addParamDerivTrans (state.x, res.initial.range(8, 12), res.gradient);
+  return res;
+}
+
+// largest deviation of the gradients from central differences of the
+// objective, for all numbers of checkpoints. The states are recomputed
+// exactly, so the gradients have to agree bitwise.
+bool CheckGradient (const std::string & name, std::function<AdjointResult(VectorView<double>,size_t)> run,
+                    VectorView<double> p)
+{
+  Vector<> fd(p.size());
+  for (size_t k = 0; k < p.size(); k++)
+    {
+      double h = 1e-6 * p(k);
+      Vector<> pp = p, pm = p;
+      pp(k) += h;
+      pm(k) -= h;
+      fd(k) = (run(pp, 0).objective - run(pm, 0).objective) / (2*h);
+    }
+
+  bool ok = true;
+  Vector<> grad0 = run(p, 0).gradient;
+  for (size_t checkpoints : { 0, 3, 1 })
+    {
+      auto res = run(p, checkpoints);
+      double err = 0;
+      bool same = true;
+      for (size_t k = 0; k < p.size(); k++)
+        {
+          err = std::max (err, std::fabs (res.gradient(k) - fd(k)));
+          same = same && res.gradient(k) == grad0(k);
+        }
+      bool gradok = err < 1e-7 && same;
+      std::cout << name << " adjoint gradient, "
+                << (checkpoints ? std::to_string(checkpoints) + " checkpoints" : "all states")
+                << ": error " << err
+                << (same ? "" : ", differs from the stored run") << (gradok ? "" : "  FAILED") << std::endl;
+      ok &= gradok;
+    }
+  return ok;
+}
+
+
+bool Check (const std::string & what, double err, double tol)
+{
+  bool ok = err < tol;
+  std::cout << what << ": error " << err << (ok ? "" : "  FAILED") << std::endl;
+  return ok;
+}
+
+
+int main()
+{
+  bool ok = true;
+  Vector<> p = { 50, 80, 1, 2 };
+  int steps = 50;
+
+  // forward sensitivities of full runs against central differences. The
+  // Jacobian of the last Newton step (instead of the one at the solution)
+  // gives errors of 1e-6 .. 1e-5 here.
+  std::pair<const char*, Stepper> steppers[] =
+    {
+      { "ImplicitEuler", [] (auto rhs) { return std::make_shared<ImplicitEuler>(rhs); } },
+      { "CrankNicolson", [] (auto rhs) { return std::make_shared<CrankNicolson>(rhs); } },
+      { "Gauss2", [] (auto rhs)
+        { return std::make_shared<ImplicitRungeKutta>(rhs, Tableau(ButcherTableau::GAUSS, 2)); } },
+    };
+  for (auto & [name, make] : steppers)
+    {
+      Matrix<> s(8, 4);
+      s = 0.0;
+      Run (make, p, steps, &s);
+      ok &= Check (std::string(name) + " forward sensitivity",
+                   SensitivityError ([&] (VectorView<double> q) { return Run (make, q, steps, nullptr); }, p, s),
+                   1e-7);
+    }
+
+  {
+    AlphaSensitivity sens(4, 4);
+    RunAlpha (p, steps, &sens);
+    ok &= Check ("generalized alpha forward sensitivity",
+                 SensitivityError ([&] (VectorView<double> q) { return RunAlpha (q, steps, nullptr); }, p, sens.x),
+                 1e-7);
+  }
+
+  // discrete adjoints, with and without checkpointing
+  for (auto & [name, make] : steppers)
+    ok &= CheckGradient (name, [&] (VectorView<double> q, size_t checkpoints)
+                         { return RunAdjoint (make, q, steps, checkpoints); }, p);
+  ok &= CheckGradient ("generalized alpha", [&] (VectorView<double> q, size_t checkpoints)
+                       { return RunAdjointAlpha (q, steps, checkpoints); }, p);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+#include <iostream>
+#include <cmath>
+#include <functional>
+#include <thread>
+
+#include <nonlinfunc.hpp>
+#include <timestepper.hpp>
+#include <implicitRK.hpp>
+
+using namespace ASC_ode;
+
+
+// built with ASC_ODE_STATS: the counters follow the work of the solvers,
+// per thread
+
+class Oscillator : public NonlinearFunction
+{
+public:
+  size_t dimX() const override { return 2; }
+  size_t dimF() const override { return 2; }
+
+  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    f(0) = x(1);
+    f(1) = -x(0);
+  }
+
+  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    df = 0.0;
+    df(0,1) = 1;
+    df(1,0) = -1;
+  }
+};
+
+
+// Van der Pol oscillator
+class VanDerPol : public NonlinearFunction
+{
+public:
+  size_t dimX() const override { return 2; }
+  size_t dimF() const override { return 2; }
+
+  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    f(0) = x(1);
+    f(1) = (1-x(0)*x(0))*x(1) - x(0);
+  }
+
+  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    df(0,0) = 0;
+    df(0,1) = 1;
+    df(1,0) = -2*x(0)*x(1) - 1;
+    df(1,1) = 1 - x(0)*x(0);
+  }
+};
+
+
+bool Check (const char * what, bool ok)
+{
+  std::cout << what << ": " << (ok ? "ok" : "FAILED") << std::endl;
+  return ok;
+}
+
+
+int main()
+{
+  bool ok = true;
+  auto rhs = std::make_shared<Oscillator>();
+  SolverStats & stats = solverStats();
+
+  {
+    stats.reset();
+    ExplicitEuler stepper(rhs);
+    Vector<> y = { 1, 0 };
+    for (int i = 0; i < 10; i++)
+      stepper.doStep (0.1, y);
+    ok &= Check ("explicit Euler", stats.steps == 10 && stats.function_evals == 10
+                 && stats.newton_solves == 0 && stats.factorizations == 0);
+  }
+
+  {
+    stats.reset();
+    ImplicitEuler stepper(rhs);
+    Vector<> y = { 1, 0 };
+    for (int i = 0; i < 10; i++)
+      stepper.doStep (0.1, y);
+    std::cout << stats;
+    ok &= Check ("implicit Euler", stats.steps == 10 && stats.newton_solves == 10
+                 && stats.newton_iterations >= 10 && stats.newton_failures == 0
+                 && stats.jacobian_evals == stats.newton_iterations
+                 && stats.factorizations == stats.newton_iterations
+                 && stats.function_evals == stats.newton_iterations + stats.newton_solves
+                 && stats.newton_max_iterations >= 1);
+  }
+
+  {
+    stats.reset();
+    ImplicitEuler stepper(rhs);
+    Vector<> y = { 1, 0 };
+    stepper.doStep (0.1, y);
+    size_t other = 1;
+    std::thread ([&] { other = solverStats().steps; }).join();
+    ok &= Check ("per thread", stats.steps == 1 && other == 0);
+  }
+
+  {
+    // the extrapolated initial guess saves Newton iterations, the solution
+    // stays the same up to the Newton tolerance
+    auto vdp = std::make_shared<VanDerPol>();
+    std::pair<const char*, std::function<std::shared_ptr<TimeStepper>()>> steppers[] =
+      {
+        { "predictor implicit Euler", [&] { return std::make_shared<ImplicitEuler>(vdp); } },
+        { "predictor Crank-Nicolson", [&] { return std::make_shared<CrankNicolson>(vdp); } },
+        { "predictor Radau IIA", [&]
+          { return std::make_shared<ImplicitRungeKutta>(vdp, Tableau(ButcherTableau::RADAU_IIA, 3)); } },
+      };
+    for (auto & [name, make] : steppers)
+      {
+        size_t iterations[2];
+        Vector<> y[2] = { { 2, 0 }, { 2, 0 } };
+        for (int predictor = 0; predictor < 2; predictor++)
+          {
+            auto stepper = make();
+            stepper->setPredictor (predictor);
+            stats.reset();
+            for (int i = 0; i < 400; i++)
+              stepper->doStep (0.01, y[predictor]);
+            iterations[predictor] = stats.newton_iterations;
+          }
+        std::cout << name << ": " << iterations[0] << " -> " << iterations[1] << " iterations" << std::endl;
+        ok &= Check (name, iterations[1] < 0.9*iterations[0]
+                     && std::hypot (y[0](0)-y[1](0), y[0](1)-y[1](1)) < 1e-8);
+      }
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+#include <iostream>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <trajectory.hpp>
+
+using namespace ASC_ode;
+
+
+// writes samples of a damped oscillation in dim components and reads them
+// back in random order, the stored values have to be bit identical
+template <typename WRITER, typename READER>
+bool RoundTrip (const std::string & name, const std::string & filename,
+                std::function<std::unique_ptr<WRITER>()> makeWriter)
+{
+  size_t dim = 5, nsamples = 1000;
+  auto sample = [&] (size_t i, size_t j)
+  {
+    return std::exp(-0.001*i) * std::cos(0.01*i + j);
+  };
+
+  {
+    auto writer = makeWriter();
+    Vector<> x(dim);
+    for (size_t i = 0; i < nsamples; i++)
+      {
+        for (size_t j = 0; j < dim; j++)
+          x(j) = sample(i, j);
+        writer->add (0.5*i, x);
+      }
+    writer->close();
+  }
+
+  READER reader(filename);
+  bool ok = reader.size() == nsamples && reader.dim() == dim;
+  Vector<> x(dim);
+  for (size_t k = 0; k < nsamples && ok; k++)
+    {
+      size_t i = (k*389) % nsamples;
+      reader.get (i, x);
+      ok = reader.time(i) == 0.5*i;
+      for (size_t j = 0; j < dim; j++)
+        ok = ok && x(j) == sample(i, j);
+    }
+  ok = ok && reader.find (100) == 200 && reader.find (100.1) == 201 && reader.find (1e6) == nsamples;
+
+  try
+    {
+      reader.get (nsamples, x);
+      ok = false;
+    }
+  catch (std::out_of_range &) { }
+
+  std::cout << name << ": " << (ok ? "ok" : "FAILED") << std::endl;
+  return ok;
+}
+
+
+int main()
+{
+  bool ok = true;
+  for (auto [comp, name] : { std::pair { Compression::NONE, "native, uncompressed" },
+                             std::pair { Compression::SHUFFLE, "native, shuffle" }
+#ifdef ASC_ODE_HAVE_ZSTD
+                             , std::pair { Compression::SHUFFLE_ZSTD, "native, shuffle + zstd" }
+#endif
+      })
+    ok &= RoundTrip<TrajectoryWriter, TrajectoryReader>
+      (name, "test_trajectory.trj", [comp=comp] ()
+       { return std::make_unique<TrajectoryWriter>("test_trajectory.trj", 5, 64, 1, comp); });
+
+#ifdef ASC_ODE_HAVE_HDF5
+  ok &= RoundTrip<HDF5TrajectoryWriter, HDF5TrajectoryReader>
+    ("HDF5", "test_trajectory.h5", [] ()
+     { return std::make_unique<HDF5TrajectoryWriter>("test_trajectory.h5", 5, 64); });
+#endif
+
+  return ok ? 0 : 1;
+}
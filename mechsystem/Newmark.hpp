@@ -1,7 +1,10 @@
 #ifndef NEWMARK_HPP
 #define NEWMARK_HPP
 
+#include <stdexcept>
+
 #include <nonlinfunc.hpp>
+#include <adjoint.hpp>
 
 
 
@@ -23,11 +26,13 @@
 
     Vector<> a(x.size());
     Vector<> v(x.size());
+    Vector<> aprev(x.size());
 
     auto xold = std::make_shared<ConstantFunction>(x);
     auto vold = std::make_shared<ConstantFunction>(dx);
     auto aold = std::make_shared<ConstantFunction>(x);
     rhs->evaluate (xold->get(), aold->get());
+    ASC_ODE_STATS_ADD(function_evals, 1);
 
     auto anew = std::make_shared<IdentityFunction>(a.size());
     auto vnew = vold + dt*((1-gamma)*aold+gamma*anew);
@@ -38,10 +43,16 @@
     double t = 0;
     for (int i = 0; i < steps; i++)            
       {
+        ASC_ODE_STATS_ADD(steps, 1);
+        // linear extrapolation of the acceleration as initial guess
+        if (i > 0)
+          for (size_t j = 0; j < a.size(); j++)
+            a(j) += a(j) - aprev(j);
         NewtonSolver (equ, a);
         xnew -> evaluate (a, x);
         vnew -> evaluate (a, v);
 
+        aprev = aold->get();
         xold->set(x);
         vold->set(v);
         aold->set(a);
@@ -54,25 +65,62 @@
 
 
 
-  // Generalized alpha method for M d^2x/dt^2 = rhs
-  void SolveODE_Alpha (double tend, int steps, double rhoinf,
-                       VectorView<double> x, VectorView<double> dx, VectorView<double> ddx,
+  // complete state of a generalized alpha run. Continuing from a stored
+  // state reproduces the uninterrupted run bit by bit.
+  class AlphaState
+  {
+  public:
+    AlphaState (size_t n = 0) : x(n), v(n), a(n), aprev(n) { }
+
+    double time = 0;
+    double dt = 0;
+    double rhoinf = 0.8;
+    size_t step = 0;
+    Vector<> x, v, a;
+    // acceleration one step before a, extrapolated for the Newton initial guess
+    bool hasprev = false;
+    Vector<> aprev;
+  };
+
+
+  // sensitivities dx/dp, dv/dp, da/dp of a generalized alpha run to the
+  // parameters of a ParameterizedFunction rhs, each n x numParams
+  class AlphaSensitivity
+  {
+  public:
+    AlphaSensitivity (size_t n = 0, size_t np = 0) : x(n, np), v(n, np), a(n, np)
+    {
+      x = 0.0;
+      v = 0.0;
+      a = 0.0;
+    }
+
+    Matrix<> x, v, a;
+  };
+
+
+  // Generalized alpha method for M d^2x/dt^2 = rhs, advancing state by
+  // steps. With sens the sensitivities are propagated as well: one solve
+  // with the Newton Jacobian per step, the mass is assumed to be linear.
+  void SolveODE_Alpha (AlphaState & state, AlphaSensitivity * sens, int steps,
                        std::shared_ptr<NonlinearFunction> rhs,   
                        std::shared_ptr<NonlinearFunction> mass,  
                        std::function<void(double,VectorView<double>)> callback = nullptr)
   {
-    double dt = tend/steps;
+    double dt = state.dt;
+    double rhoinf = state.rhoinf;
     double alpham = (2*rhoinf-1)/(rhoinf+1);
     double alphaf = rhoinf/(rhoinf+1);
     double gamma = 0.5-alpham+alphaf;
     double beta = 0.25 * (1-alpham+alphaf)*(1-alpham+alphaf);
 
-    Vector<> a(x.size());
-    Vector<> v(x.size());
+    VectorView<double> x = state.x;
+    VectorView<double> a = state.a;
+    VectorView<double> v = state.v;
 
     auto xold = std::make_shared<ConstantFunction>(x);
-    auto vold = std::make_shared<ConstantFunction>(dx);
-    auto aold = std::make_shared<ConstantFunction>(ddx);
+    auto vold = std::make_shared<ConstantFunction>(v);
+    auto aold = std::make_shared<ConstantFunction>(a);
     // rhs->evaluate (xold->get(), aold->get()); // solve with M ???
 
     auto anew = std::make_shared<IdentityFunction>(a.size());
@@ -82,23 +130,216 @@
     // auto equ = Compose(mass, (1-alpham)*anew+alpham*aold) - Compose(rhs, (1-alphaf)*xnew+alphaf*xold);
     auto equ = Compose(mass, (1-alpham)*anew+alpham*aold) - (1-alphaf)*Compose(rhs,xnew) - alphaf*Compose(rhs, xold);
 
-    double t = 0;
-    a = ddx;
+    // d/dp of the equation at the new acceleration:
+    // J sa_new = -alpham M sa + (1-alphaf) (f_x(xnew) (sx + dt sv + dt^2/2 (1-2beta) sa) + f_p(xnew))
+    //            + alphaf (f_x(xold) sx + f_p(xold))
+    std::shared_ptr<ParameterizedFunction> prhs;
+    size_t n = x.size(), np = 0;
+    if (sens)
+      {
+        prhs = std::dynamic_pointer_cast<ParameterizedFunction>(rhs);
+        if (!prhs)
+          throw std::invalid_argument("SolveODE_Alpha: sensitivities need a ParameterizedFunction as rhs");
+        np = prhs->numParams();
+        if (sens->x.rows() != n || sens->x.cols() != np)
+          throw std::invalid_argument("SolveODE_Alpha: sensitivities have wrong dimension");
+      }
+    Matrix<> jacinv(n, sens ? n : 0), dmass(n, sens ? n : 0);
+    Matrix<> fxold(n, sens ? n : 0), fxnew(n, sens ? n : 0);
+    Matrix<> fpold(n, np), fpnew(n, np), r(n, np), sxpred(n, np), sanew(n, np);
+    if (sens)
+      {
+        ASC_ODE_STATS_ADD(jacobian_evals, 2);
+        mass->evaluateDeriv (a, dmass);
+        prhs->evaluateDeriv (x, fxold);
+        prhs->evaluateParamDeriv (x, fpold);
+      }
 
     for (int i = 0; i < steps; i++)
       {
-        NewtonSolver (equ, a);
+        ASC_ODE_STATS_ADD(steps, 1);
+        if (state.hasprev)
+          for (size_t j = 0; j < n; j++)
+            a(j) += a(j) - state.aprev(j);
+        if (!sens)
+          NewtonSolver (equ, a);
+        else
+          NewtonSolver (equ, a, jacinv);
         xnew -> evaluate (a, x);
         vnew -> evaluate (a, v);
 
+        if (sens)
+          {
+            // f_x, f_p at xnew are reused as the old ones of the next step
+            ASC_ODE_STATS_ADD(jacobian_evals, 1);
+            prhs->evaluateDeriv (x, fxnew);
+            prhs->evaluateParamDeriv (x, fpnew);
+
+            sxpred = sens->x;
+            sxpred += dt * sens->v;
+            sxpred += dt*dt/2*(1-2*beta) * sens->a;
+
+            r = fxnew * sxpred;
+            r += fpnew;
+            r *= 1-alphaf;
+            r += alphaf * (fxold * sens->x);
+            r += alphaf * fpold;
+            r -= alpham * (dmass * sens->a);
+            sanew = jacinv * r;
+
+            sens->x = sxpred;
+            sens->x += dt*dt*beta * sanew;
+            sens->v += dt*(1-gamma) * sens->a;
+            sens->v += dt*gamma * sanew;
+            sens->a = sanew;
+            fxold = fxnew;
+            fpold = fpnew;
+          }
+
+        state.aprev = aold->get();
+        state.hasprev = true;
         xold->set(x);
         vold->set(v);
         aold->set(a);
-        t += dt;
-        if (callback) callback(t, x);
+        state.time += dt;
+        state.step++;
+        if (callback) callback(state.time, x);
       }
-    dx = v;
-    ddx = a;
+  }
+
+
+  // Generalized alpha method for M d^2x/dt^2 = rhs, advancing state by steps
+  void SolveODE_Alpha (AlphaState & state, int steps,
+                       std::shared_ptr<NonlinearFunction> rhs,   
+                       std::shared_ptr<NonlinearFunction> mass,  
+                       std::function<void(double,VectorView<double>)> callback = nullptr)
+  {
+    SolveODE_Alpha (state, nullptr, steps, rhs, mass, callback);
+  }
+
+
+  // discrete adjoint of the generalized alpha method for J = sum_k g_k(z_k)
+  // with the states z_k = (x, v, a) after k steps, starting from state.
+  // rhs has to be a ParameterizedFunction, the mass is assumed to be linear.
+  // If the initial acceleration depends on p, add its part via result.initial.
+  AdjointResult SolveAdjoint_Alpha (const AlphaState & state, int steps,
+                                    std::shared_ptr<NonlinearFunction> rhs,
+                                    std::shared_ptr<NonlinearFunction> mass,
+                                    AdjointObjective objective, size_t checkpoints = 0)
+  {
+    double dt = state.dt;
+    double rhoinf = state.rhoinf;
+    double alpham = (2*rhoinf-1)/(rhoinf+1);
+    double alphaf = rhoinf/(rhoinf+1);
+    double gamma = 0.5-alpham+alphaf;
+    double beta = 0.25 * (1-alpham+alphaf)*(1-alpham+alphaf);
+
+    auto prhs = std::dynamic_pointer_cast<ParameterizedFunction>(rhs);
+    if (!prhs)
+      throw std::invalid_argument("SolveAdjoint_Alpha: needs a ParameterizedFunction as rhs");
+    size_t n = state.x.size();
+
+    auto xold = std::make_shared<ConstantFunction>(n);
+    auto vold = std::make_shared<ConstantFunction>(n);
+    auto aold = std::make_shared<ConstantFunction>(n);
+    auto anew = std::make_shared<IdentityFunction>(n);
+    auto vnew = vold + dt*((1-gamma)*aold+gamma*anew);
+    auto xnew = xold + dt*vold + dt*dt/2 * ((1-2*beta)*aold+2*beta*anew);
+    auto equ = Compose(mass, (1-alpham)*anew+alpham*aold) - (1-alphaf)*Compose(rhs,xnew) - alphaf*Compose(rhs, xold);
+
+    Matrix<> dmass(n, n), jacinv(n, n), fxold(n, n), fxnew(n, n);
+    Vector<> xo(n), la(n), mu(n), w(n), tmp(n), laold(n);
+    ASC_ODE_STATS_ADD(jacobian_evals, 1);
+    mass->evaluateDeriv (state.a, dmass);
+
+    // z = (x, v, a), the old acceleration is the initial guess: the recomputed
+    // steps have no history to extrapolate
+    auto step = [&] (VectorView<double> z, Matrix<> * jac)
+    {
+      VectorView<double> x = z.range(0, n), v = z.range(n, 2*n), a = z.range(2*n, 3*n);
+      xold->set(x);
+      vold->set(v);
+      aold->set(a);
+      ASC_ODE_STATS_ADD(steps, 1);
+      if (jac)
+        NewtonSolver (equ, a, *jac);
+      else
+        NewtonSolver (equ, a);
+      xnew -> evaluate (a, x);
+      vnew -> evaluate (a, v);
+    };
+
+    // with the adjoint la of the effective new acceleration and mu = J^-T la, w = f_x(xnew)^T mu:
+    // lx_old = lx + (1-alphaf) w + alphaf f_x(xold)^T mu
+    // lv_old = lv + dt lx + (1-alphaf) dt w
+    // la_old = dt^2/2 (1-2beta) (lx + (1-alphaf) w) + dt (1-gamma) lv - alpham M^T mu
+    auto adjointstep = [&] (size_t, VectorView<double> z, VectorView<double> lambda,
+                            VectorView<double> grad)
+    {
+      VectorView<double> lx = lambda.range(0, n), lv = lambda.range(n, 2*n),
+        lacc = lambda.range(2*n, 3*n);
+      xo = z.range(0, n);
+      step (z, &jacinv);
+
+      ASC_ODE_STATS_ADD(jacobian_evals, 2);
+      prhs->evaluateDeriv (z.range(0, n), fxnew);
+      prhs->evaluateDeriv (xo, fxold);
+
+      la = lacc;
+      la += dt*dt*beta * lx;
+      la += dt*gamma * lv;
+      MultTrans (jacinv, la, mu);
+      MultTrans (fxnew, mu, w);
+
+      tmp = (1-alphaf) * mu;
+      prhs->addParamDerivTrans (z.range(0, n), tmp, grad);
+      tmp = alphaf * mu;
+      prhs->addParamDerivTrans (xo, tmp, grad);
+
+      MultTrans (dmass, mu, tmp);
+      laold = dt*dt/2*(1-2*beta) * lx;
+      laold += dt*dt/2*(1-2*beta)*(1-alphaf) * w;
+      laold += dt*(1-gamma) * lv;
+      laold -= alpham * tmp;
+
+      lv += dt * lx;
+      lv += (1-alphaf)*dt * w;
+
+      MultTrans (fxold, mu, tmp);
+      lx += (1-alphaf) * w;
+      lx += alphaf * tmp;
+      lacc = laold;
+    };
+
+    Vector<> z0(3*n);
+    z0.range(0, n) = state.x;
+    z0.range(n, 2*n) = state.v;
+    z0.range(2*n, 3*n) = state.a;
+    return SolveAdjoint (prhs->numParams(), steps, z0,
+                         [&] (size_t, VectorView<double> z) { step (z, nullptr); },
+                         adjointstep, objective, checkpoints);
+  }
+
+
+  // Generalized alpha method for M d^2x/dt^2 = rhs
+  void SolveODE_Alpha (double tend, int steps, double rhoinf,
+                       VectorView<double> x, VectorView<double> dx, VectorView<double> ddx,
+                       std::shared_ptr<NonlinearFunction> rhs,   
+                       std::shared_ptr<NonlinearFunction> mass,  
+                       std::function<void(double,VectorView<double>)> callback = nullptr)
+  {
+    AlphaState state(x.size());
+    state.dt = tend/steps;
+    state.rhoinf = rhoinf;
+    state.x = x;
+    state.v = dx;
+    state.a = ddx;
+
+    SolveODE_Alpha (state, steps, rhs, mass, callback);
+
+    x = state.x;
+    dx = state.v;
+    ddx = state.a;
   }
 
 
@@ -2,12 +2,29 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/stl_bind.h>
+#include <pybind11/numpy.h>
 
 #include "mass_spring.hpp"
 #include "Newmark.hpp"
+#include "constrained_alpha.hpp"
+#include "rattle.hpp"
+#include "multirate.hpp"
+#include <bdf.hpp>
+#include "checkpoint.hpp"
+#include "mss_file.hpp"
 
 namespace py = pybind11;
 
+template <typename T>
+using carray = py::array_t<T, py::array::c_style | py::array::forcecast>;
+
+template <typename T>
+void checkShape (const carray<T> & a, size_t rows, size_t cols, const char * name)
+{
+  if (a.size() != py::ssize_t(rows*cols) || (cols > 1 && (a.ndim() != 2 || a.shape(1) != py::ssize_t(cols))))
+    throw std::invalid_argument(std::string(name)+" has wrong shape");
+}
+
 PYBIND11_MAKE_OPAQUE(std::vector<Mass<3>>);
 PYBIND11_MAKE_OPAQUE(std::vector<Fix<3>>);
 PYBIND11_MAKE_OPAQUE(std::vector<Spring>);
@@ -69,6 +86,11 @@ PYBIND11_MODULE(mass_spring, m) {
 
     py::class_<Spring> (m, "Spring")
       .def(py::init<double, double, std::array<Connector,2>>())
+      .def(py::init([](double length, double stiffness, std::array<Connector,2> connectors,
+                       double breakstrain) {
+        return Spring{length, stiffness, connectors, breakstrain};
+      }), py::arg("length"), py::arg("stiffness"), py::arg("connectors"), py::arg("breakstrain"))
+      .def_readwrite("breakstrain", &Spring::breakstrain)
       .def_property_readonly("connectors",
                              [](Spring & s) { return s.connectors; })
       ;
@@ -86,6 +108,17 @@ PYBIND11_MODULE(mass_spring, m) {
     py::bind_vector<std::vector<Joint>>(m, "Joints");
     
     
+    // integrator state of a run, returned by loadCheckpoint and passed to
+    // simulate to continue the run exactly
+    py::class_<AlphaState> (m, "AlphaState")
+      .def_readonly("time", &AlphaState::time)
+      .def_readonly("dt", &AlphaState::dt)
+      .def_readonly("step", &AlphaState::step)
+      .def_readonly("rhoinf", &AlphaState::rhoinf)
+      .def_property_readonly("x", [](AlphaState & s) { return std::vector<double>(s.x); })
+      ;
+
+
     py::class_<MassSpringSystem<2>> (m, "MassSpringSystem2d")
       .def(py::init<>())
       .def("add", [](MassSpringSystem<2> & mss, Mass<2> m) { return mss.addMass(m); })
@@ -101,10 +134,66 @@ PYBIND11_MODULE(mass_spring, m) {
       })
       .def_property("gravity", [](MassSpringSystem<3> & mss) { return mss.getGravity(); },
                     [](MassSpringSystem<3> & mss, std::array<double,3> g) { mss.setGravity(Vec<3>{g[0],g[1],g[2]}); })
+      // penalty contact between masses of the given radius and with the plane z = ground
+      .def("setContact", [](MassSpringSystem<3> & mss, double radius, double stiffness,
+                            std::optional<double> ground, double ground_stiffness) {
+        ContactParameters contact;
+        contact.radius = radius;
+        contact.stiffness = stiffness;
+        if (ground)
+          {
+            contact.ground = *ground;
+            contact.groundstiffness = ground_stiffness;
+          }
+        mss.setContact (contact);
+      }, py::arg("radius"), py::arg("stiffness"), py::arg("ground") = py::none(), py::arg("ground_stiffness") = 0.0)
       .def("add", [](MassSpringSystem<3> & mss, Mass<3> m) { return mss.addMass(m); })
       .def("add", [](MassSpringSystem<3> & mss, Fix<3> f) { return mss.addFix(f); })
       .def("add", [](MassSpringSystem<3> & mss, Spring s) { return mss.addSpring(s); })
       .def("add", [](MassSpringSystem<3> & mss, Joint j) { return mss.addJoint(j); })
+
+      // bulk construction from numpy arrays, returns the number of the first new entity
+      .def("addFixes", [](MassSpringSystem<3> & mss, carray<double> pos) {
+        size_t n = pos.ndim() ? pos.shape(0) : 0;
+        checkShape (pos, n, 3, "pos");
+        py::gil_scoped_release release;
+        return mss.addFixes (n, pos.data());
+      }, py::arg("pos"))
+      .def("addMasses", [](MassSpringSystem<3> & mss, carray<double> mass, carray<double> pos,
+                           std::optional<carray<double>> vel) {
+        size_t n = mass.size();
+        checkShape (pos, n, 3, "pos");
+        if (vel) checkShape (*vel, n, 3, "vel");
+        py::gil_scoped_release release;
+        return mss.addMasses (n, mass.data(), pos.data(), vel ? vel->data() : nullptr);
+      }, py::arg("mass"), py::arg("pos"), py::arg("vel") = py::none())
+      .def("addSprings", [](MassSpringSystem<3> & mss, carray<uint64_t> pairs, carray<double> stiffness,
+                            std::optional<carray<double>> length, std::optional<carray<uint8_t>> isfix,
+                            std::optional<carray<double>> breakstrain) {
+        size_t n = pairs.ndim() ? pairs.shape(0) : 0;
+        checkShape (pairs, n, 2, "pairs");
+        checkShape (stiffness, n, 1, "stiffness");
+        if (length) checkShape (*length, n, 1, "length");
+        if (isfix) checkShape (*isfix, n, 2, "isfix");
+        if (breakstrain) checkShape (*breakstrain, n, 1, "breakstrain");
+        py::gil_scoped_release release;
+        return mss.addSprings (n, pairs.data(), stiffness.data(),
+                               length ? length->data() : nullptr,
+                               isfix ? isfix->data() : nullptr,
+                               breakstrain ? breakstrain->data() : nullptr);
+      }, py::arg("pairs"), py::arg("stiffness"), py::arg("length") = py::none(), py::arg("isfix") = py::none(),
+         py::arg("breakstrain") = py::none())
+      .def("reserve", &MassSpringSystem<3>::reserve,
+           py::arg("masses"), py::arg("springs"), py::arg("fixes") = 0, py::arg("joints") = 0)
+
+      // native memory mappable model files
+      .def("save", [](MassSpringSystem<3> & mss, std::string filename) { SaveModel (filename, mss); })
+      .def_static("load", [](std::string filename) {
+        MassSpringSystem<3> mss;
+        LoadModel (filename, mss);
+        return mss;
+      })
+
       .def_property_readonly("masses", [](MassSpringSystem<3> & mss) -> auto& { return mss.masses(); })
       .def_property_readonly("fixes", [](MassSpringSystem<3> & mss) -> auto& { return mss.fixes(); })
       .def_property_readonly("springs", [](MassSpringSystem<3> & mss) -> auto& { return mss.springs(); })
@@ -122,22 +211,158 @@ PYBIND11_MODULE(mass_spring, m) {
         return std::vector<double>(x);
       })
 
-      // call solver
-      .def("simulate", [](MassSpringSystem<3> & mss, double tend, size_t steps) {
+      // removes the springs strained beyond their breakstrain, returns their number
+      .def("breakSprings", [](MassSpringSystem<3> & mss) {
+        Vector<> x(3*mss.masses().size()), v(3*mss.masses().size()), a(3*mss.masses().size());
+        mss.getState (x, v, a);
+        return mss.breakSprings (x);
+      })
+
+      // call solver, optionally writing a checkpoint every checkpoint_every steps.
+      // method "constrained" solves the joint multipliers by a Schur complement,
+      // "rattle" is explicit with exact joint lengths, "multirate" takes substeps
+      // Verlet steps for the stiff masses (without joints and contact), "bdf" is
+      // adaptive variable order BDF with tolerances rtol, atol, without joints
+      // (all three without checkpoints)
+      // state (from loadCheckpoint) resumes that run and is advanced in place
+      .def("simulate", [](MassSpringSystem<3> & mss, double tend, size_t steps,
+                          std::string checkpoint, size_t checkpoint_every, std::string method,
+                          int substeps, double rtol, double atol, AlphaState * resume) {
+        if (method != "alpha" && method != "constrained" && method != "rattle" && method != "multirate"
+            && method != "bdf")
+          throw std::invalid_argument("unknown method '"+method+"'");
+        if (method == "bdf" && mss.joints().size() > 0)
+          throw std::invalid_argument("method 'bdf' does not support joints");
+        if ((method == "bdf" || method == "multirate" || method == "rattle")
+            && (!checkpoint.empty() || checkpoint_every > 0))
+          throw std::invalid_argument("method '"+method+"' does not write checkpoints");
+
         const size_t m = mss.masses().size();
         const size_t j = mss.joints().size();
 
-        Vector<> x(3*m + j);
-        Vector<> dx(3*m + j);
-        Vector<> ddx(3*m + j);
-        mss.getState (x, dx, ddx);
+        // a fresh run starts from the state of the system, a resumed one
+        // (from loadCheckpoint) continues time, step count, multipliers and
+        // predictor history, and is updated in place. The history belongs
+        // to the step size of the checkpoint (if it made steps at all),
+        // which has to be kept.
+        AlphaState fresh(3*m + j);
+        if (resume && resume->x.size() != 3*m + j)
+          throw std::invalid_argument("state does not fit the system");
+        if (resume && resume->dt > 0 && std::abs (tend/steps - resume->dt) > 1e-12 * resume->dt)
+          throw std::invalid_argument("resumed run needs the step size of the checkpoint, dt = "
+                                      + std::to_string(resume->dt));
+        AlphaState & state = resume ? *resume : fresh;
+        if (!resume)
+          mss.getState (state.x, state.v, state.a);
+        state.dt = tend/steps;
 
         auto mss_func = std::make_shared<MSS_Function<3>> (mss);
-        auto mass = std::make_shared<Projector> (x.size(), 0, mss.masses().size()*3);
+        auto mass = std::make_shared<Projector> (state.x.size(), 0, mss.masses().size()*3);
+
+        // springs break after every step, checkpoints every checkpoint_every steps
+        std::function<void(double,VectorView<double>)> callback = [&] (double t, VectorView<double> x)
+          {
+            mss.breakSprings (x);
+            if (!checkpoint.empty() && checkpoint_every > 0 && state.step % checkpoint_every == 0)
+              {
+                MassSpringSystem<3> snapshot = mss;
+                snapshot.setState (state.x, state.v, state.a);
+                SaveCheckpoint (checkpoint, snapshot, state);
+              }
+          };
 
-        SolveODE_Alpha(tend, steps, 0.8, x, dx, ddx, mss_func, mass);
+        if (method == "bdf")
+          {
+            // y = (x, v), unit mass matrix as for the alpha method
+            size_t n = 3*m;
+            BDFOptions opts;
+            opts.rtol = rtol;
+            opts.atol = atol;
+            BDF stepper(FirstOrderSystem(mss_func), opts);
+            Vector<> y(2*n);
+            y.range(0, n) = state.x;
+            y.range(n, 2*n) = state.v;
+            for (size_t i = 0; i < steps; i++)
+              {
+                stepper.doStep (tend/steps, y);
+                mss.breakSprings (y.range(0, n));
+              }
+            state.x = y.range(0, n);
+            state.v = y.range(n, 2*n);
+          }
+        else if (method == "multirate")
+          SolveODE_Multirate(mss, tend, steps, substeps, state.x, state.v,
+                             [&] (double t, VectorView<double> x) { mss.breakSprings (x); });
+        else if (method == "rattle")
+          SolveODE_Rattle(mss, tend, steps, state.x, state.v,
+                          [&] (double t, VectorView<double> x) { mss.breakSprings (x); });
+        else if (method == "constrained")
+          SolveODE_ConstrainedAlpha(mss, state, steps, callback);
+        else
+          SolveODE_Alpha(state, steps, mss_func, mass, callback);
 
-        mss.setState (x, dx, ddx);
+        if (method == "bdf" || method == "multirate" || method == "rattle")
+          {
+            // the accelerations of the final positions, from springs, gravity
+            // and contact; these methods do not use the multipliers
+            Vector<> x = state.x;
+            x.range(3*m, 3*m+j) = 0.0;
+            mss_func->evaluate (x, state.a);
+            state.time += tend;
+            state.step += steps;
+            state.hasprev = false;
+          }
+        mss.setState (state.x, state.v, state.a);
+      }, py::arg("tend"), py::arg("steps"), py::arg("checkpoint") = "", py::arg("checkpoint_every") = 0,
+         py::arg("method") = "alpha", py::arg("substeps") = 4,
+         py::arg("rtol") = 1e-6, py::arg("atol") = 1e-8, py::arg("state") = nullptr)
+
+      // counters of the solvers run by this thread (compiled with ASC_ODE_STATS)
+      .def_static("getSolverStats", [] () {
+        const SolverStats & s = solverStats();
+        py::dict d;
+        d["function_evals"] = s.function_evals;
+        d["jacobian_evals"] = s.jacobian_evals;
+        d["factorizations"] = s.factorizations;
+        d["newton_solves"] = s.newton_solves;
+        d["newton_iterations"] = s.newton_iterations;
+        d["newton_iterations_per_solve"] = s.newtonIterationsPerSolve();
+        d["newton_max_iterations"] = s.newton_max_iterations;
+        d["newton_failures"] = s.newton_failures;
+        d["linear_iterations"] = s.linear_iterations;
+        d["steps"] = s.steps;
+        d["rejected_steps"] = s.rejected_steps;
+        d["alloc_bytes"] = s.alloc_bytes;
+        d["time_function"] = s.time_function;
+        d["time_jacobian"] = s.time_jacobian;
+        d["time_factorization"] = s.time_factorization;
+        d["time_linear"] = s.time_linear;
+#ifdef ASC_ODE_STATS
+        d["enabled"] = true;
+#else
+        d["enabled"] = false;
+#endif
+        return d;
+      })
+      .def_static("resetSolverStats", [] () { solverStats().reset(); })
+
+      .def("saveCheckpoint", [](MassSpringSystem<3> & mss, std::string filename, AlphaState * state) {
+        if (state)
+          {
+            SaveCheckpoint (filename, mss, *state);
+            return;
+          }
+        AlphaState fresh(3*mss.masses().size() + mss.joints().size());
+        mss.getState (fresh.x, fresh.v, fresh.a);
+        SaveCheckpoint (filename, mss, fresh);
+      }, py::arg("filename"), py::arg("state") = nullptr)
+      
+      // replaces the system by the checkpointed one and returns the
+      // integrator state, simulate(..., state=...) continues the run
+      .def("loadCheckpoint", [](MassSpringSystem<3> & mss, std::string filename) {
+        AlphaState state = LoadCheckpoint (filename, mss);
+        mss.setState (state.x, state.v, state.a);
+        return state;
       });
 
 
@@ -0,0 +1,338 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "mass_spring.hpp"
+#include "Newmark.hpp"
+
+
+// Binary checkpoints of a MassSpringSystem together with the state of
+// the generalized alpha integrator.
+//
+// layout: "ASCCKP04", D, system, integrator state, FNV-1a hash of all
+// preceding bytes. Version 01 files (springs without breakstrain), 02
+// files (no previous acceleration) and 03 files (no contact parameters)
+// are still read. Files are written to <filename>.tmp and renamed, so a
+// checkpoint on disk is always complete.
+
+namespace checkpoint_detail
+{
+  inline constexpr char magic[8] = { 'A','S','C','C','K','P','0','4' };
+  inline constexpr size_t versionpos = 6;   // two digit version in the magic
+
+  class Writer
+  {
+    std::vector<char> m_buffer;
+  public:
+    template <typename T>
+    void put (T val)
+    {
+      const char * p = reinterpret_cast<const char*>(&val);
+      m_buffer.insert (m_buffer.end(), p, p+sizeof(T));
+    }
+
+    void putVector (VectorView<double> v)
+    {
+      put<uint64_t> (v.size());
+      for (size_t i = 0; i < v.size(); i++)
+        put<double> (v(i));
+    }
+
+    template <size_t D>
+    void putVec (const Vec<D> & v)
+    {
+      for (size_t i = 0; i < D; i++)
+        put<double> (v(i));
+    }
+
+    void putConnector (const Connector & c)
+    {
+      put<uint32_t> (c.type);
+      put<uint64_t> (c.nr);
+    }
+
+    const std::vector<char> & buffer() const { return m_buffer; }
+  };
+
+  class Reader
+  {
+    const std::vector<char> & m_buffer;
+    size_t m_pos = 0;
+  public:
+    Reader (const std::vector<char> & buffer) : m_buffer(buffer) { }
+
+    template <typename T>
+    T get ()
+    {
+      if (m_pos+sizeof(T) > m_buffer.size())
+        throw std::runtime_error("checkpoint: unexpected end of file");
+      T val;
+      std::memcpy (&val, m_buffer.data()+m_pos, sizeof(T));
+      m_pos += sizeof(T);
+      return val;
+    }
+
+    Vector<> getVector ()
+    {
+      Vector<> v(get<uint64_t>());
+      for (size_t i = 0; i < v.size(); i++)
+        v(i) = get<double>();
+      return v;
+    }
+
+    template <int D>
+    Vec<D> getVec ()
+    {
+      Vec<D> v;
+      for (int i = 0; i < D; i++)
+        v(i) = get<double>();
+      return v;
+    }
+
+    Connector getConnector ()
+    {
+      Connector c;
+      c.type = Connector::CONTYPE(get<uint32_t>());
+      c.nr = get<uint64_t>();
+      return c;
+    }
+  };
+
+  inline uint64_t hash (const char * data, size_t size)
+  {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++)
+      {
+        h ^= uint8_t(data[i]);
+        h *= 1099511628211ull;
+      }
+    return h;
+  }
+}
+
+
+
+template <int D>
+void WriteMassSpringSystem (checkpoint_detail::Writer & out, MassSpringSystem<D> & mss)
+{
+  out.putVec (mss.getGravity());
+
+  out.put<uint64_t> (mss.fixes().size());
+  for (auto & f : mss.fixes())
+    out.putVec (f.pos);
+
+  out.put<uint64_t> (mss.masses().size());
+  for (auto & m : mss.masses())
+    {
+      out.put<double> (m.mass);
+      out.putVec (m.pos);
+      out.putVec (m.vel);
+      out.putVec (m.acc);
+    }
+
+  out.put<uint64_t> (mss.springs().size());
+  for (auto & s : mss.springs())
+    {
+      out.put<double> (s.length);
+      out.put<double> (s.stiffness);
+      out.putConnector (s.connectors[0]);
+      out.putConnector (s.connectors[1]);
+      out.put<double> (s.breakstrain);
+    }
+
+  out.put<uint64_t> (mss.joints().size());
+  for (auto & j : mss.joints())
+    {
+      out.put<double> (j.length);
+      out.putConnector (j.connectors[0]);
+      out.putConnector (j.connectors[1]);
+    }
+
+  auto & contact = mss.getContact();
+  out.put<double> (contact.radius);
+  out.put<double> (contact.stiffness);
+  out.put<double> (contact.ground);
+  out.put<double> (contact.groundstiffness);
+}
+
+template <int D>
+void ReadMassSpringSystem (checkpoint_detail::Reader & in, MassSpringSystem<D> & mss,
+                           int version = 4)
+{
+  mss = MassSpringSystem<D>();
+  mss.setGravity (in.getVec<D>());
+
+  size_t n = in.get<uint64_t>();
+  for (size_t i = 0; i < n; i++)
+    mss.addFix ( { in.getVec<D>() } );
+
+  n = in.get<uint64_t>();
+  for (size_t i = 0; i < n; i++)
+    {
+      Mass<D> m;
+      m.mass = in.get<double>();
+      m.pos = in.getVec<D>();
+      m.vel = in.getVec<D>();
+      m.acc = in.getVec<D>();
+      mss.addMass (m);
+    }
+
+  n = in.get<uint64_t>();
+  for (size_t i = 0; i < n; i++)
+    {
+      Spring s;
+      s.length = in.get<double>();
+      s.stiffness = in.get<double>();
+      s.connectors[0] = in.getConnector();
+      s.connectors[1] = in.getConnector();
+      if (version >= 2)
+        s.breakstrain = in.get<double>();
+      mss.addSpring (s);
+    }
+
+  n = in.get<uint64_t>();
+  for (size_t i = 0; i < n; i++)
+    {
+      Joint j;
+      j.length = in.get<double>();
+      j.connectors[0] = in.getConnector();
+      j.connectors[1] = in.getConnector();
+      mss.addJoint (j);
+    }
+
+  if (version >= 4)
+    {
+      ContactParameters contact;
+      contact.radius = in.get<double>();
+      contact.stiffness = in.get<double>();
+      contact.ground = in.get<double>();
+      contact.groundstiffness = in.get<double>();
+      mss.setContact (contact);
+    }
+}
+
+
+
+// atomically (write + rename) store system and integrator state
+template <int D>
+void SaveCheckpoint (const std::string & filename,
+                     MassSpringSystem<D> & mss, const AlphaState & state)
+{
+  checkpoint_detail::Writer out;
+  for (char c : checkpoint_detail::magic)
+    out.put<char> (c);
+  out.put<uint32_t> (D);
+
+  WriteMassSpringSystem (out, mss);
+
+  out.put<double> (state.time);
+  out.put<double> (state.dt);
+  out.put<double> (state.rhoinf);
+  out.put<uint64_t> (state.step);
+  out.putVector (state.x);
+  out.putVector (state.v);
+  out.putVector (state.a);
+  out.put<uint8_t> (state.hasprev);
+  out.putVector (state.aprev);
+
+  auto & buf = out.buffer();
+  uint64_t h = checkpoint_detail::hash (buf.data(), buf.size());
+
+  std::string tmpname = filename + ".tmp";
+  FILE * file = std::fopen (tmpname.c_str(), "wb");
+  if (!file)
+    throw std::runtime_error("cannot open checkpoint file "+tmpname);
+  bool ok = std::fwrite (buf.data(), 1, buf.size(), file) == buf.size();
+  ok = ok && std::fwrite (&h, sizeof(h), 1, file) == 1;
+  ok = ok && std::fflush (file) == 0;
+#ifndef _WIN32
+  ok = ok && fsync (fileno(file)) == 0;
+#endif
+  ok = (std::fclose (file) == 0) && ok;
+  if (!ok)
+    {
+      std::remove (tmpname.c_str());
+      throw std::runtime_error("writing checkpoint "+tmpname+" failed");
+    }
+
+  std::filesystem::rename (tmpname, filename);
+}
+
+
+// restore system and integrator state. Continuing with
+// SolveODE_Alpha(state, ...) gives the same result as the original run.
+template <int D>
+AlphaState LoadCheckpoint (const std::string & filename, MassSpringSystem<D> & mss)
+{
+  FILE * file = std::fopen (filename.c_str(), "rb");
+  if (!file)
+    throw std::runtime_error("cannot open checkpoint file "+filename);
+  std::vector<char> buf;
+  char block[65536];
+  size_t n;
+  while ((n = std::fread (block, 1, sizeof(block), file)) > 0)
+    buf.insert (buf.end(), block, block+n);
+  std::fclose (file);
+
+  uint64_t h;
+  if (buf.size() < sizeof(checkpoint_detail::magic)+sizeof(h))
+    throw std::runtime_error(filename+" is not a checkpoint file");
+  std::memcpy (&h, buf.data()+buf.size()-sizeof(h), sizeof(h));
+  buf.resize (buf.size()-sizeof(h));
+  using checkpoint_detail::versionpos;
+  if (std::memcmp (buf.data(), checkpoint_detail::magic, versionpos) != 0)
+    throw std::runtime_error(filename+" is not a checkpoint file");
+  int version = 10*(buf[versionpos]-'0') + (buf[versionpos+1]-'0');
+  if (version < 1 || version > 4)
+    throw std::runtime_error(filename+": unsupported checkpoint version");
+  if (checkpoint_detail::hash (buf.data(), buf.size()) != h)
+    throw std::runtime_error(filename+": checkpoint is corrupt");
+
+  checkpoint_detail::Reader in(buf);
+  for (size_t i = 0; i < sizeof(checkpoint_detail::magic); i++)
+    in.get<char>();
+  if (in.get<uint32_t>() != D)
+    throw std::invalid_argument(filename+": checkpoint has different dimension");
+
+  ReadMassSpringSystem (in, mss, version);
+
+  double time = in.get<double>();
+  double dt = in.get<double>();
+  double rhoinf = in.get<double>();
+  size_t step = in.get<uint64_t>();
+  Vector<> x = in.getVector();
+  Vector<> v = in.getVector();
+  Vector<> a = in.getVector();
+  if (v.size() != x.size() || a.size() != x.size())
+    throw std::runtime_error(filename+": checkpoint is corrupt");
+
+  AlphaState state(x.size());
+  if (version >= 3)
+    {
+      state.hasprev = in.get<uint8_t>() != 0;
+      state.aprev = in.getVector();
+      if (state.aprev.size() != x.size())
+        throw std::runtime_error(filename+": checkpoint is corrupt");
+    }
+  state.time = time;
+  state.dt = dt;
+  state.rhoinf = rhoinf;
+  state.step = step;
+  state.x = x;
+  state.v = v;
+  state.a = a;
+  return state;
+}
+
+#endif
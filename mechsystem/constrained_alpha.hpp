@@ -0,0 +1,480 @@
+#ifndef CONSTRAINED_ALPHA_HPP
+#define CONSTRAINED_ALPHA_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <Newton.hpp>
+#include <inverse.hpp>
+#include <solver_stats.hpp>
+
+#include "mass_spring.hpp"
+#include "Newmark.hpp"
+
+
+// Generalized alpha for mass-spring systems with joints.
+//
+// Same discretization as SolveODE_Alpha with MSS_Function and the
+// Projector mass matrix, but the Newton systems
+//
+//   [ A     -s G^T ] [dq]   [ M r_q ]
+//   [ -s G   0     ] [dl] = [ r_l   ],   A = (1-alpham) M - s K
+//
+// are solved by a Schur complement on the joint multipliers. A is sparse
+// (D x D blocks per pair of connected masses) and solved by Jacobi
+// preconditioned CG, the Schur complement s^2 G A^-1 G^T is dense of
+// size #joints.
+
+
+// symmetric block sparse matrix, D x D blocks
+template <int D>
+class BlockSparseMatrix
+{
+  std::vector<size_t> m_first;   // first block of row i
+  std::vector<size_t> m_cols;    // block column of every block
+  std::vector<double> m_vals;    // D*D values per block, row major
+public:
+  // neighbors[i] contains the block columns of row i
+  void setPattern (std::vector<std::vector<size_t>> neighbors)
+  {
+    m_first.assign (1, 0);
+    m_cols.clear();
+    for (auto & row : neighbors)
+      {
+        std::sort (row.begin(), row.end());
+        row.erase (std::unique (row.begin(), row.end()), row.end());
+        m_cols.insert (m_cols.end(), row.begin(), row.end());
+        m_first.push_back (m_cols.size());
+      }
+    m_vals.assign (D*D*m_cols.size(), 0.0);
+  }
+
+  size_t blockRows() const { return m_first.size()-1; }
+  size_t height() const { return D*blockRows(); }
+
+  // number of block (i,j), which has to be in the pattern
+  size_t block (size_t i, size_t j) const
+  {
+    auto begin = m_cols.begin()+m_first[i], end = m_cols.begin()+m_first[i+1];
+    auto pos = std::lower_bound (begin, end, j);
+    if (pos == end || *pos != j)
+      throw std::logic_error("BlockSparseMatrix: block not in pattern");
+    return pos-m_cols.begin();
+  }
+
+  double * blockValues (size_t nr) { return &m_vals[D*D*nr]; }
+  void setZero() { std::fill (m_vals.begin(), m_vals.end(), 0.0); }
+
+  void mult (VectorView<double> x, VectorView<double> y) const
+  {
+    for (size_t i = 0; i < blockRows(); i++)
+      {
+        double sum[D] = { 0 };
+        for (size_t k = m_first[i]; k < m_first[i+1]; k++)
+          {
+            const double * b = &m_vals[D*D*k];
+            size_t col = D*m_cols[k];
+            for (int r = 0; r < D; r++)
+              for (int c = 0; c < D; c++)
+                sum[r] += b[D*r+c] * x(col+c);
+          }
+        for (int r = 0; r < D; r++)
+          y(D*i+r) = sum[r];
+      }
+  }
+
+  void getDiag (VectorView<double> diag) const
+  {
+    for (size_t i = 0; i < blockRows(); i++)
+      {
+        const double * b = &m_vals[D*D*block(i,i)];
+        for (int r = 0; r < D; r++)
+          diag(D*i+r) = b[D*r+r];
+      }
+  }
+};
+
+
+
+// Jacobi preconditioned CG for the symmetric positive definite matrix a,
+// returns the number of iterations
+template <int D>
+size_t SolvePCG (const BlockSparseMatrix<D> & a, VectorView<double> b, VectorView<double> x,
+                 double tol = 1e-12, size_t maxsteps = 0)
+{
+  size_t n = a.height();
+  if (maxsteps == 0) maxsteps = 10*n+10;
+
+  Vector<> diag(n), r(n), z(n), p(n), ap(n);
+  a.getDiag (diag);
+
+  auto dot = [n] (VectorView<double> u, VectorView<double> v)
+  {
+    double sum = 0;
+    for (size_t i = 0; i < n; i++)
+      sum += u(i)*v(i);
+    return sum;
+  };
+
+  x = 0.0;
+  r = b;
+  double bnorm = std::sqrt (dot(b, b));
+  if (bnorm == 0) return 0;
+
+  for (size_t i = 0; i < n; i++)
+    z(i) = r(i) / diag(i);
+  p = z;
+  double rz = dot(r, z);
+
+  for (size_t it = 0; it < maxsteps; it++)
+    {
+      if (std::sqrt (dot(r, r)) <= tol*bnorm)
+        return it;
+
+      a.mult (p, ap);
+      double pap = dot(p, ap);
+      if (!(pap > 0))
+        throw std::domain_error("PCG: matrix is not positive definite, reduce the time step");
+      double alpha = rz / pap;
+      for (size_t i = 0; i < n; i++)
+        {
+          x(i) += alpha * p(i);
+          r(i) -= alpha * ap(i);
+          z(i) = r(i) / diag(i);
+        }
+      double rznew = dot(r, z);
+      for (size_t i = 0; i < n; i++)
+        p(i) = z(i) + rznew/rz * p(i);
+      rz = rznew;
+    }
+
+  throw std::domain_error("PCG did not converge");
+}
+
+
+
+template <int D>
+class ConstrainedAlphaSolver
+{
+  MassSpringSystem<D> & m_mss;
+  std::shared_ptr<MSS_Function<D>> m_func;
+  BlockSparseMatrix<D> m_a;
+  // block numbers (11, 12, 21, 22) of springs and joints between two
+  // masses, or (11) for a mass attached to a fix
+  std::vector<std::array<size_t,4>> m_springblocks, m_jointblocks;
+  // state of the topology the pattern was built for. Blocks of broken
+  // springs stay in the pattern as zeros.
+  size_t m_version = 0;
+  size_t m_nremovals = 0;
+
+public:
+  ConstrainedAlphaSolver (MassSpringSystem<D> & mss)
+    : m_mss(mss), m_func(std::make_shared<MSS_Function<D>>(mss))
+  {
+    setup();
+  }
+
+  // follow removed springs incrementally, rebuild after other changes
+  void updateTopology()
+  {
+    if (m_mss.topologyVersion() != m_version)
+      {
+        setup();
+        return;
+      }
+    auto & removals = m_mss.springRemovals();
+    for ( ; m_nremovals < removals.size(); m_nremovals++)
+      {
+        auto [i, last] = removals[m_nremovals];
+        m_springblocks[i] = m_springblocks[last];
+        m_springblocks.pop_back();
+      }
+  }
+
+  void solve (AlphaState & state, int steps,
+              std::function<void(double,VectorView<double>)> callback = nullptr,
+              double tol = 1e-10, int maxsteps = 10);
+
+private:
+  void setup()
+  {
+    size_t m = m_mss.masses().size();
+    std::vector<std::vector<size_t>> neighbors(m);
+    for (size_t i = 0; i < m; i++)
+      neighbors[i].push_back (i);
+
+    auto connect = [&] (const std::array<Connector,2> & c)
+    {
+      if (c[0].type == Connector::MASS && c[1].type == Connector::MASS)
+        {
+          neighbors[c[0].nr].push_back (c[1].nr);
+          neighbors[c[1].nr].push_back (c[0].nr);
+        }
+    };
+    for (auto & s : m_mss.springs()) connect (s.connectors);
+    for (auto & j : m_mss.joints()) connect (j.connectors);
+    m_a.setPattern (neighbors);
+
+    auto blocks = [&] (const std::array<Connector,2> & c)
+    {
+      std::array<size_t,4> nr;
+      for (int k = 0; k < 2; k++)
+        for (int l = 0; l < 2; l++)
+          nr[2*k+l] = (c[k].type == Connector::MASS && c[l].type == Connector::MASS)
+            ? m_a.block (c[k].nr, c[l].nr) : size_t(-1);
+      return nr;
+    };
+    m_springblocks.clear();
+    m_jointblocks.clear();
+    for (auto & s : m_mss.springs()) m_springblocks.push_back (blocks (s.connectors));
+    for (auto & j : m_mss.joints()) m_jointblocks.push_back (blocks (j.connectors));
+
+    m_version = m_mss.topologyVersion();
+    m_nremovals = m_mss.springRemovals().size();
+  }
+
+  // A = (1-alpham) M - s K(x) and the constraint gradients G
+  void assemble (VectorView<double> x, double alpham, double s, VectorView<double> g);
+};
+
+
+
+template <int D>
+void ConstrainedAlphaSolver<D> :: assemble (VectorView<double> x, double alpham, double s,
+                                            VectorView<double> g)
+{
+  size_t m = m_mss.masses().size();
+  size_t nj = m_mss.joints().size();
+  auto xmat = x.asMatrix(m, D);
+
+  auto position = [&] (Connector c)
+  {
+    Vec<D> p;
+    if (c.type == Connector::FIX)
+      p = m_mss.fixes()[c.nr].pos;
+    else
+      p = xmat.row(c.nr);
+    return p;
+  };
+
+  // adds s * kb to the blocks (11,22) and -s * kb to (12,21)
+  auto addCoupling = [&] (const std::array<size_t,4> & nr, const double (&kb)[D][D])
+  {
+    for (int k = 0; k < 4; k++)
+      if (nr[k] != size_t(-1))
+        {
+          double sign = (k == 0 || k == 3) ? 1 : -1;
+          double * b = m_a.blockValues (nr[k]);
+          for (int r = 0; r < D; r++)
+            for (int c = 0; c < D; c++)
+              b[D*r+c] += s * sign * kb[r][c];
+        }
+  };
+
+  m_a.setZero();
+  for (size_t i = 0; i < m; i++)
+    {
+      double * b = m_a.blockValues (m_a.block (i,i));
+      for (int r = 0; r < D; r++)
+        b[D*r+r] = (1-alpham) * m_mss.masses()[i].mass;
+    }
+
+  // spring force F1 = k (|d|-L) d/|d|, d = p2-p1 has the derivative
+  // dF1/dp2 = k ( (1-L/|d|) I + L/|d|^3 d d^T )
+  for (size_t i = 0; i < m_mss.springs().size(); i++)
+    {
+      auto & spring = m_mss.springs()[i];
+      Vec<D> d = position(spring.connectors[1]) - position(spring.connectors[0]);
+      double len = norm(d);
+      double kb[D][D];
+      for (int r = 0; r < D; r++)
+        for (int c = 0; c < D; c++)
+          kb[r][c] = spring.stiffness * ((r == c ? 1-spring.length/len : 0)
+                                         + spring.length/(len*len*len) * d(r)*d(c));
+      addCoupling (m_springblocks[i], kb);
+    }
+
+  // ground contact, mass-mass contacts are left to the Newton iteration
+  const ContactParameters & contact = m_mss.getContact();
+  if (contact.groundContact())
+    for (size_t i = 0; i < m; i++)
+      if (xmat(i,D-1) < contact.ground + contact.radius)
+        m_a.blockValues (m_a.block (i,i))[D*D-1] += s * contact.groundstiffness;
+
+  // joint force F1 = 2 lambda (p1-p2), constraint |p1-p2|^2 - L^2
+  g = 0.0;
+  for (size_t i = 0; i < nj; i++)
+    {
+      auto & joint = m_mss.joints()[i];
+      double lam = x(D*m+i);
+      double kb[D][D] = { };
+      for (int r = 0; r < D; r++)
+        kb[r][r] = -2*lam;
+      addCoupling (m_jointblocks[i], kb);
+
+      Vec<D> d = position(joint.connectors[0]) - position(joint.connectors[1]);
+      auto grow = g.range(i*D*m, (i+1)*D*m);
+      for (int k = 0; k < 2; k++)
+        if (joint.connectors[k].type == Connector::MASS)
+          for (int r = 0; r < D; r++)
+            grow(D*joint.connectors[k].nr+r) += (k == 0 ? 2 : -2) * d(r);
+    }
+}
+
+
+
+template <int D>
+void ConstrainedAlphaSolver<D> :: solve (AlphaState & state, int steps,
+                                         std::function<void(double,VectorView<double>)> callback,
+                                         double tol, int maxsteps)
+{
+  size_t m = m_mss.masses().size();
+  size_t n = D*m;
+  size_t nj = m_mss.joints().size();
+  if (state.x.size() != n+nj)
+    throw std::invalid_argument("ConstrainedAlphaSolver: state does not match the system");
+
+  double dt = state.dt;
+  double rhoinf = state.rhoinf;
+  double alpham = (2*rhoinf-1)/(rhoinf+1);
+  double alphaf = rhoinf/(rhoinf+1);
+  double gamma = 0.5-alpham+alphaf;
+  double beta = 0.25 * (1-alpham+alphaf)*(1-alpham+alphaf);
+  double s = (1-alphaf)*beta*dt*dt;
+
+  Vector<> xold(n+nj), vold(n+nj), aold(n+nj), a(n+nj);
+  Vector<> xnew(n+nj), fold(n+nj), fnew(n+nj), res(n+nj);
+  Vector<> g(nj*n), w(nj*n), mr(n), z(n), rhsl(nj), dl(nj);
+  Matrix<> schur(nj, nj);
+  ASC_ODE_STATS_ADD(alloc_bytes, sizeof(double)*(9*(n+nj) + 2*nj*n + 2*n + nj*nj));
+
+  for (int step = 0; step < steps; step++)
+    {
+      updateTopology();     // springs may break in the callback
+      ASC_ODE_STATS_ADD(steps, 1);
+      ASC_ODE_STATS_ADD(newton_solves, 1);
+      xold = state.x;
+      vold = state.v;
+      aold = state.a;
+      a = state.a;
+      m_func->evaluate (xold, fold);
+      ASC_ODE_STATS_ADD(function_evals, 1);
+
+      double err = 0;
+      bool converged = false;
+      for (int it = 0; it < maxsteps; it++)
+        {
+          for (size_t i = 0; i < n+nj; i++)
+            xnew(i) = xold(i) + dt*vold(i) + dt*dt/2 * ((1-2*beta)*aold(i) + 2*beta*a(i));
+          {
+            ASC_ODE_STATS_TIMER(time_function);
+            ASC_ODE_STATS_ADD(function_evals, 1);
+            m_func->evaluate (xnew, fnew);
+          }
+
+          for (size_t i = 0; i < n; i++)
+            res(i) = (1-alpham)*a(i) + alpham*aold(i) - (1-alphaf)*fnew(i) - alphaf*fold(i);
+          for (size_t i = n; i < n+nj; i++)
+            res(i) = -(1-alphaf)*fnew(i) - alphaf*fold(i);
+          err = norm(res);
+          if (err < tol)
+            {
+              ASC_ODE_STATS_MAX(newton_max_iterations, it);
+              converged = true;
+              break;
+            }
+
+          {
+            ASC_ODE_STATS_TIMER(time_jacobian);
+            ASC_ODE_STATS_ADD(jacobian_evals, 1);
+            assemble (xnew, alpham, s, g);
+          }
+
+          // z = A^-1 M r_q,  w_k = A^-1 G_k^T
+          for (size_t i = 0; i < m; i++)
+            for (int d = 0; d < D; d++)
+              mr(D*i+d) = m_mss.masses()[i].mass * res(D*i+d);
+          {
+            ASC_ODE_STATS_TIMER(time_linear);
+            size_t its = SolvePCG (m_a, mr, z);
+            for (size_t k = 0; k < nj; k++)
+              its += SolvePCG (m_a, g.range(k*n, (k+1)*n), w.range(k*n, (k+1)*n));
+            ASC_ODE_STATS_ADD(linear_iterations, its);
+          }
+
+          // (s^2 G A^-1 G^T) dl = -r_l - s G z
+          for (size_t i = 0; i < nj; i++)
+            {
+              auto gi = g.range(i*n, (i+1)*n);
+              double gz = 0;
+              for (size_t l = 0; l < n; l++)
+                gz += gi(l) * z(l);
+              rhsl(i) = -res(n+i) - s*gz;
+              for (size_t k = 0; k < nj; k++)
+                {
+                  auto wk = w.range(k*n, (k+1)*n);
+                  double gw = 0;
+                  for (size_t l = 0; l < n; l++)
+                    gw += gi(l) * wk(l);
+                  schur(i,k) = s*s*gw;
+                }
+            }
+          if (nj > 0)
+            {
+              ASC_ODE_STATS_TIMER(time_factorization);
+              ASC_ODE_STATS_ADD(factorizations, 1);
+              calcInverse (schur);
+              dl = schur*rhsl;
+            }
+
+          // dq = z + s W dl
+          for (size_t k = 0; k < nj; k++)
+            {
+              auto wk = w.range(k*n, (k+1)*n);
+              for (size_t l = 0; l < n; l++)
+                z(l) += s * dl(k) * wk(l);
+            }
+          for (size_t l = 0; l < n; l++)
+            a(l) -= z(l);
+          for (size_t k = 0; k < nj; k++)
+            a(n+k) -= dl(k);
+          ASC_ODE_STATS_ADD(newton_iterations, 1);
+        }
+
+      if (!converged)
+        {
+          ASC_ODE_STATS_ADD(newton_failures, 1);
+          ASC_ODE_STATS_MAX(newton_max_iterations, maxsteps);
+          std::ostringstream msg;
+          msg << "Newton did not converge: residual " << err << " after " << maxsteps
+              << " iterations (tol " << tol << ", dim " << n+nj << ")";
+          throw std::domain_error(msg.str());
+        }
+
+      for (size_t i = 0; i < n+nj; i++)
+        {
+          state.x(i) = xold(i) + dt*vold(i) + dt*dt/2 * ((1-2*beta)*aold(i) + 2*beta*a(i));
+          state.v(i) = vold(i) + dt*((1-gamma)*aold(i) + gamma*a(i));
+        }
+      state.a = a;
+      state.time += dt;
+      state.step++;
+      if (callback) callback(state.time, state.x);
+    }
+}
+
+
+// generalized alpha for a mass-spring system with joints, continuing state
+template <int D>
+void SolveODE_ConstrainedAlpha (MassSpringSystem<D> & mss, AlphaState & state, int steps,
+                                std::function<void(double,VectorView<double>)> callback = nullptr)
+{
+  ConstrainedAlphaSolver<D> solver(mss);
+  solver.solve (state, steps, callback);
+}
+
+#endif
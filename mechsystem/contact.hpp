@@ -0,0 +1,152 @@
+#ifndef CONTACT_HPP
+#define CONTACT_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include <autodiff.hpp>
+#include <autodiff_dynamic.hpp>
+#include <vector.hpp>
+
+
+// Penalty contact between masses (spheres of equal radius) and with the
+// ground plane x_{D-1} = ground. Contact is off with stiffness 0.
+class ContactParameters
+{
+public:
+  double radius = 0;
+  double stiffness = 0;
+  double ground = -std::numeric_limits<double>::infinity();
+  double groundstiffness = 0;
+
+  bool massContact() const { return stiffness > 0 && radius > 0; }
+  bool groundContact() const { return groundstiffness > 0 && std::isfinite(ground); }
+};
+
+
+// value part of a generic scalar, for decisions that are not differentiated
+inline double valueOf (double x) { return x; }
+template <typename T>
+double valueOf (const ASC_ode::AutoDiffDynamic<T> & x) { return x.value(); }
+template <size_t N, typename T>
+double valueOf (const ASC_ode::AutoDiff<N,T> & x) { return x.value(); }
+
+
+
+// Uniform grid spatial hash for the broad phase. update() only moves the
+// points that changed their cell since the last call.
+template <int D>
+class SpatialHash
+{
+  static_assert (D >= 1 && D <= 3, "SpatialHash supports up to 3 dimensions");
+
+  double m_cellsize = 0;
+  std::unordered_map<uint64_t, std::vector<size_t>> m_cells;
+  std::vector<uint64_t> m_cellof;   // current cell of every point
+  std::vector<size_t> m_slot;       // position of every point in its cell
+
+  std::array<int64_t,D> cellIndex (const nanoblas::Vec<D> & p) const
+  {
+    std::array<int64_t,D> ind;
+    for (int d = 0; d < D; d++)
+      ind[d] = int64_t(std::floor (p(d) / m_cellsize));
+    return ind;
+  }
+
+  // 64 / D bits per coordinate, far away cells may share a key
+  static uint64_t key (const std::array<int64_t,D> & ind)
+  {
+    constexpr int bits = 64 / D;
+    constexpr uint64_t mask = (bits == 64) ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+    uint64_t k = 0;
+    for (int d = 0; d < D; d++)
+      k |= (uint64_t(ind[d]) & mask) << (bits*d);
+    return k;
+  }
+
+  void insert (size_t i, uint64_t k)
+  {
+    auto & cell = m_cells[k];
+    m_cellof[i] = k;
+    m_slot[i] = cell.size();
+    cell.push_back (i);
+  }
+
+  void remove (size_t i)
+  {
+    auto it = m_cells.find (m_cellof[i]);
+    auto & cell = it->second;
+    size_t last = cell.back();
+    cell[m_slot[i]] = last;
+    m_slot[last] = m_slot[i];
+    cell.pop_back();
+    if (cell.empty()) m_cells.erase (it);
+  }
+
+public:
+  double cellSize() const { return m_cellsize; }
+
+  // pos(i) returns the position of point i as Vec<D>
+  template <typename POS>
+  void update (size_t n, double cellsize, POS && pos)
+  {
+    if (cellsize != m_cellsize || n != m_cellof.size())
+      {
+        m_cellsize = cellsize;
+        m_cells.clear();
+        m_cellof.resize (n);
+        m_slot.resize (n);
+        for (size_t i = 0; i < n; i++)
+          insert (i, key (cellIndex (pos(i))));
+        return;
+      }
+
+    for (size_t i = 0; i < n; i++)
+      {
+        uint64_t k = key (cellIndex (pos(i)));
+        if (k != m_cellof[i])
+          {
+            remove (i);
+            insert (i, k);
+          }
+      }
+  }
+
+  // calls f(i,j), i < j, for all pairs in the same or adjacent cells,
+  // i.e. at least for all pairs closer than the cell size
+  template <typename POS, typename F>
+  void forEachPair (POS && pos, F && f) const
+  {
+    constexpr int nneighbors = (D == 1) ? 3 : (D == 2) ? 9 : 27;
+    std::array<uint64_t,nneighbors> keys;
+
+    for (size_t i = 0; i < m_cellof.size(); i++)
+      {
+        auto ind = cellIndex (pos(i));
+        for (int nb = 0; nb < nneighbors; nb++)
+          {
+            auto nind = ind;
+            for (int d = 0, rest = nb; d < D; d++, rest /= 3)
+              nind[d] += rest % 3 - 1;
+            keys[nb] = key (nind);
+          }
+        std::sort (keys.begin(), keys.end());
+        auto end = std::unique (keys.begin(), keys.end());
+
+        for (auto k = keys.begin(); k != end; ++k)
+          {
+            auto it = m_cells.find (*k);
+            if (it == m_cells.end()) continue;
+            for (size_t j : it->second)
+              if (j > i) f(i, j);
+          }
+      }
+  }
+};
+
+#endif
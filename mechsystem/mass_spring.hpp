@@ -1,15 +1,29 @@
 #ifndef MASS_SPRING_HPP
 #define MASS_SPRING_HPP
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
 #include <nonlinfunc.hpp>
 #include <timestepper.hpp>
 #include <autodiff_dynamic.hpp>
+#include <colored_jacobian.hpp>
 
 using namespace ASC_ode;
 
 #include <vector.hpp>
 using namespace nanoblas;
 
+#include "contact.hpp"
+
 
 template <int D>
 class Mass
@@ -51,6 +65,8 @@ public:
   double length;  
   double stiffness;
   std::array<Connector,2> connectors;
+  // the spring breaks when (|p2-p1| - length) / length exceeds breakstrain
+  double breakstrain = std::numeric_limits<double>::infinity();
 };
 
 class Joint 
@@ -68,33 +84,191 @@ class MassSpringSystem
   std::vector<Spring> m_springs;
   std::vector<Joint> m_joints;
   Vec<D> m_gravity=0.0;
+  ContactParameters m_contact;
+  // removed springs as (removed, last): the last spring took the place of
+  // the removed one. All other changes of the topology increment m_version
+  // and clear the log, the caches of the old version rebuild anyway.
+  std::vector<std::array<size_t,2>> m_removedsprings;
+  size_t m_version = 0;
 public:
   void setGravity (Vec<D> gravity) { m_gravity = gravity; }
   Vec<D> getGravity() const { return m_gravity; }
 
+  void setContact (ContactParameters contact) { m_contact = contact; }
+  const ContactParameters & getContact() const { return m_contact; }
+
   Connector addFix (Fix<D> p)
   {
     m_fixes.push_back(p);
+    topologyChanged();
     return { Connector::FIX, m_fixes.size()-1 };
   }
 
   Connector addMass (Mass<D> m)
   {
     m_masses.push_back (m);
+    topologyChanged();
     return { Connector::MASS, m_masses.size()-1 };
   }
   
   size_t addSpring (Spring s) 
   {
     m_springs.push_back (s); 
+    topologyChanged();
     return m_springs.size()-1;
   }
   size_t addJoint (Joint j) 
   {
     m_joints.push_back (j); 
+    topologyChanged();
     return m_joints.size()-1;
   }
 
+  void reserve (size_t nmasses, size_t nsprings, size_t nfixes = 0, size_t njoints = 0)
+  {
+    m_masses.reserve (nmasses);
+    m_springs.reserve (nsprings);
+    m_fixes.reserve (nfixes);
+    m_joints.reserve (njoints);
+  }
+
+  // bulk construction from flat arrays, vectors of entity i are stored
+  // at [D*i, D*i+D). Returns the number of the first new entity.
+  size_t addFixes (size_t n, const double * pos)
+  {
+    size_t first = m_fixes.size();
+    m_fixes.resize (first+n);
+    topologyChanged();
+    for (size_t i = 0; i < n; i++)
+      for (int d = 0; d < D; d++)
+        m_fixes[first+i].pos(d) = pos[D*i+d];
+    return first;
+  }
+
+  size_t addMasses (size_t n, const double * mass, const double * pos,
+                    const double * vel = nullptr)
+  {
+    size_t first = m_masses.size();
+    m_masses.resize (first+n);
+    topologyChanged();
+    for (size_t i = 0; i < n; i++)
+      {
+        Mass<D> & m = m_masses[first+i];
+        m.mass = mass[i];
+        for (int d = 0; d < D; d++)
+          {
+            m.pos(d) = pos[D*i+d];
+            m.vel(d) = vel ? vel[D*i+d] : 0.0;
+            m.acc(d) = 0.0;
+          }
+      }
+    return first;
+  }
+
+  // spring i connects nr[2*i] and nr[2*i+1], which are masses unless
+  // the isfix flag is set. Without length the current distance is taken
+  // as rest length, without breakstrain the springs do not break.
+  size_t addSprings (size_t n, const uint64_t * nr, const double * stiffness,
+                     const double * length = nullptr,
+                     const uint8_t * isfix = nullptr,
+                     const double * breakstrain = nullptr)
+  {
+    size_t first = m_springs.size();
+    m_springs.resize (first+n);
+    topologyChanged();
+    for (size_t i = 0; i < n; i++)
+      {
+        Spring & s = m_springs[first+i];
+        for (int k = 0; k < 2; k++)
+          {
+            auto type = (isfix && isfix[2*i+k]) ? Connector::FIX : Connector::MASS;
+            size_t num = (type == Connector::FIX) ? m_fixes.size() : m_masses.size();
+            if (nr[2*i+k] >= num)
+              {
+                m_springs.resize (first);
+                throw std::out_of_range("spring "+std::to_string(i)+" refers to non-existing "
+                                        +(type == Connector::FIX ? "fix" : "mass"));
+              }
+            s.connectors[k] = { type, nr[2*i+k] };
+          }
+        s.stiffness = stiffness[i];
+        if (breakstrain)
+          s.breakstrain = breakstrain[i];
+        if (length)
+          s.length = length[i];
+        else
+          {
+            Vec<D> diff = position(s.connectors[1]) - position(s.connectors[0]);
+            s.length = norm(diff);
+          }
+      }
+    return first;
+  }
+
+  Vec<D> position (Connector c) const
+  {
+    return (c.type == Connector::FIX) ? m_fixes[c.nr].pos : m_masses[c.nr].pos;
+  }
+
+  // cached data depending on the topology compare topologyVersion() and
+  // replay the springRemovals() they have not seen yet. The removals are
+  // the ones since the last version change.
+  size_t topologyVersion() const { return m_version; }
+  const std::vector<std::array<size_t,2>> & springRemovals() const { return m_removedsprings; }
+  // to be called after modifying the system through springs(), joints() ...
+  void topologyChanged()
+  {
+    m_version++;
+    m_removedsprings.clear();
+  }
+
+  // swap-remove: the last spring gets number i
+  void removeSpring (size_t i)
+  {
+    size_t last = m_springs.size()-1;
+    m_springs[i] = m_springs[last];
+    m_springs.pop_back();
+    m_removedsprings.push_back ( { i, last } );
+    // replaying more removals than there are springs costs more than a
+    // rebuild, start a new version instead of growing the log
+    if (m_removedsprings.size() > std::max<size_t>(m_springs.size(), 1024))
+      topologyChanged();
+  }
+
+  // removes the springs strained beyond their breakstrain at the positions
+  // x (as in getState), returns the number of broken springs
+  size_t breakSprings (VectorView<double> x)
+  {
+    auto xmat = x.range(0, D*m_masses.size()).asMatrix(m_masses.size(), D);
+    auto pos = [&] (Connector c)
+    {
+      Vec<D> p;
+      if (c.type == Connector::FIX)
+        p = m_fixes[c.nr].pos;
+      else
+        p = xmat.row(c.nr);
+      return p;
+    };
+
+    size_t broken = 0;
+    for (size_t i = 0; i < m_springs.size(); )
+      {
+        const Spring & s = m_springs[i];
+        if (std::isfinite (s.breakstrain))
+          {
+            Vec<D> diff = pos(s.connectors[1]) - pos(s.connectors[0]);
+            if (norm(diff) - s.length > s.breakstrain * s.length)
+              {
+                removeSpring (i);     // check the moved spring at i next
+                broken++;
+                continue;
+              }
+          }
+        i++;
+      }
+    return broken;
+  }
+
   auto & fixes() { return m_fixes; } 
   auto & masses() { return m_masses; } 
   auto & springs() { return m_springs; }
@@ -156,13 +330,257 @@ std::ostream & operator<< (std::ostream & ost, MassSpringSystem<D> & mss)
 
 
 template <int D>
-class MSS_Function : public NonlinearFunction
+class MSS_Function : public ParameterizedFunction
 {
   MassSpringSystem<D> & mss;
+  // broad phase of the mass-mass contacts, shared by all evaluations.
+  // Concurrent evaluations are safe, they take turns finding the pairs.
+  mutable SpatialHash<D> m_hash;
+  mutable std::mutex m_hashmutex;
+  // part of the forces: springs with minstiffness <= stiffness < maxstiffness,
+  // external forces (gravity, contact) and joints
+  double m_minstiffness = 0;
+  double m_maxstiffness = std::numeric_limits<double>::infinity();
+  bool m_external = true;
+  bool m_joints = true;
+  // contact candidates of the last evaluation, for sparsity()
+  mutable std::vector<std::pair<size_t,size_t>> m_candidates;
+  mutable bool m_havecandidates = false;
+  // Jacobian pattern of the springs, joints and ground contact and its
+  // coloring. Spring removals are replayed on it as in MultirateVerlet:
+  // m_springmasses follows the numbering of the springs, m_blocks counts
+  // the springs and joints coupling two masses, and blocks nothing couples
+  // any more are dropped from the pattern, keeping the colors. Other
+  // changes of the topology or of the ground contact rebuild it. The
+  // contact candidates are added on top.
+  static constexpr size_t none = std::numeric_limits<size_t>::max();
+  mutable std::mutex m_coloringmutex;
+  mutable std::shared_ptr<const ColoredJacobian> m_basecoloring, m_coloring;
+  mutable std::unordered_map<uint64_t,size_t> m_blocks;
+  mutable std::vector<std::array<size_t,2>> m_springmasses;
+  mutable size_t m_version = 0, m_nremovals = 0;
+  mutable bool m_ground = false;
+  mutable std::vector<std::pair<size_t,size_t>> m_coloringpairs;
+  mutable size_t m_patternversion = 0;     // counts the new colorings
+
+  std::shared_ptr<const ColoredJacobian>
+  coloring (const std::vector<std::pair<size_t,size_t>> & candidates) const
+  {
+    std::lock_guard<std::mutex> guard(m_coloringmutex);
+    bool ground = m_external && mss.getContact().groundContact();
+    bool changed = false;
+    if (!m_basecoloring || mss.topologyVersion() != m_version || ground != m_ground)
+      {
+        buildBase();
+        changed = true;
+      }
+    else if (mss.springRemovals().size() != m_nremovals)
+      changed = replayRemovals();
+
+    if (changed || !m_coloring || candidates != m_coloringpairs)
+      {
+        if (candidates.empty())
+          m_coloring = m_basecoloring;
+        else
+          {
+            std::vector<std::vector<size_t>> rows(dimF());
+            for (auto [i, j] : candidates)
+              for (auto [k, l] : { std::pair { i, i }, std::pair { i, j },
+                                   std::pair { j, i }, std::pair { j, j } })
+                for (int d = 0; d < D; d++)
+                  for (int e = 0; e < D; e++)
+                    rows[D*k+d].push_back (D*l+e);
+            auto pattern = Union (m_basecoloring->pattern(), SparsityPattern(dimX(), rows));
+            m_coloring = std::make_shared<const ColoredJacobian>
+              (std::make_shared<const SparsityPattern>(std::move(pattern)));
+          }
+        m_coloringpairs = candidates;
+        m_patternversion++;
+      }
+    return m_coloring;
+  }
+
+  uint64_t blockKey (size_t i, size_t j) const { return uint64_t(i) * mss.masses().size() + j; }
+
+  // the masses coupled by a spring of this part, none for fixes
+  std::array<size_t,2> springMasses (const Spring & spring) const
+  {
+    std::array<size_t,2> masses { none, none };
+    if (spring.stiffness >= m_minstiffness && spring.stiffness < m_maxstiffness)
+      for (int k = 0; k < 2; k++)
+        if (spring.connectors[k].type == Connector::MASS)
+          masses[k] = spring.connectors[k].nr;
+    return masses;
+  }
+
+  // a mass depends on itself, the masses it is connected to by springs or
+  // joints and the multipliers of its joints, a joint equation on its masses.
+  // Without springs, joints and contact a mass has a constant force and an
+  // empty row, e.g. in the stiff part of a splitting.
+  void buildBase () const
+  {
+    size_t nm = mss.masses().size();
+    m_blocks.clear();
+    m_springmasses.clear();
+    auto couple = [&] (std::array<size_t,2> masses)
+    {
+      for (size_t i : masses)
+        for (size_t j : masses)
+          if (i != none && j != none)
+            m_blocks[blockKey(i, j)]++;
+    };
+    m_ground = m_external && mss.getContact().groundContact();
+    if (m_ground)
+      for (size_t i = 0; i < nm; i++)
+        m_blocks[blockKey(i, i)]++;
+    for (auto & spring : mss.springs())
+      {
+        m_springmasses.push_back (springMasses (spring));
+        couple (m_springmasses.back());
+      }
+
+    std::vector<std::vector<size_t>> rows(dimF());
+    for (size_t j = 0; j < mss.joints().size() && m_joints; j++)
+      {
+        std::array<size_t,2> masses { none, none };
+        for (int k = 0; k < 2; k++)
+          if (mss.joints()[j].connectors[k].type == Connector::MASS)
+            masses[k] = mss.joints()[j].connectors[k].nr;
+        couple (masses);
+        for (size_t i : masses)
+          if (i != none)
+            for (int d = 0; d < D; d++)
+              {
+                rows[D*i+d].push_back(D*nm+j);
+                rows[D*nm+j].push_back(D*i+d);
+              }
+      }
+    for (auto [key, count] : m_blocks)
+      for (int d = 0; d < D; d++)
+        for (int e = 0; e < D; e++)
+          rows[D*(key/nm)+d].push_back(D*(key%nm)+e);
+
+    m_basecoloring = std::make_shared<const ColoredJacobian>
+      (std::make_shared<const SparsityPattern>(dimX(), rows));
+    m_version = mss.topologyVersion();
+    m_nremovals = mss.springRemovals().size();
+  }
+
+  // replays the spring removals, returns whether the pattern changed
+  bool replayRemovals () const
+  {
+    size_t nm = mss.masses().size();
+    auto & removals = mss.springRemovals();
+    std::unordered_set<uint64_t> dropped;
+    std::vector<bool> touched(nm, false);    // masses with dropped blocks
+    for ( ; m_nremovals < removals.size(); m_nremovals++)
+      {
+        auto [removed, last] = removals[m_nremovals];
+        for (size_t i : m_springmasses[removed])
+          for (size_t j : m_springmasses[removed])
+            if (i != none && j != none)
+              {
+                auto it = m_blocks.find (blockKey(i, j));
+                if (--it->second == 0)
+                  {
+                    m_blocks.erase (it);
+                    dropped.insert (blockKey(i, j));
+                    touched[i] = true;
+                  }
+              }
+        m_springmasses[removed] = m_springmasses[last];
+        m_springmasses.pop_back();
+      }
+    if (dropped.empty())
+      return false;
+
+    // only the rows of the touched masses lose entries
+    auto & p = m_basecoloring->pattern();
+    std::vector<size_t> first(1, 0), colind;
+    colind.reserve (p.nnz());
+    for (size_t r = 0; r < p.rows(); r++)
+      {
+        bool filter = r < D*nm && touched[r/D];
+        for (size_t k = p.first(r); k < p.next(r); k++)
+          if (!filter || p.col(k) >= D*nm || !dropped.count (blockKey(r/D, p.col(k)/D)))
+            colind.push_back (p.col(k));
+        first.push_back (colind.size());
+      }
+    m_basecoloring = std::make_shared<const ColoredJacobian>
+      (std::make_shared<const SparsityPattern>(p.rows(), p.cols(), std::move(first), std::move(colind)),
+       *m_basecoloring);
+    return true;
+  }
+
+  bool hasMassContact () const { return m_external && mss.getContact().massContact(); }
+
+  // broad phase at the positions pos(i): returns the pairs in contact and
+  // the candidates closer than twice the contact distance, which stay in
+  // the Jacobian pattern while the masses move a bit. Both are sorted,
+  // the order of the hash depends on its history.
+  template <typename POS>
+  std::vector<std::pair<size_t,size_t>>
+  contactPairs (POS && pos, std::vector<std::pair<size_t,size_t>> & candidates) const
+  {
+    double dist0 = 2*mss.getContact().radius;
+    std::vector<std::pair<size_t,size_t>> pairs;
+    candidates.clear();
+    {
+      std::lock_guard<std::mutex> guard(m_hashmutex);
+      m_hash.update (mss.masses().size(), dist0, pos);
+      m_hash.forEachPair (pos, [&] (size_t i, size_t j)
+      {
+        double dist = norm(pos(j)-pos(i));
+        if (dist < 2*dist0)
+          candidates.emplace_back (i, j);
+        if (dist < dist0 && dist > 0)
+          pairs.emplace_back (i, j);
+      });
+    }
+    std::sort (pairs.begin(), pairs.end());
+    std::sort (candidates.begin(), candidates.end());
+    return pairs;
+  }
+
+  // the coloring for the contact candidates of the last evaluation, or
+  // of the positions of the masses before the first one
+  std::shared_ptr<const ColoredJacobian> lastColoring () const
+  {
+    std::vector<std::pair<size_t,size_t>> candidates;
+    if (hasMassContact())
+      {
+        bool have;
+        {
+          std::lock_guard<std::mutex> guard(m_hashmutex);
+          have = m_havecandidates;
+          candidates = m_candidates;
+        }
+        if (!have)
+          contactPairs ([this] (size_t i) { return mss.masses()[i].pos; }, candidates);
+      }
+    return coloring(candidates);
+  }
+
+  // contact candidates at x, empty without mass contact
+  std::vector<std::pair<size_t,size_t>> contactCandidates (VectorView<double> x) const
+  {
+    std::vector<std::pair<size_t,size_t>> candidates;
+    if (hasMassContact())
+      {
+        auto xmat = x.range(0, D*mss.masses().size()).asMatrix(mss.masses().size(), D);
+        contactPairs ([&xmat] (size_t i) { Vec<D> p = xmat.row(i); return p; }, candidates);
+      }
+    return candidates;
+  }
 public:
   MSS_Function (MassSpringSystem<D> & _mss)
     : mss(_mss) { }
 
+  MSS_Function (MassSpringSystem<D> & _mss, double minstiffness, double maxstiffness,
+                bool external, bool joints)
+    : mss(_mss), m_minstiffness(minstiffness), m_maxstiffness(maxstiffness),
+      m_external(external), m_joints(joints) { }
+
   virtual size_t dimX() const override { return D*mss.masses().size() + mss.joints().size(); }
   virtual size_t dimF() const override{ return D*mss.masses().size() +  mss.joints().size(); }
 
@@ -182,12 +600,15 @@ public:
     auto flambda = f.range(D*mss.masses().size(), lamdacounter);
 
     // gravity force
-    for (size_t i = 0; i < mss.masses().size(); i++)
-      fmat.row(i) = mss.masses()[i].mass*mss.getGravity();
+    if (m_external)
+      for (size_t i = 0; i < mss.masses().size(); i++)
+        fmat.row(i) = mss.masses()[i].mass*mss.getGravity();
 
     // spring forces
     for (auto spring : mss.springs())
     {
+        if (spring.stiffness < m_minstiffness || spring.stiffness >= m_maxstiffness)
+          continue;
         auto [c1, c2] = spring.connectors;
         Vec<D, T> p1, p2;
         if (c1.type == Connector::FIX)
@@ -211,8 +632,49 @@ public:
           fmat.row(c2.nr) -= force*dir12;
       }
 
+      // contact forces, pairs are found from the values only
+      const ContactParameters & contact = mss.getContact();
+      if (m_external && contact.massContact())
+      {
+        double dist0 = 2*contact.radius;
+        auto posval = [&xmat] (size_t i)
+        {
+          Vec<D> p;
+          for (int d = 0; d < D; d++)
+            p(d) = valueOf(xmat(i,d));
+          return p;
+        };
+        std::vector<std::pair<size_t,size_t>> candidates;
+        auto pairs = contactPairs (posval, candidates);
+        {
+          std::lock_guard<std::mutex> guard(m_hashmutex);
+          m_candidates = std::move(candidates);
+          m_havecandidates = true;
+        }
+
+        for (auto [i, j] : pairs)
+        {
+          Vec<D, T> p1, p2;
+          p1 = xmat.row(i);
+          p2 = xmat.row(j);
+          Vec<D, T> p2MinusP1 = p2-p1;
+          T dist = norm(p2MinusP1);
+          T force = contact.stiffness * (dist0 - dist);
+          Vec<D, T> dir12 = (1.0/dist) * p2MinusP1;
+          fmat.row(i) -= force*dir12;
+          fmat.row(j) += force*dir12;
+        }
+      }
+      if (m_external && contact.groundContact())
+        for (size_t i = 0; i < mss.masses().size(); i++)
+          if (valueOf(xmat(i,D-1)) < contact.ground + contact.radius)
+            {
+              T penetration = (contact.ground + contact.radius) - xmat(i,D-1);
+              fmat(i,D-1) = fmat(i,D-1) + contact.groundstiffness * penetration;
+            }
+
       // joint part
-      for (size_t i=0; i<lamdacounter; i ++)
+      for (size_t i=0; i<lamdacounter && m_joints; i ++)
       {
         Joint joint = mss.joints()[i];
         auto [c1, c2] = joint.connectors;
@@ -254,21 +716,144 @@ public:
       }
     }
 
-    virtual void evaluateDeriv(VectorView<double> x, MatrixView<double> df) const override {
-      Vector<AutoDiffDynamic<>> xs(x.size());
-      Vector<AutoDiffDynamic<>> fs(x.size());
-      for (int i = 0; i < x.size(); i++) {
-        xs(i) = AutoDiffDynamic(x(i), x.size()); // <--- FIX: Assign to index 'i'
-        xs(i).deriv()[i] = 1.0;
+    // parameters: the stiffnesses of all springs, then all masses
+    virtual size_t numParams() const override {
+      return mss.springs().size() + mss.masses().size();
+    }
+
+    virtual void evaluateParamDeriv(VectorView<double> x, MatrixView<double> df) const override {
+      df = 0.0;
+      size_t nm = mss.masses().size();
+      size_t ns = mss.springs().size();
+      auto xmat = x.range(0, D*nm).asMatrix(nm, D);
+      auto position = [&] (Connector c)
+      {
+        Vec<D> p;
+        if (c.type == Connector::FIX)
+          p = mss.fixes()[c.nr].pos;
+        else
+          p = xmat.row(c.nr);
+        return p;
+      };
+
+      // spring force is linear in the stiffness
+      for (size_t s = 0; s < ns; s++)
+      {
+        auto & spring = mss.springs()[s];
+        if (spring.stiffness < m_minstiffness || spring.stiffness >= m_maxstiffness)
+          continue;
+        auto [c1, c2] = spring.connectors;
+        Vec<D> p2MinusP1 = position(c2) - position(c1);
+        double dist = norm(p2MinusP1);
+        double fac = (dist - spring.length) / dist;
+        for (int d = 0; d < D; d++)
+        {
+          if (c1.type == Connector::MASS)
+            df(D*c1.nr+d, s) += fac * p2MinusP1(d) / mss.masses()[c1.nr].mass;
+          if (c2.type == Connector::MASS)
+            df(D*c2.nr+d, s) -= fac * p2MinusP1(d) / mss.masses()[c2.nr].mass;
+        }
       }
-      evaluateGeneric(xs, fs);
-      for (size_t r = 0; r < dimF(); r++) {
-        for (size_t c = 0; c < dimX(); c++) {
-          df(r, c) = fs[r].deriv()[c];
+
+      // f_i = g + F_i / m_i, so d f_i / d m_i = -(f_i - g) / m_i
+      Vector<> f(dimF());
+      evaluate(x, f);
+      for (size_t i = 0; i < nm; i++)
+        for (int d = 0; d < D; d++)
+        {
+          double g = m_external ? mss.getGravity()(d) : 0.0;
+          df(D*i+d, ns+i) = -(f(D*i+d) - g) / mss.masses()[i].mass;
+        }
+    }
+
+    // sparse version of the above, the springs only touch their masses
+    virtual void addParamDerivTrans(VectorView<double> x, VectorView<double> w,
+                                    VectorView<double> g) const override {
+      size_t nm = mss.masses().size();
+      size_t ns = mss.springs().size();
+      auto xmat = x.range(0, D*nm).asMatrix(nm, D);
+      auto position = [&] (Connector c)
+      {
+        Vec<D> p;
+        if (c.type == Connector::FIX)
+          p = mss.fixes()[c.nr].pos;
+        else
+          p = xmat.row(c.nr);
+        return p;
+      };
+
+      for (size_t s = 0; s < ns; s++)
+      {
+        auto & spring = mss.springs()[s];
+        if (spring.stiffness < m_minstiffness || spring.stiffness >= m_maxstiffness)
+          continue;
+        auto [c1, c2] = spring.connectors;
+        Vec<D> p2MinusP1 = position(c2) - position(c1);
+        double dist = norm(p2MinusP1);
+        double fac = (dist - spring.length) / dist;
+        for (int d = 0; d < D; d++)
+        {
+          if (c1.type == Connector::MASS)
+            g(s) += fac * p2MinusP1(d) * w(D*c1.nr+d) / mss.masses()[c1.nr].mass;
+          if (c2.type == Connector::MASS)
+            g(s) -= fac * p2MinusP1(d) * w(D*c2.nr+d) / mss.masses()[c2.nr].mass;
         }
       }
+
+      Vector<> f(dimF());
+      evaluate(x, f);
+      for (size_t i = 0; i < nm; i++)
+        for (int d = 0; d < D; d++)
+        {
+          double grav = m_external ? mss.getGravity()(d) : 0.0;
+          g(ns+i) -= (f(D*i+d) - grav) / mss.masses()[i].mass * w(D*i+d);
+        }
+    }
+
+    // the pattern of buildBase and the blocks of the masses that may touch
+    virtual SparsityPattern sparsity() const override {
+      return lastColoring()->pattern();
+    }
+
+    virtual size_t sparsityVersion() const override {
+      lastColoring();
+      std::lock_guard<std::mutex> guard(m_coloringmutex);
+      return m_patternversion;
+    }
+
+    // forward AD over evaluateGeneric, a few colors per evaluation
+    virtual void evaluateDerivSparse(VectorView<double> x, SparseMatrix & df) const override {
+      auto func = [this] (auto & xs, auto & fs) { evaluateGeneric(xs, fs); };
+      auto col = coloring(contactCandidates(x));
+      if (df.pattern() == col->pattern())
+        col->evaluateAD (func, x, df);
+      else
+        {
+          // a pattern from before the topology changed or the masses moved
+          SparseMatrix jac(col->sharedPattern());
+          col->evaluateAD (func, x, jac);
+          df.assign (jac);
+        }
     }
 
+    virtual void evaluateDeriv(VectorView<double> x, MatrixView<double> df) const override {
+      auto col = coloring(contactCandidates(x));
+      SparseMatrix jac(col->sharedPattern());
+      col->evaluateAD ([this] (auto & xs, auto & fs) { evaluateGeneric(xs, fs); }, x, jac);
+      jac.toDense(df);
+    }
 };
 
+// splits the forces for IMEX schemes into (stiff, rest): springs with
+// stiffness >= threshold and the joints, and the soft springs with the
+// external forces
+template <int D>
+auto SplitStiffSprings (MassSpringSystem<D> & mss, double threshold)
+{
+  double inf = std::numeric_limits<double>::infinity();
+  return std::pair { std::make_shared<MSS_Function<D>>(mss, threshold, inf, false, true),
+                     std::make_shared<MSS_Function<D>>(mss, 0, threshold, true, false) };
+}
+
+
 #endif
\ No newline at end of file
@@ -0,0 +1,346 @@
+#ifndef MSS_FILE_HPP
+#define MSS_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mass_spring.hpp"
+
+
+// Native binary model format for mass-spring systems.
+//
+// A fixed size header is followed by structure-of-arrays sections, each
+// aligned to 64 bytes, such that a memory mapped file can be handed to
+// the bulk construction functions of MassSpringSystem without parsing.
+// Later versions append to the header, version 1 files have no contact
+// parameters, version 2 files no spring break strains.
+
+class ModelFileHeader
+{
+public:
+  char magic[8];                 // "ASCMSS01"
+  uint32_t dim;
+  uint32_t version;
+  uint64_t nfixes, nmasses, nsprings, njoints;
+  double gravity[3];
+  // section offsets from the begin of the file
+  uint64_t fixpos;                          // double[nfixes*dim]
+  uint64_t mass, masspos, massvel;          // double[nmasses], double[nmasses*dim] x2
+  uint64_t springlength, springstiffness;   // double[nsprings]
+  uint64_t springnr, springfix;             // uint64_t[2*nsprings], uint8_t[2*nsprings]
+  uint64_t jointlength;                     // double[njoints]
+  uint64_t jointnr, jointfix;               // uint64_t[2*njoints], uint8_t[2*njoints]
+  uint64_t filesize;
+  // version 2
+  double contactradius, contactstiffness, ground, groundstiffness;
+  // version 3
+  uint64_t springbreakstrain;               // double[nsprings]
+};
+
+namespace mss_file_detail
+{
+  inline constexpr char magic[8] = { 'A','S','C','M','S','S','0','1' };
+  inline constexpr uint32_t version = 3;
+  inline uint64_t align (uint64_t offset) { return (offset+63) & ~uint64_t(63); }
+
+  // bytes of the header written by a version, 0 for unknown versions
+  inline size_t headerSize (uint32_t version)
+  {
+    switch (version)
+      {
+      case 1: return offsetof(ModelFileHeader, contactradius);
+      case 2: return offsetof(ModelFileHeader, springbreakstrain);
+      case 3: return sizeof(ModelFileHeader);
+      default: return 0;
+      }
+  }
+
+  template <typename T>
+  T * at (std::vector<char> & buf, uint64_t offset) { return reinterpret_cast<T*>(buf.data()+offset); }
+}
+
+
+// read-only view of a model file, memory mapped where available
+class MappedModelFile
+{
+  const char * m_data = nullptr;
+  size_t m_size = 0;
+  std::vector<char> m_buffer;     // fallback without mmap
+public:
+  MappedModelFile (const std::string & filename)
+  {
+#ifndef _WIN32
+    int fd = open (filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("cannot open model file "+filename);
+    struct stat st;
+    if (fstat (fd, &st) != 0)
+      {
+        close (fd);
+        throw std::runtime_error("cannot stat model file "+filename);
+      }
+    m_size = st.st_size;
+    void * p = m_size ? mmap (nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close (fd);
+    if (p == MAP_FAILED)
+      throw std::runtime_error("cannot map model file "+filename);
+    m_data = static_cast<const char*>(p);
+#else
+    FILE * file = std::fopen (filename.c_str(), "rb");
+    if (!file)
+      throw std::runtime_error("cannot open model file "+filename);
+    char block[65536];
+    size_t n;
+    while ((n = std::fread (block, 1, sizeof(block), file)) > 0)
+      m_buffer.insert (m_buffer.end(), block, block+n);
+    std::fclose (file);
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+#endif
+
+    using mss_file_detail::headerSize;
+    if (m_size < headerSize(1)
+        || std::memcmp (header().magic, mss_file_detail::magic, 8) != 0
+        || header().filesize != m_size)
+      {
+        release();
+        throw std::runtime_error(filename+" is not a valid model file");
+      }
+    if (headerSize(header().version) == 0 || m_size < headerSize(header().version))
+      {
+        release();
+        throw std::runtime_error(filename+": unsupported model file version");
+      }
+  }
+
+  MappedModelFile (const MappedModelFile &) = delete;
+  MappedModelFile & operator= (const MappedModelFile &) = delete;
+  ~MappedModelFile() { release(); }
+
+  const ModelFileHeader & header() const
+  {
+    return *reinterpret_cast<const ModelFileHeader*>(m_data);
+  }
+
+  // only the fields of header().version may be accessed
+  // count entries of type T at offset, checked against the file size
+  template <typename T>
+  const T * section (uint64_t offset, uint64_t count) const
+  {
+    if (count > m_size / sizeof(T) || offset > m_size - count*sizeof(T)
+        || offset % alignof(T) != 0)
+      throw std::runtime_error("model file: section out of range");
+    return reinterpret_cast<const T*>(m_data+offset);
+  }
+
+private:
+  void release()
+  {
+#ifndef _WIN32
+    if (m_data) munmap (const_cast<char*>(m_data), m_size);
+#endif
+    m_data = nullptr;
+  }
+};
+
+
+
+template <int D>
+void SaveModel (const std::string & filename, MassSpringSystem<D> & mss)
+{
+  using mss_file_detail::align;
+  static_assert (D <= 3, "model files support up to 3 dimensions");
+
+  ModelFileHeader h;
+  std::memset (&h, 0, sizeof(h));
+  std::memcpy (h.magic, mss_file_detail::magic, 8);
+  h.dim = D;
+  h.version = mss_file_detail::version;
+  h.nfixes = mss.fixes().size();
+  h.nmasses = mss.masses().size();
+  h.nsprings = mss.springs().size();
+  h.njoints = mss.joints().size();
+  for (int d = 0; d < D; d++)
+    h.gravity[d] = mss.getGravity()(d);
+  auto & contact = mss.getContact();
+  h.contactradius = contact.radius;
+  h.contactstiffness = contact.stiffness;
+  h.ground = contact.ground;
+  h.groundstiffness = contact.groundstiffness;
+
+  uint64_t offset = align (sizeof(h));
+  auto place = [&offset] (uint64_t & sec, uint64_t bytes)
+  {
+    sec = offset;
+    offset = align (offset+bytes);
+  };
+  place (h.fixpos, h.nfixes*D*sizeof(double));
+  place (h.mass, h.nmasses*sizeof(double));
+  place (h.masspos, h.nmasses*D*sizeof(double));
+  place (h.massvel, h.nmasses*D*sizeof(double));
+  place (h.springlength, h.nsprings*sizeof(double));
+  place (h.springstiffness, h.nsprings*sizeof(double));
+  place (h.springnr, 2*h.nsprings*sizeof(uint64_t));
+  place (h.springfix, 2*h.nsprings);
+  place (h.jointlength, h.njoints*sizeof(double));
+  place (h.jointnr, 2*h.njoints*sizeof(uint64_t));
+  place (h.jointfix, 2*h.njoints);
+  place (h.springbreakstrain, h.nsprings*sizeof(double));
+  h.filesize = offset;
+
+  std::vector<char> buf(h.filesize, 0);
+  std::memcpy (buf.data(), &h, sizeof(h));
+  using mss_file_detail::at;
+
+  double * fixpos = at<double> (buf, h.fixpos);
+  for (size_t i = 0; i < h.nfixes; i++)
+    for (int d = 0; d < D; d++)
+      fixpos[D*i+d] = mss.fixes()[i].pos(d);
+
+  double * mass = at<double> (buf, h.mass);
+  double * masspos = at<double> (buf, h.masspos);
+  double * massvel = at<double> (buf, h.massvel);
+  for (size_t i = 0; i < h.nmasses; i++)
+    {
+      auto & m = mss.masses()[i];
+      mass[i] = m.mass;
+      for (int d = 0; d < D; d++)
+        {
+          masspos[D*i+d] = m.pos(d);
+          massvel[D*i+d] = m.vel(d);
+        }
+    }
+
+  double * springlength = at<double> (buf, h.springlength);
+  double * springstiffness = at<double> (buf, h.springstiffness);
+  uint64_t * springnr = at<uint64_t> (buf, h.springnr);
+  uint8_t * springfix = at<uint8_t> (buf, h.springfix);
+  double * springbreakstrain = at<double> (buf, h.springbreakstrain);
+  for (size_t i = 0; i < h.nsprings; i++)
+    {
+      auto & s = mss.springs()[i];
+      springlength[i] = s.length;
+      springstiffness[i] = s.stiffness;
+      springbreakstrain[i] = s.breakstrain;
+      for (int k = 0; k < 2; k++)
+        {
+          springnr[2*i+k] = s.connectors[k].nr;
+          springfix[2*i+k] = s.connectors[k].type == Connector::FIX;
+        }
+    }
+
+  double * jointlength = at<double> (buf, h.jointlength);
+  uint64_t * jointnr = at<uint64_t> (buf, h.jointnr);
+  uint8_t * jointfix = at<uint8_t> (buf, h.jointfix);
+  for (size_t i = 0; i < h.njoints; i++)
+    {
+      auto & j = mss.joints()[i];
+      jointlength[i] = j.length;
+      for (int k = 0; k < 2; k++)
+        {
+          jointnr[2*i+k] = j.connectors[k].nr;
+          jointfix[2*i+k] = j.connectors[k].type == Connector::FIX;
+        }
+    }
+
+  FILE * file = std::fopen (filename.c_str(), "wb");
+  if (!file)
+    throw std::runtime_error("cannot open model file "+filename);
+  bool ok = std::fwrite (buf.data(), 1, buf.size(), file) == buf.size();
+  ok = (std::fclose (file) == 0) && ok;
+  if (!ok)
+    throw std::runtime_error("writing model file "+filename+" failed");
+}
+
+
+// append the model stored in filename to mss
+template <int D>
+void LoadModel (const std::string & filename, MassSpringSystem<D> & mss)
+{
+  MappedModelFile file(filename);
+  auto & h = file.header();
+  if (h.dim != D)
+    throw std::invalid_argument(filename+": model has different dimension");
+
+  // all sections are validated before anything is added to mss
+  const double * fixpos = file.section<double>(h.fixpos, h.nfixes*D);
+  const double * mass = file.section<double>(h.mass, h.nmasses);
+  const double * masspos = file.section<double>(h.masspos, h.nmasses*D);
+  const double * massvel = file.section<double>(h.massvel, h.nmasses*D);
+  const double * springlength = file.section<double>(h.springlength, h.nsprings);
+  const double * springstiffness = file.section<double>(h.springstiffness, h.nsprings);
+  const uint64_t * springnr = file.section<uint64_t>(h.springnr, 2*h.nsprings);
+  const uint8_t * springfix = file.section<uint8_t>(h.springfix, 2*h.nsprings);
+  const double * jointlength = file.section<double>(h.jointlength, h.njoints);
+  const uint64_t * jointnr = file.section<uint64_t>(h.jointnr, 2*h.njoints);
+  const uint8_t * jointfix = file.section<uint8_t>(h.jointfix, 2*h.njoints);
+  const double * springbreakstrain = h.version >= 3
+    ? file.section<double>(h.springbreakstrain, h.nsprings) : nullptr;
+  for (size_t i = 0; i < 2*h.nsprings; i++)
+    if (springnr[i] >= (springfix[i] ? h.nfixes : h.nmasses))
+      throw std::runtime_error(filename+": spring connector out of range");
+  for (size_t i = 0; i < 2*h.njoints; i++)
+    if (jointnr[i] >= (jointfix[i] ? h.nfixes : h.nmasses))
+      throw std::runtime_error(filename+": joint connector out of range");
+
+  Vec<D> gravity;
+  for (int d = 0; d < D; d++)
+    gravity(d) = h.gravity[d];
+  mss.setGravity (gravity);
+  if (h.version >= 2)
+    {
+      ContactParameters contact;
+      contact.radius = h.contactradius;
+      contact.stiffness = h.contactstiffness;
+      contact.ground = h.ground;
+      contact.groundstiffness = h.groundstiffness;
+      mss.setContact (contact);
+    }
+
+  // connector numbers in the file are local to the model
+  size_t firstfix = mss.fixes().size();
+  size_t firstmass = mss.masses().size();
+  mss.reserve (firstmass+h.nmasses, mss.springs().size()+h.nsprings,
+               firstfix+h.nfixes, mss.joints().size()+h.njoints);
+
+  mss.addFixes (h.nfixes, fixpos);
+  mss.addMasses (h.nmasses, mass, masspos, massvel);
+
+  if (firstfix == 0 && firstmass == 0)
+    mss.addSprings (h.nsprings, springnr,
+                    springstiffness, springlength, springfix, springbreakstrain);
+  else
+    {
+      std::vector<uint64_t> nr(2*h.nsprings);
+      for (size_t i = 0; i < nr.size(); i++)
+        nr[i] = springnr[i] + (springfix[i] ? firstfix : firstmass);
+      mss.addSprings (h.nsprings, nr.data(),
+                      springstiffness, springlength, springfix, springbreakstrain);
+    }
+
+  for (size_t i = 0; i < h.njoints; i++)
+    {
+      Joint j;
+      j.length = jointlength[i];
+      for (int k = 0; k < 2; k++)
+        if (jointfix[2*i+k])
+          j.connectors[k] = { Connector::FIX, jointnr[2*i+k] + firstfix };
+        else
+          j.connectors[k] = { Connector::MASS, jointnr[2*i+k] + firstmass };
+      mss.addJoint (j);
+    }
+}
+
+#endif
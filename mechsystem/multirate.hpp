@@ -0,0 +1,278 @@
+#ifndef MULTIRATE_HPP
+#define MULTIRATE_HPP
+
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include <solver_stats.hpp>
+
+#include "mass_spring.hpp"
+
+
+// Multirate velocity Verlet for mass-spring systems.
+//
+// Masses are split into a slow and a fast group by their local frequency
+// sqrt(sum k / m) over the attached springs. Per macro step H the slow
+// masses do one Verlet step, the fast masses k steps of size H/k with
+// the slow positions interpolated linearly over the macro step. Forces
+// are computed only from springs attached to the group being advanced,
+// and the accelerations at the end of a macro step are the ones at the
+// begin of the next, so the cost of a macro step is about
+// (#slow + k #fast) springs.
+//
+// Broken springs are removed from the groups as they are reported by
+// springRemovals(), masses keep their group. Other changes of the
+// topology repeat the partition.
+//
+// Joints and contact are not supported.
+
+template <int D>
+class MultirateVerlet
+{
+  MassSpringSystem<D> & m_mss;
+  int m_substeps;
+  std::vector<bool> m_fast;
+  std::vector<size_t> m_fastmasses, m_slowmasses;
+  std::vector<size_t> m_fastsprings, m_slowsprings;   // attached to a fast/slow mass
+  // position of every spring in m_fastsprings / m_slowsprings, none if not in it
+  static constexpr size_t none = std::numeric_limits<size_t>::max();
+  std::vector<size_t> m_fastpos, m_slowpos;
+  double m_H, m_limit;
+  size_t m_version = size_t(-1), m_nremovals = 0;
+
+public:
+  // masses with local frequency * H > limit are fast
+  MultirateVerlet (MassSpringSystem<D> & mss, double H, int substeps, double limit = 1.0)
+    : m_mss(mss), m_substeps(substeps), m_H(H), m_limit(limit)
+  {
+    setup();
+  }
+
+  const std::vector<bool> & fast() const { return m_fast; }
+  size_t numFast() const { return m_fastmasses.size(); }
+
+  // advances positions x and velocities v (as in getState) by steps macro steps
+  void solve (double tend, int steps, VectorView<double> x, VectorView<double> v,
+              std::function<void(double,VectorView<double>)> callback = nullptr);
+
+private:
+  void setup()
+  {
+    if (!m_mss.joints().empty())
+      throw std::invalid_argument("MultirateVerlet: joints are not supported");
+    if (m_mss.getContact().massContact() || m_mss.getContact().groundContact())
+      throw std::invalid_argument("MultirateVerlet: contact is not supported");
+
+    size_t m = m_mss.masses().size();
+    std::vector<double> ksum(m, 0.0);
+    for (auto & s : m_mss.springs())
+      for (auto c : s.connectors)
+        if (c.type == Connector::MASS)
+          ksum[c.nr] += s.stiffness;
+
+    m_fast.resize (m);
+    for (size_t i = 0; i < m; i++)
+      m_fast[i] = std::sqrt (ksum[i] / m_mss.masses()[i].mass) * m_H > m_limit;
+
+    m_fastmasses.clear();
+    m_slowmasses.clear();
+    for (size_t i = 0; i < m_fast.size(); i++)
+      (m_fast[i] ? m_fastmasses : m_slowmasses).push_back (i);
+
+    m_fastsprings.clear();
+    m_slowsprings.clear();
+    m_fastpos.assign (m_mss.springs().size(), none);
+    m_slowpos.assign (m_mss.springs().size(), none);
+    for (size_t i = 0; i < m_mss.springs().size(); i++)
+      {
+        bool fast = false, slow = false;
+        for (auto c : m_mss.springs()[i].connectors)
+          if (c.type == Connector::MASS)
+            (m_fast[c.nr] ? fast : slow) = true;
+        if (fast)
+          {
+            m_fastpos[i] = m_fastsprings.size();
+            m_fastsprings.push_back (i);
+          }
+        if (slow)
+          {
+            m_slowpos[i] = m_slowsprings.size();
+            m_slowsprings.push_back (i);
+          }
+      }
+    m_version = m_mss.topologyVersion();
+    m_nremovals = m_mss.springRemovals().size();
+  }
+
+  // follows the changes of the system, returns whether there were any
+  bool update()
+  {
+    auto & removals = m_mss.springRemovals();
+    if (m_mss.topologyVersion() != m_version)
+      {
+        setup();
+        return true;
+      }
+    if (removals.size() == m_nremovals)
+      return false;
+    for ( ; m_nremovals < removals.size(); m_nremovals++)
+      {
+        auto [removed, last] = removals[m_nremovals];
+        removeSpring (m_fastsprings, m_fastpos, removed, last);
+        removeSpring (m_slowsprings, m_slowpos, removed, last);
+      }
+    m_fastpos.resize (m_mss.springs().size());
+    m_slowpos.resize (m_mss.springs().size());
+    return true;
+  }
+
+  // replays MassSpringSystem::removeSpring on one group
+  static void removeSpring (std::vector<size_t> & springs, std::vector<size_t> & pos,
+                            size_t removed, size_t last)
+  {
+    if (size_t p = pos[removed]; p != none)
+      {
+        springs[p] = springs.back();
+        pos[springs[p]] = p;
+        springs.pop_back();
+        pos[removed] = none;
+      }
+    if (last != removed && pos[last] != none)
+      {
+        springs[pos[last]] = removed;
+        pos[removed] = pos[last];
+        pos[last] = none;
+      }
+  }
+
+  // accelerations of the masses of one group from gravity and the given springs
+  void acceleration (VectorView<double> x, const std::vector<size_t> & masses,
+                     const std::vector<size_t> & springs, bool fastgroup,
+                     VectorView<double> a) const
+  {
+    for (size_t i : masses)
+      for (int d = 0; d < D; d++)
+        a(D*i+d) = m_mss.getGravity()(d);
+
+    auto position = [&] (Connector c)
+    {
+      Vec<D> p;
+      if (c.type == Connector::FIX)
+        p = m_mss.fixes()[c.nr].pos;
+      else
+        for (int d = 0; d < D; d++)
+          p(d) = x(D*c.nr+d);
+      return p;
+    };
+
+    for (size_t nr : springs)
+      {
+        auto & spring = m_mss.springs()[nr];
+        auto [c1, c2] = spring.connectors;
+        Vec<D> p2MinusP1 = position(c2) - position(c1);
+        double dist = norm(p2MinusP1);
+        double force = spring.stiffness * (dist - spring.length) / dist;
+        for (int k = 0; k < 2; k++)
+          {
+            Connector c = spring.connectors[k];
+            if (c.type != Connector::MASS || m_fast[c.nr] != fastgroup) continue;
+            double fac = (k == 0 ? force : -force) / m_mss.masses()[c.nr].mass;
+            for (int d = 0; d < D; d++)
+              a(D*c.nr+d) += fac * p2MinusP1(d);
+          }
+      }
+  }
+};
+
+
+
+template <int D>
+void MultirateVerlet<D> :: solve (double tend, int steps, VectorView<double> x, VectorView<double> v,
+                                  std::function<void(double,VectorView<double>)> callback)
+{
+  size_t n = D*m_mss.masses().size();
+  double H = tend/steps;
+  double h = H/m_substeps;
+
+  Vector<> a(n), xslowold(n), xslownew(n);
+  ASC_ODE_STATS_ADD(alloc_bytes, sizeof(double)*3*n);
+  a = 0.0;
+
+  // a holds the accelerations at x of both groups from the end of the
+  // previous step, unless springs changed in between
+  bool current = false;
+  double t = 0;
+  for (int step = 0; step < steps; step++)
+    {
+      if (update())
+        current = false;
+      ASC_ODE_STATS_ADD(steps, 1);
+
+      // slow: half kick and drift
+      if (!current)
+        acceleration (x, m_slowmasses, m_slowsprings, false, a);
+      for (size_t i : m_slowmasses)
+        for (int d = 0; d < D; d++)
+          {
+            size_t j = D*i+d;
+            v(j) += H/2 * a(j);
+            xslowold(j) = x(j);
+            xslownew(j) = x(j) + H * v(j);
+          }
+
+      // fast: substeps with interpolated slow positions
+      auto interpolate = [&] (double theta)
+      {
+        for (size_t i : m_slowmasses)
+          for (int d = 0; d < D; d++)
+            x(D*i+d) = (1-theta) * xslowold(D*i+d) + theta * xslownew(D*i+d);
+      };
+
+      if (!m_fastmasses.empty())
+        {
+          if (!current)
+            acceleration (x, m_fastmasses, m_fastsprings, true, a);
+          for (int sub = 0; sub < m_substeps; sub++)
+            {
+              for (size_t i : m_fastmasses)
+                for (int d = 0; d < D; d++)
+                  {
+                    v(D*i+d) += h/2 * a(D*i+d);
+                    x(D*i+d) += h * v(D*i+d);
+                  }
+              interpolate (double(sub+1) / m_substeps);
+              acceleration (x, m_fastmasses, m_fastsprings, true, a);
+              for (size_t i : m_fastmasses)
+                for (int d = 0; d < D; d++)
+                  v(D*i+d) += h/2 * a(D*i+d);
+            }
+        }
+      interpolate (1.0);
+
+      // slow: half kick at the new positions
+      acceleration (x, m_slowmasses, m_slowsprings, false, a);
+      for (size_t i : m_slowmasses)
+        for (int d = 0; d < D; d++)
+          v(D*i+d) += H/2 * a(D*i+d);
+      current = true;
+
+      t += H;
+      if (callback) callback(t, x);
+    }
+}
+
+
+// multirate Verlet with the partition for the macro step tend/steps
+template <int D>
+void SolveODE_Multirate (MassSpringSystem<D> & mss, double tend, int steps, int substeps,
+                         VectorView<double> x, VectorView<double> v,
+                         std::function<void(double,VectorView<double>)> callback = nullptr)
+{
+  MultirateVerlet<D> solver(mss, tend/steps, substeps);
+  solver.solve (tend, steps, x, v, callback);
+}
+
+#endif
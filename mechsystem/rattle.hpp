@@ -0,0 +1,161 @@
+#ifndef RATTLE_HPP
+#define RATTLE_HPP
+
+#include <cmath>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+
+#include <solver_stats.hpp>
+
+#include "mass_spring.hpp"
+
+
+// RATTLE: velocity Verlet for mass-spring systems, joints are enforced
+// by projecting positions (SHAKE) and velocities onto the constraints,
+// one joint at a time until all of them are satisfied. Springs and
+// gravity are evaluated by MSS_Function with all multipliers set to 0.
+//
+// x and v hold positions and velocities of the masses as in getState,
+// trailing entries for the joint multipliers are not touched.
+
+template <int D>
+void SolveODE_Rattle (MassSpringSystem<D> & mss, double tend, int steps,
+                      VectorView<double> x, VectorView<double> v,
+                      std::function<void(double,VectorView<double>)> callback = nullptr,
+                      double tol = 1e-12, int maxsteps = 1000)
+{
+  size_t m = mss.masses().size();
+  size_t n = D*m;
+  size_t nj = mss.joints().size();
+  double dt = tend/steps;
+
+  MSS_Function<D> func(mss);
+  Vector<> y(n+nj), a(n+nj), xold(n);
+  Vector<> invmass(m);
+  ASC_ODE_STATS_ADD(alloc_bytes, sizeof(double)*(2*(n+nj) + n + m));
+  for (size_t i = 0; i < m; i++)
+    invmass(i) = 1.0 / mss.masses()[i].mass;
+
+  // the forces, multipliers are 0
+  y = 0.0;
+  auto acceleration = [&] ()
+  {
+    ASC_ODE_STATS_TIMER(time_function);
+    ASC_ODE_STATS_ADD(function_evals, 1);
+    for (size_t i = 0; i < n; i++)
+      y(i) = x(i);
+    func.evaluate (y, a);
+  };
+
+  auto position = [&] (VectorView<double> pos, Connector c)
+  {
+    Vec<D> p;
+    if (c.type == Connector::FIX)
+      p = mss.fixes()[c.nr].pos;
+    else
+      for (int d = 0; d < D; d++)
+        p(d) = pos(D*c.nr+d);
+    return p;
+  };
+  auto weight = [&] (Connector c) { return c.type == Connector::MASS ? invmass(c.nr) : 0.0; };
+
+  // adds +-coef/m * dir to the two ends of a joint
+  auto update = [&] (VectorView<double> vec, const Joint & joint, double coef, const Vec<D> & dir)
+  {
+    for (int k = 0; k < 2; k++)
+      {
+        Connector c = joint.connectors[k];
+        if (c.type != Connector::MASS) continue;
+        double sign = (k == 0) ? 1 : -1;
+        for (int d = 0; d < D; d++)
+          vec(D*c.nr+d) += sign * invmass(c.nr) * coef * dir(d);
+      }
+  };
+
+  auto fail = [&] (const char * what, double err)
+  {
+    std::ostringstream msg;
+    msg << "RATTLE: " << what << " did not converge: violation " << err
+        << " after " << maxsteps << " sweeps";
+    throw std::domain_error(msg.str());
+  };
+
+  acceleration();
+  double t = 0;
+  for (int step = 0; step < steps; step++)
+    {
+      ASC_ODE_STATS_ADD(steps, 1);
+      for (size_t i = 0; i < n; i++)
+        {
+          xold(i) = x(i);
+          v(i) += dt/2 * a(i);
+          x(i) += dt * v(i);
+        }
+
+      // SHAKE: move along the joint directions of the old positions until
+      // |p1-p2|^2 = L^2, the same correction is applied to v
+      double err = 0;
+      int sweep = 0;
+      for ( ; sweep < maxsteps; sweep++)
+        {
+          err = 0;
+          for (auto & joint : mss.joints())
+            {
+              auto [c1, c2] = joint.connectors;
+              Vec<D> d = position(x, c1) - position(x, c2);
+              Vec<D> dold = position(xold, c1) - position(xold, c2);
+              double len2 = joint.length*joint.length;
+              double diff = len2;
+              double ddold = 0;
+              for (int k = 0; k < D; k++)
+                {
+                  diff -= d(k)*d(k);
+                  ddold += d(k)*dold(k);
+                }
+              err = std::max(err, std::fabs(diff) / len2);
+              double w = weight(c1) + weight(c2);
+              if (w == 0 || ddold == 0)
+                throw std::invalid_argument("RATTLE: degenerate joint");
+              double g = diff / (2*ddold*w);
+              update (x, joint, g, dold);
+              update (v, joint, g/dt, dold);
+            }
+          if (err < tol) break;
+        }
+      if (sweep == maxsteps) fail ("position projection", err);
+
+      acceleration();
+      for (size_t i = 0; i < n; i++)
+        v(i) += dt/2 * a(i);
+
+      // remove the velocity components along the joints
+      for (sweep = 0; sweep < maxsteps; sweep++)
+        {
+          err = 0;
+          for (auto & joint : mss.joints())
+            {
+              auto [c1, c2] = joint.connectors;
+              Vec<D> d = position(x, c1) - position(x, c2);
+              double dv = 0, dd = 0;
+              for (int k = 0; k < D; k++)
+                {
+                  double vel1 = c1.type == Connector::MASS ? v(D*c1.nr+k) : 0.0;
+                  double vel2 = c2.type == Connector::MASS ? v(D*c2.nr+k) : 0.0;
+                  dv += d(k) * (vel1-vel2);
+                  dd += d(k) * d(k);
+                }
+              err = std::max(err, std::fabs(dv) / dd);
+              double k = -dv / (dd * (weight(c1) + weight(c2)));
+              update (v, joint, k, d);
+            }
+          if (err*dt < tol) break;
+        }
+      if (sweep == maxsteps) fail ("velocity projection", err);
+
+      t += dt;
+      if (callback) callback(t, x);
+    }
+}
+
+#endif
@@ -3,13 +3,14 @@ sys.path.append('/Users/joachim/texjs/lva/IntroSC/ASC-ODE/build/mechsystem')
 sys.path.append('../build/mechsystem')
 
 from mass_spring import *
+import numpy as np
 
 
 mss = MassSpringSystem3d()
 mss.gravity = (0,0,-9.81)
 
-mA = mss.add (Mass(1, (1,0,0)))
-mB = mss.add (Mass(2, (2,0,0)))
+mA = mss.add (Mass(1, (1,0,0), (0,0,0)))
+mB = mss.add (Mass(2, (2,0,0), (0,0,0)))
 f1 = mss.add (Fix( (0,0,0)) )
 mss.add (Spring(1, 10, (f1, mA)))
 mss.add (Spring(1, 20, (mA, mB)))
@@ -33,3 +34,124 @@ mss.masses[0].mass = 5
 
 for m in mss.masses:
     print (m.mass, m.pos)
+
+
+
+# regression checks
+
+def chain(n = 5, breakstrain = float('inf')):
+    mss = MassSpringSystem3d()
+    mss.gravity = (0,0,-9.81)
+    prev = mss.add (Fix( (0,0,0)) )
+    for i in range(n):
+        m = mss.add (Mass(1, (i+1,0,0), (0,0,0)))
+        mss.add (Spring(1, 100, (prev, m), breakstrain))
+        prev = m
+    return mss
+
+def maxdiff(a, b):
+    return max(abs(x-y) for x,y in zip(a,b))
+
+def raises(f, error = ValueError):
+    try:
+        f()
+    except error:
+        return True
+    return False
+
+
+# a run resumed from a checkpoint continues the uninterrupted one bit for bit
+ref = chain()
+ref.simulate (0.2, 20)
+
+first = chain()
+first.simulate (0.1, 10, checkpoint="test_checkpoint.ckp", checkpoint_every=10)
+resumed = MassSpringSystem3d()
+state = resumed.loadCheckpoint ("test_checkpoint.ckp")
+assert state.step == 10
+assert raises (lambda: resumed.simulate (0.1, 20, state=state))
+resumed.simulate (0.1, 10, state=state)
+assert state.step == 20
+assert resumed.getState() == ref.getState()
+assert raises (lambda: chain().simulate (0.1, 10, method="rattle", checkpoint="test_checkpoint.ckp"))
+print ("checkpoint resume ok")
+
+
+# bulk construction builds the same system as single adds, and the model
+# file reproduces it
+bulk = MassSpringSystem3d()
+bulk.gravity = (0,0,-9.81)
+bulk.addFixes (np.zeros((1,3)))
+bulk.addMasses (np.ones(5), np.array([[i+1,0,0] for i in range(5)], dtype=float))
+pairs = np.array([[0,0]] + [[i,i+1] for i in range(4)], dtype=np.uint64)
+isfix = np.array([[1,0]] + [[0,0]]*4, dtype=np.uint8)
+bulk.addSprings (pairs, 100*np.ones(5), np.ones(5), isfix)
+single = chain()
+assert bulk.getState() == single.getState()
+bulk.simulate (0.1, 10)
+single.simulate (0.1, 10)
+assert bulk.getState() == single.getState()
+
+bulk.save ("test_model.mss")
+loaded = MassSpringSystem3d.load ("test_model.mss")
+assert loaded.getState() == bulk.getState()
+assert len(loaded.springs) == len(bulk.springs)
+with open("test_model.mss", "r+b") as f:
+    f.truncate (100)
+assert raises (lambda: MassSpringSystem3d.load ("test_model.mss"), RuntimeError)
+print ("model file ok")
+
+
+# masses piling up on the ground: contact runs resume bit for bit, and the
+# contact parameters survive the model file
+def pile(n = 8):
+    mss = MassSpringSystem3d()
+    mss.gravity = (0,0,-9.81)
+    for i in range(n):
+        mss.add (Mass(1, (0.05*(i%2), 0, 0.3*i+0.2), (0,0,0)))
+    mss.setContact (0.1, 1e4, ground=0, ground_stiffness=1e4)
+    return mss
+
+ref = pile()
+ref.simulate (0.4, 400)
+first = pile()
+first.simulate (0.2, 200, checkpoint="test_checkpoint.ckp", checkpoint_every=200)
+resumed = MassSpringSystem3d()
+state = resumed.loadCheckpoint ("test_checkpoint.ckp")
+resumed.simulate (0.2, 200, state=state)
+assert resumed.getState() == ref.getState()
+
+model = pile()
+model.save ("test_model.mss")
+loaded = MassSpringSystem3d.load ("test_model.mss")
+model.simulate (0.4, 400)
+loaded.simulate (0.4, 400)
+assert loaded.getState() == model.getState()
+print ("contact ok")
+
+
+# overstrained springs break during the run, and the breakstrains survive
+# the model file
+model = chain(breakstrain = 0.1)
+model.save ("test_model.mss")
+loaded = MassSpringSystem3d.load ("test_model.mss")
+assert [s.breakstrain for s in loaded.springs] == [s.breakstrain for s in model.springs]
+model.simulate (0.5, 50)
+loaded.simulate (0.5, 50)
+assert len(model.springs) < 5
+assert len(loaded.springs) == len(model.springs)
+assert loaded.getState() == model.getState()
+print ("breaking springs ok")
+
+
+# rattle and multirate leave the accelerations of the final state: an alpha
+# run continuing a free fall stays exact. Multirate rejects contact.
+for method in ["rattle", "multirate"]:
+    mss = MassSpringSystem3d()
+    mss.gravity = (0,0,-9.81)
+    mss.add (Mass(1, (0,0,0), (1,0,0)))
+    mss.simulate (0.1, 10, method=method)
+    mss.simulate (0.1, 10)
+    assert maxdiff(mss.getState(), [0.2, 0, -9.81/2*0.2**2]) < 1e-12
+assert raises (lambda: pile().simulate (0.1, 10, method="multirate"))
+print ("method switch ok")
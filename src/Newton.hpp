@@ -1,39 +1,147 @@
 #ifndef Newton_h
 #define Newton_h
 
+#include <memory>
+#include <sstream>
+
 #include "nonlinfunc.hpp"
-#include <inverse.hpp>
+#include "solver_stats.hpp"
 #include <lapack_interface.hpp>
 
 namespace ASC_ode
 {  
-  void NewtonSolver (std::shared_ptr<NonlinearFunction> func, VectorView<double> x,
-                     double tol = 1e-10, int maxsteps = 10,
-                     std::function<void(int,double,VectorView<double>)> callback = nullptr)
+  // compressed storage for the Jacobian of func if at most a quarter of
+  // its entries are structurally nonzero, else nullptr. The pattern is
+  // the one cached by func, shared by all its Jacobians.
+  inline std::unique_ptr<SparseMatrix> SparseJacobian (std::shared_ptr<NonlinearFunction> func)
   {
-    Vector<double> res(func->dimF());
-    Matrix<double> fprime(func->dimF(), func->dimX());
+    auto pattern = func->sharedSparsity();
+    if (pattern->isDense() || 4*pattern->nnz() > pattern->rows()*pattern->cols())
+      return nullptr;
+    return std::make_unique<SparseMatrix>(pattern);
+  }
 
-    for (int i = 0; i < maxsteps; i++)
+  // assembled in sjac if given, else in jac
+  inline void EvaluateJacobian (std::shared_ptr<NonlinearFunction> func, VectorView<double> x,
+                                SparseMatrix * sjac, MatrixView<double> jac)
+  {
+    ASC_ODE_STATS_TIMER(time_jacobian);
+    ASC_ODE_STATS_ADD(jacobian_evals, 1);
+    if (sjac)
+      func->evaluateDerivSparse(x, *sjac);
+    else
+      func->evaluateDeriv(x, jac);
+  }
+
+  // one Newton update x -= f'(x)^-1 res for the residual res = f(x), res
+  // is overwritten. The Jacobian is factored in sjac's compressed storage
+  // if given, else in fprime.
+  inline void NewtonStep (std::shared_ptr<NonlinearFunction> func, VectorView<double> x,
+                          VectorView<double> res, Matrix<double> & fprime, SparseMatrix * sjac)
+  {
+    EvaluateJacobian (func, x, sjac, fprime);
+
+    ASC_ODE_STATS_ADD(factorizations, 1);
+    if (sjac)
+      {
+        auto lu = [&] { ASC_ODE_STATS_TIMER(time_factorization); return SparseLU(*sjac); }();
+        lu.solve(res);
+      }
+    else
       {
-        func->evaluate(x, res);
-        double err= norm(res);
-        if (err < tol) return;
+        auto lu = [&] { ASC_ODE_STATS_TIMER(time_factorization); return LapackLU(fprime); }();
+        lu.solve(res);
+      }
+    x -= res;
+    ASC_ODE_STATS_ADD(newton_iterations, 1);
+  }
 
-        func->evaluateDeriv(x, fprime);
+  // Newton iteration, fprime is the storage of dense Jacobians.
+  // Returns false if x was converged before any Jacobian was computed.
+  // The sparse Jacobian is set up after the first residual, so patterns
+  // depending on the state (contacts) belong to the initial guess and not
+  // to whatever was evaluated before.
+  inline bool NewtonIteration (std::shared_ptr<NonlinearFunction> func, VectorView<double> x,
+                               Matrix<double> & fprime, std::unique_ptr<SparseMatrix> & sjac,
+                               double tol, int maxsteps,
+                               std::function<void(int,double,VectorView<double>)> callback)
+  {
+    Vector<double> res(func->dimF());
+    ASC_ODE_STATS_ADD(alloc_bytes, sizeof(double)*func->dimF());
+    ASC_ODE_STATS_ADD(newton_solves, 1);
 
-        calcInverse(fprime);
-        x -= fprime*res;
+    double err = 0;
+    for (int i = 0; i < maxsteps; i++)
+      {
+        {
+          ASC_ODE_STATS_TIMER(time_function);
+          ASC_ODE_STATS_ADD(function_evals, 1);
+          func->evaluate(x, res);
+        }
+        err = norm(res);
+        if (err < tol)
+          {
+            ASC_ODE_STATS_MAX(newton_max_iterations, i);
+            return i > 0;
+          }
 
-        // LapackLU LU(fprime);
-        // LU.solve(res);
-        // x -= res;
- 
+        if (i == 0)
+          sjac = SparseJacobian (func);
+        NewtonStep (func, x, res, fprime, sjac.get());
         if (callback)
           callback(i, err, x);
       }
 
-    throw std::domain_error("Newton did not converge");
+    ASC_ODE_STATS_ADD(newton_failures, 1);
+    ASC_ODE_STATS_MAX(newton_max_iterations, maxsteps);
+    std::ostringstream msg;
+    msg << "Newton did not converge: residual " << err << " after " << maxsteps
+        << " iterations (tol " << tol << ", dim " << func->dimX() << ")";
+    throw std::domain_error(msg.str());
+  }
+
+
+  void NewtonSolver (std::shared_ptr<NonlinearFunction> func, VectorView<double> x,
+                     double tol = 1e-10, int maxsteps = 10,
+                     std::function<void(int,double,VectorView<double>)> callback = nullptr)
+  {
+    Matrix<double> fprime(func->dimF(), func->dimX());
+    ASC_ODE_STATS_ADD(alloc_bytes, sizeof(double)*func->dimF()*func->dimX());
+    std::unique_ptr<SparseMatrix> sjac;
+    NewtonIteration (func, x, fprime, sjac, tol, maxsteps, callback);
+  }
+
+
+  // keeps the inverse Jacobian at the solution x in jacinverse, e.g. for
+  // sensitivity solves. The one of the last Newton step belongs to the
+  // iterate before the update, so it is evaluated again.
+  void NewtonSolver (std::shared_ptr<NonlinearFunction> func, VectorView<double> x,
+                     Matrix<double> & jacinverse,
+                     double tol = 1e-10, int maxsteps = 10,
+                     std::function<void(int,double,VectorView<double>)> callback = nullptr)
+  {
+    std::unique_ptr<SparseMatrix> sjac;
+    NewtonIteration (func, x, jacinverse, sjac, tol, maxsteps, callback);
+
+    sjac = SparseJacobian (func);
+    EvaluateJacobian (func, x, sjac.get(), jacinverse);
+    ASC_ODE_STATS_TIMER(time_factorization);
+    ASC_ODE_STATS_ADD(factorizations, 1);
+    if (sjac)
+      {
+        // the columns of the inverse from the compressed factors
+        SparseLU lu(*sjac);
+        Vector<double> e(x.size());
+        for (size_t j = 0; j < x.size(); j++)
+          {
+            e = 0.0;
+            e(j) = 1;
+            lu.solve(e);
+            jacinverse.col(j) = e;
+          }
+      }
+    else
+      jacinverse = LapackLU(jacinverse).inverse();
   }
 
 }
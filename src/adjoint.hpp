@@ -0,0 +1,193 @@
+#ifndef ADJOINT_HPP
+#define ADJOINT_HPP
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "timestepper.hpp"
+
+namespace ASC_ode
+{
+
+  // Reverses the steps y_k -> y_{k+1}, k < steps, of step(k, y), calling
+  // reverse(k, y_k) for k = steps-1, ..., 0. At most checkpoints states
+  // besides y_0 and one work vector are stored, the others are recomputed
+  // with the binomial schedule of Griewank and Walther (Revolve): with c
+  // checkpoints and r recomputations of each step C(c+r, c) steps can be
+  // reversed.
+  class BinomialCheckpointing
+  {
+    std::function<void(size_t,VectorView<double>)> m_step;
+    std::function<void(size_t,VectorView<double>)> m_reverse;
+    size_t m_forwardsteps = 0;
+
+    static double beta (size_t c, size_t r)
+    {
+      double b = 1;
+      for (size_t i = 1; i <= r; i++)
+        b = b * (c+i) / i;
+      return b;
+    }
+
+    void advance (size_t from, size_t to, VectorView<double> y)
+    {
+      for (size_t k = from; k < to; k++)
+        m_step (k, y);
+      m_forwardsteps += to-from;
+    }
+
+    // reverses [a, b) starting from ya = y_a with c free checkpoints
+    void reverse (size_t a, size_t b, VectorView<double> ya, size_t c)
+    {
+      while (b-a > 1)
+        {
+          size_t n = b-a;
+          if (c >= n-1)
+            {
+              // enough memory for the states y_{a+1} ... y_{b-1}
+              std::vector<Vector<>> states;
+              states.reserve (n-1);
+              for (size_t k = a+1; k < b; k++)
+                {
+                  VectorView<double> prev = (k == a+1) ? ya : VectorView<double>(states.back());
+                  states.emplace_back (prev);
+                  advance (k-1, k, states.back());
+                }
+              for (size_t k = b-1; k > a; k--)
+                m_reverse (k, states[k-a-1]);
+              break;
+            }
+          if (c == 0)
+            {
+              Vector<> y(ya.size());
+              for (size_t k = b; k-- > a; )
+                {
+                  y = ya;
+                  advance (a, k, y);
+                  m_reverse (k, y);
+                }
+              return;
+            }
+
+          // place the checkpoint such that [a+m, b) is reversible with c-1
+          // and [a, a+m) with c checkpoints in r-1 recomputations
+          size_t r = 1;
+          while (beta(c, r) < n) r++;
+          size_t right = size_t(std::min (beta(c-1, r), double(n-1)));
+          size_t m = n - right;
+
+          Vector<> ym(ya);
+          advance (a, a+m, ym);
+          reverse (a+m, b, ym, c-1);
+          b = a+m;
+        }
+      m_reverse (a, ya);
+    }
+
+  public:
+    BinomialCheckpointing (std::function<void(size_t,VectorView<double>)> step,
+                           std::function<void(size_t,VectorView<double>)> reverse)
+      : m_step(step), m_reverse(reverse) { }
+
+    void run (size_t steps, VectorView<double> y0, size_t checkpoints)
+    {
+      m_forwardsteps = 0;
+      if (steps > 0)
+        reverse (0, steps, y0, checkpoints);
+    }
+
+    // forward steps including the recomputations
+    size_t forwardSteps() const { return m_forwardsteps; }
+  };
+
+
+
+  class AdjointResult
+  {
+  public:
+    double objective = 0;
+    Vector<> gradient;           // dJ/dp
+    Vector<> initial;            // dJ/dy_0
+    size_t forwardsteps = 0;     // including recomputations, without the adjoint steps
+  };
+
+  // g_k(y_k): returns the value and adds dg_k/dy to dgdy
+  using AdjointObjective = std::function<double(size_t,VectorView<double>,VectorView<double>)>;
+
+
+  // discrete adjoint of J = sum_{k=0}^{steps} g_k(y_k), y_{k+1} = step(k, y_k; p).
+  // adjointstep(k, y_k, lambda, grad) replaces lambda_{k+1} by
+  // (dy_{k+1}/dy_k)^T lambda_{k+1} and adds (dy_{k+1}/dp)^T lambda_{k+1} to grad.
+  // checkpoints = 0 stores all states.
+  inline AdjointResult
+  SolveAdjoint (size_t nparams, size_t steps, VectorView<double> y0,
+                std::function<void(size_t,VectorView<double>)> step,
+                std::function<void(size_t,VectorView<double>,VectorView<double>,VectorView<double>)> adjointstep,
+                AdjointObjective objective, size_t checkpoints = 0)
+  {
+    size_t n = y0.size();
+    AdjointResult res;
+    res.gradient = Vector<>(nparams);
+    res.initial = Vector<>(n);
+    res.gradient = 0.0;
+
+    Vector<> lambda(n), y(n);
+    lambda = 0.0;
+    bool last = true;
+
+    BinomialCheckpointing schedule(step, [&] (size_t k, VectorView<double> yk)
+    {
+      if (last)
+        {
+          y = yk;
+          step (k, y);
+          res.objective += objective (k+1, y, lambda);
+          last = false;
+        }
+      y = yk;
+      adjointstep (k, y, lambda, res.gradient);
+      res.objective += objective (k, yk, lambda);
+    });
+
+    if (steps == 0)
+      res.objective = objective (0, y0, lambda);
+    schedule.run (steps, y0, checkpoints ? checkpoints : steps);
+
+    res.initial = lambda;
+    res.forwardsteps = schedule.forwardSteps() + (steps > 0 ? 1 : 0);
+    return res;
+  }
+
+
+  // discrete adjoint of a fixed step time stepper on [0, tend]. The
+  // predictor is switched off: recomputed steps start without history, and
+  // all steps have to give the states the adjoint steps linearize at.
+  inline AdjointResult
+  SolveAdjoint (TimeStepper & stepper, double tend, int steps, VectorView<double> y0,
+                AdjointObjective objective, size_t checkpoints = 0)
+  {
+    double tau = tend/steps;
+    size_t nparams = stepper.parameterizedRhs()->numParams();
+    bool predictor = stepper.predictor();
+    stepper.setPredictor (false);
+    try
+      {
+        auto res = SolveAdjoint (nparams, steps, y0,
+                                 [&] (size_t, VectorView<double> y) { stepper.doStep (tau, y); },
+                                 [&] (size_t, VectorView<double> y, VectorView<double> lambda,
+                                      VectorView<double> grad) { stepper.doStepAdjoint (tau, y, lambda, grad); },
+                                 objective, checkpoints);
+        stepper.setPredictor (predictor);
+        return res;
+      }
+    catch (...)
+      {
+        stepper.setPredictor (predictor);
+        throw;
+      }
+  }
+
+}
+
+#endif
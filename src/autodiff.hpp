@@ -6,6 +6,7 @@
 #include <cmath>   
 #include <array>  
 
+#include <vector.hpp>
 
 namespace ASC_ode
 {
@@ -154,6 +155,72 @@ namespace ASC_ode
     }
 
 
+  // mixed with scalars, as needed by generic evaluations like
+  // MSS_Function::evaluateGeneric
+
+  template <size_t N, typename T = double>
+  auto operator+ (const AutoDiff<N, T>& a, T b) { return a + AutoDiff<N, T>(b); }
+
+  template <size_t N, typename T = double>
+  auto operator- (const AutoDiff<N, T>& a, T b) { return a - AutoDiff<N, T>(b); }
+
+  template <size_t N, typename T = double>
+  AutoDiff<N, T> operator- (const AutoDiff<N, T>& a)
+  {
+    AutoDiff<N, T> result(-a.value());
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = -a.deriv()[i];
+    return result;
+  }
+
+  template <size_t N, typename T = double>
+  AutoDiff<N, T> operator* (T a, const AutoDiff<N, T>& b)
+  {
+    AutoDiff<N, T> result(a * b.value());
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = a * b.deriv()[i];
+    return result;
+  }
+
+  template <size_t N, typename T = double>
+  auto operator* (const AutoDiff<N, T>& a, T b) { return b * a; }
+
+  template <size_t N, typename T = double>
+  auto operator/ (const AutoDiff<N, T>& a, T b) { return (1/b) * a; }
+
+  template <size_t N, typename T = double>
+  auto operator/ (T a, const AutoDiff<N, T>& b) { return AutoDiff<N, T>(a) / b; }
+
+  template <size_t N, typename T = double>
+  AutoDiff<N, T> & operator+= (AutoDiff<N, T>& a, const AutoDiff<N, T>& b) { return a = a + b; }
+
+  template <size_t N, typename T = double>
+  AutoDiff<N, T> & operator-= (AutoDiff<N, T>& a, const AutoDiff<N, T>& b) { return a = a - b; }
+
+  using std::sqrt;
+
+  template <size_t N, typename T = double>
+  AutoDiff<N, T> sqrt (const AutoDiff<N, T>& a)
+  {
+    AutoDiff<N, T> result(sqrt(a.value()));
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = a.deriv()[i] / (2 * result.value());
+    return result;
+  }
+
+  // used by nanoblas::norm
+  template <size_t N, typename T = double>
+  AutoDiff<N, T> norm2 (const AutoDiff<N, T>& a) { return a*a; }
+
+  template <size_t D, size_t N, typename T>
+  nanoblas::Vec<D, AutoDiff<N, T>> operator* (const AutoDiff<N, T>& s,
+                                              const nanoblas::Vec<D, AutoDiff<N, T>>& v)
+  {
+    nanoblas::Vec<D, AutoDiff<N, T>> result;
+    for (size_t i = 0; i < D; i++)
+      result(i) = s * v(i);
+    return result;
+  }
 
 } // namespace ASC_ode
 
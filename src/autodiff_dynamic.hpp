@@ -1,5 +1,5 @@
-#ifndef AUTODIFF_HPP
-#define AUTODIFF_HPP
+#ifndef AUTODIFF_DYNAMIC_HPP
+#define AUTODIFF_DYNAMIC_HPP
 
 #include <vector>
 #include <iostream>
@@ -0,0 +1,144 @@
+#ifndef BATCH_STEPPER_HPP
+#define BATCH_STEPPER_HPP
+
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <inverse.hpp>
+
+#include "Newton.hpp"
+
+namespace ASC_ode
+{
+
+  // steps many independent states of the same ODE together, the states are
+  // the columns of Y (dimX x n) and the rhs is evaluated by evaluateBatch
+  class BatchTimeStepper
+  {
+  protected:
+    std::shared_ptr<NonlinearFunction> m_rhs;
+  public:
+    BatchTimeStepper(std::shared_ptr<NonlinearFunction> rhs) : m_rhs(rhs) {}
+    virtual ~BatchTimeStepper() = default;
+    virtual void doStep(double tau, MatrixView<double> Y) = 0;
+  };
+
+
+  class BatchExplicitEuler : public BatchTimeStepper
+  {
+    Matrix<> m_f;
+  public:
+    BatchExplicitEuler(std::shared_ptr<NonlinearFunction> rhs)
+      : BatchTimeStepper(rhs), m_f(rhs->dimF(), 0) {}
+
+    void doStep(double tau, MatrixView<double> Y) override
+    {
+      if (m_f.cols() != Y.cols())
+        m_f = Matrix<>(m_rhs->dimF(), Y.cols());
+      ASC_ODE_STATS_ADD(steps, Y.cols());
+      ASC_ODE_STATS_ADD(function_evals, Y.cols());
+      m_rhs->evaluateBatch(Y, m_f);
+      Y += tau * m_f;
+    }
+  };
+
+
+  class BatchImprovedEuler : public BatchTimeStepper
+  {
+    Matrix<> m_f, m_ytemp;
+  public:
+    BatchImprovedEuler(std::shared_ptr<NonlinearFunction> rhs)
+      : BatchTimeStepper(rhs), m_f(rhs->dimF(), 0), m_ytemp(rhs->dimX(), 0) {}
+
+    void doStep(double tau, MatrixView<double> Y) override
+    {
+      if (m_f.cols() != Y.cols())
+        {
+          m_f = Matrix<>(m_rhs->dimF(), Y.cols());
+          m_ytemp = Matrix<>(m_rhs->dimX(), Y.cols());
+        }
+      ASC_ODE_STATS_ADD(steps, Y.cols());
+      ASC_ODE_STATS_ADD(function_evals, 2*Y.cols());
+      m_rhs->evaluateBatch(Y, m_f);
+      m_ytemp = Y + 0.5 * tau * m_f;
+      m_rhs->evaluateBatch(m_ytemp, m_f);
+      Y += tau * m_f;
+    }
+  };
+
+
+  // Newton for y - y_old - tau f(y) = 0 on all columns: the residuals are
+  // evaluated batched, the Jacobians per state, converged states are frozen
+  class BatchImplicitEuler : public BatchTimeStepper
+  {
+    Matrix<> m_yold, m_f;
+    double m_tol;
+    int m_maxsteps;
+  public:
+    BatchImplicitEuler(std::shared_ptr<NonlinearFunction> rhs,
+                       double tol = 1e-10, int maxsteps = 10)
+      : BatchTimeStepper(rhs), m_yold(rhs->dimX(), 0), m_f(rhs->dimF(), 0),
+        m_tol(tol), m_maxsteps(maxsteps) {}
+
+    void doStep(double tau, MatrixView<double> Y) override
+    {
+      size_t n = m_rhs->dimX(), nb = Y.cols();
+      if (m_f.cols() != nb)
+        {
+          m_yold = Matrix<>(n, nb);
+          m_f = Matrix<>(n, nb);
+        }
+      ASC_ODE_STATS_ADD(steps, nb);
+      ASC_ODE_STATS_ADD(newton_solves, nb);
+      m_yold = Y;
+
+      Matrix<> jac(n, n);
+      Vector<> y(n), res(n);
+      std::vector<bool> converged(nb, false);
+      size_t open = nb;
+
+      for (int it = 0; it < m_maxsteps; it++)
+        {
+          ASC_ODE_STATS_ADD(function_evals, nb);
+          m_rhs->evaluateBatch(Y, m_f);
+
+          for (size_t j = 0; j < nb; j++)
+            {
+              if (converged[j]) continue;
+              for (size_t i = 0; i < n; i++)
+                res(i) = Y(i,j) - m_yold(i,j) - tau * m_f(i,j);
+              if (norm(res) < m_tol)
+                {
+                  converged[j] = true;
+                  ASC_ODE_STATS_MAX(newton_max_iterations, it);
+                  open--;
+                  continue;
+                }
+
+              y = Y.col(j);
+              ASC_ODE_STATS_ADD(jacobian_evals, 1);
+              m_rhs->evaluateDeriv(y, jac);
+              jac *= -tau;
+              for (size_t i = 0; i < n; i++)
+                jac(i,i) += 1.0;
+              ASC_ODE_STATS_ADD(factorizations, 1);
+              calcInverse(jac);
+              y -= jac * res;
+              Y.col(j) = y;
+              ASC_ODE_STATS_ADD(newton_iterations, 1);
+            }
+          if (open == 0) return;
+        }
+
+      ASC_ODE_STATS_ADD(newton_failures, open);
+      std::ostringstream msg;
+      msg << "Newton did not converge for " << open << " of " << nb
+          << " states after " << m_maxsteps << " iterations (tol " << m_tol << ")";
+      throw std::domain_error(msg.str());
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,337 @@
+#ifndef BDF_HPP
+#define BDF_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include <inverse.hpp>
+
+#include "timestepper.hpp"
+
+namespace ASC_ode
+{
+
+  class BDFOptions
+  {
+  public:
+    double rtol = 1e-6;
+    double atol = 1e-8;
+    int maxorder = 5;                // 1 ... 5
+    double h0 = 0;                   // first internal step, 0: estimated
+    double hmax = std::numeric_limits<double>::infinity();
+    int jacobianAge = 20;            // steps before the iteration matrix is renewed
+    int maxsteps = 100000;           // internal steps per doStep
+  };
+
+
+  // Variable order (1 to 5), variable step BDF in Nordsieck form
+  //   z_j = h^j y^(j) / j!,   j = 0, ..., q
+  // as in LSODE: the step size is changed by rescaling z, the corrector
+  // solves  y - gamma f(y) = a  with gamma = h / l_1 by a modified Newton
+  // iteration whose matrix (I - gamma J)^-1 is kept for many steps.
+  // doStep(tau, y) takes as many internal steps as the tolerances require
+  // and interpolates y at the end of the interval. If y was changed
+  // between two calls, the history is dropped and the method restarts.
+  class BDF : public TimeStepper
+  {
+    BDFOptions m_opts;
+    size_t m_n;
+    int m_q = 1;
+    double m_h = 0;
+    double m_t = 0, m_tout = 0;       // internal time, time of the last output
+    bool m_started = false;
+    int m_stepsSinceChange = 0;      // steps with the current h and q
+
+    Matrix<> m_z, m_zsave;
+    Vector<> m_e, m_eprev, m_y, m_f, m_res, m_delta, m_w, m_yout;
+    bool m_eprevValid = false;
+
+    Matrix<> m_jacinv;
+    double m_gammajac = 0;
+    int m_jacage = 0;
+    bool m_jacvalid = false, m_jaccurrent = false;
+
+    static double l (int q, int j)
+    {
+      // coefficients of prod_{i=1}^q (1 + x/i)
+      double c[7] = { 1, 0, 0, 0, 0, 0, 0 };
+      for (int i = 1; i <= q; i++)
+        for (int k = i; k > 0; k--)
+          c[k] += c[k-1] / i;
+      return c[j];
+    }
+
+    static double factorial (int k)
+    {
+      double f = 1;
+      for (int i = 2; i <= k; i++) f *= i;
+      return f;
+    }
+
+    // with the history of the method the correction e = y_n - y_predicted
+    // approximates h^{q+1} y^{(q+1)}, the local error is e / (q+1).
+    // For order q-1 it is h^q y^(q) / q = (q-1)! z_q.
+    double errorDown () const
+    {
+      return factorial(m_q-1) * wnorm(m_z.row(m_q));
+    }
+
+    double wnorm (VectorView<double> v) const
+    {
+      double sum = 0;
+      for (size_t i = 0; i < m_n; i++)
+        sum += (v(i)/m_w(i)) * (v(i)/m_w(i));
+      return std::sqrt (sum / m_n);
+    }
+
+    void rescale (double eta)
+    {
+      double s = 1;
+      for (int j = 1; j <= m_q; j++)
+        {
+          s *= eta;
+          m_z.row(j) *= s;
+        }
+      m_h *= eta;
+      m_stepsSinceChange = 0;
+      m_eprevValid = false;
+    }
+
+    void restart (VectorView<double> y, double tau)
+    {
+      for (size_t i = 0; i < m_n; i++)
+        m_w(i) = m_opts.rtol * std::fabs(y(i)) + m_opts.atol;
+      ASC_ODE_STATS_ADD(function_evals, 1);
+      this->m_rhs->evaluate(y, m_f);
+
+      double h = m_opts.h0;
+      if (h <= 0)
+        {
+          double d = wnorm(m_f);
+          h = d > 0 ? std::min(tau, 0.1/d) : tau;
+        }
+      m_h = std::min(h, m_opts.hmax);
+      m_q = 1;
+      m_z = 0.0;
+      m_z.row(0) = y;
+      m_z.row(1) = m_h * m_f;
+      m_t = m_tout;
+      m_stepsSinceChange = 0;
+      m_eprevValid = false;
+      m_jacvalid = false;
+      m_started = true;
+    }
+
+    // modified Newton for  y - gamma f(y) = a,  y holds the predictor
+    bool solveCorrector (double gamma, VectorView<double> a)
+    {
+      if (!m_jacvalid || m_jacage >= m_opts.jacobianAge || std::fabs(gamma/m_gammajac - 1) > 0.3)
+        updateJacobian (gamma);
+
+      double delp = 0, crate = 1;
+      ASC_ODE_STATS_ADD(newton_solves, 1);
+      for (int m = 0; m < 4; m++)
+        {
+          {
+            ASC_ODE_STATS_TIMER(time_function);
+            ASC_ODE_STATS_ADD(function_evals, 1);
+            this->m_rhs->evaluate(m_y, m_f);
+          }
+          m_res = m_y - gamma * m_f;
+          m_res -= a;
+          m_delta = m_jacinv * m_res;
+          m_y -= m_delta;
+          ASC_ODE_STATS_ADD(newton_iterations, 1);
+
+          double del = wnorm(m_delta);
+          if (m > 0)
+            {
+              crate = std::max(0.3*crate, del/delp);
+              if (del > 2*delp) break;
+            }
+          if (del * std::min(1.0, crate) <= 0.1)
+            {
+              ASC_ODE_STATS_MAX(newton_max_iterations, m+1);
+              return true;
+            }
+          delp = del;
+        }
+      ASC_ODE_STATS_ADD(newton_failures, 1);
+      return false;
+    }
+
+    void updateJacobian (double gamma)
+    {
+      {
+        ASC_ODE_STATS_TIMER(time_jacobian);
+        ASC_ODE_STATS_ADD(jacobian_evals, 1);
+        this->m_rhs->evaluateDeriv(m_z.row(0), m_jacinv);
+      }
+      ASC_ODE_STATS_TIMER(time_factorization);
+      ASC_ODE_STATS_ADD(factorizations, 1);
+      m_jacinv *= -gamma;
+      for (size_t i = 0; i < m_n; i++)
+        m_jacinv(i,i) += 1.0;
+      calcInverse(m_jacinv);
+      m_gammajac = gamma;
+      m_jacage = 0;
+      m_jacvalid = m_jaccurrent = true;
+    }
+
+    void predict ()
+    {
+      for (int k = 0; k < m_q; k++)
+        for (int j = m_q-1; j >= k; j--)
+          m_z.row(j) += m_z.row(j+1);
+    }
+
+    void step ()
+    {
+      for (size_t i = 0; i < m_n; i++)
+        m_w(i) = m_opts.rtol * std::fabs(m_z(0,i)) + m_opts.atol;
+
+      Vector<> a(m_n);
+      double err = 0;
+      while (true)
+        {
+          if (m_h < 1e-14 * std::max(1.0, std::fabs(m_t)))
+            {
+              std::ostringstream msg;
+              msg << "BDF: step size " << m_h << " too small at t = " << m_t;
+              throw std::domain_error(msg.str());
+            }
+
+          m_zsave = m_z;
+          predict();
+          double l1 = l(m_q, 1);
+          double gamma = m_h / l1;
+          m_y = m_z.row(0);
+          a = m_z.row(0) - (1/l1) * m_z.row(1);
+
+          if (!solveCorrector (gamma, a))
+            {
+              m_z = m_zsave;
+              if (m_jaccurrent)
+                {
+                  ASC_ODE_STATS_ADD(rejected_steps, 1);
+                  rescale (0.25);
+                }
+              m_jacvalid = false;
+              continue;
+            }
+
+          m_e = m_y - m_z.row(0);
+          err = wnorm(m_e) / (m_q+1);
+          if (err <= 1) break;
+
+          // error test failed: smaller step, lower order if that promises more
+          ASC_ODE_STATS_ADD(rejected_steps, 1);
+          m_z = m_zsave;
+          double eta = 1 / (1.2 * std::pow(err, 1.0/(m_q+1)) + 1e-6);
+          if (m_q > 1)
+            {
+              double etadown = 1 / (1.3 * std::pow(errorDown(), 1.0/m_q) + 1e-6);
+              if (etadown > eta)
+                {
+                  eta = etadown;
+                  m_z.row(m_q) = 0.0;
+                  m_q--;
+                }
+            }
+          rescale (std::clamp(eta, 0.2, 0.9));
+        }
+
+      // accept
+      ASC_ODE_STATS_ADD(steps, 1);
+      for (int j = 0; j <= m_q; j++)
+        m_z.row(j) += l(m_q, j) * m_e;
+      m_t += m_h;
+      m_stepsSinceChange++;
+      m_jacage++;
+      m_jaccurrent = false;
+
+      // as in LSODE, step size and order are reconsidered after q+1 steps
+      // with the same ones, the estimates for q-1 and q+1 need the history
+      bool reconsider = m_stepsSinceChange > m_q;
+      if (reconsider)
+        {
+          double eta = 1 / (1.2 * std::pow(err, 1.0/(m_q+1)) + 1e-6);
+          int newq = m_q;
+          if (m_q > 1)
+            {
+              double etadown = 1 / (1.3 * std::pow(errorDown(), 1.0/m_q) + 1e-6);
+              if (etadown > eta) { eta = etadown; newq = m_q-1; }
+            }
+          if (m_q < m_opts.maxorder && m_eprevValid)
+            {
+              m_delta = m_e - m_eprev;
+              double errup = wnorm(m_delta) / (m_q+2);
+              double etaup = 1 / (1.4 * std::pow(errup, 1.0/(m_q+2)) + 1e-6);
+              if (etaup > eta) { eta = etaup; newq = m_q+1; }
+            }
+          eta = std::min({eta, 10.0, m_opts.hmax / m_h});
+
+          if (eta >= 1.1)
+            {
+              if (newq > m_q)
+                m_z.row(newq) = (1 / factorial(m_q+1)) * m_e;
+              else if (newq < m_q)
+                m_z.row(m_q) = 0.0;
+              m_q = newq;
+              rescale (eta);
+              return;
+            }
+        }
+      m_eprev = m_e;
+      m_eprevValid = true;
+    }
+
+  public:
+    BDF (std::shared_ptr<NonlinearFunction> rhs, BDFOptions opts = BDFOptions())
+      : TimeStepper(rhs), m_opts(opts), m_n(rhs->dimX()),
+        m_z(7, m_n), m_zsave(7, m_n),
+        m_e(m_n), m_eprev(m_n), m_y(m_n), m_f(m_n), m_res(m_n), m_delta(m_n),
+        m_w(m_n), m_yout(m_n), m_jacinv(m_n, m_n)
+    {
+      if (opts.maxorder < 1 || opts.maxorder > 5)
+        throw std::invalid_argument("BDF: maxorder must be between 1 and 5");
+    }
+
+    void doStep (double tau, VectorView<double> y) override
+    {
+      bool changed = !m_started;
+      for (size_t i = 0; i < m_n && !changed; i++)
+        changed = y(i) != m_yout(i);
+      if (changed)
+        restart (y, tau);
+
+      double tend = m_tout + tau;
+      for (int k = 0; m_t < tend; k++)
+        {
+          if (k == m_opts.maxsteps)
+            throw std::domain_error("BDF: too many internal steps");
+          step();
+        }
+
+      // interpolate the Nordsieck polynomial
+      double s = (tend - m_t) / m_h, sj = 1;
+      y = m_z.row(0);
+      for (int j = 1; j <= m_q; j++)
+        {
+          sj *= s;
+          y += sj * m_z.row(j);
+        }
+      m_yout = y;
+      m_tout = tend;
+    }
+
+    int order () const { return m_q; }
+    double stepSize () const { return m_h; }
+  };
+
+}
+
+#endif
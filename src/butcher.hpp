@@ -0,0 +1,357 @@
+#ifndef BUTCHER_HPP
+#define BUTCHER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <vector.hpp>
+#include <matrix.hpp>
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+  // Runge-Kutta coefficients and order. Obtained from Tableau(family, stages),
+  // which computes every tableau once per process.
+  class ButcherTableau
+  {
+  public:
+    enum Family { GAUSS, RADAU_IIA, LOBATTO_IIIC, SDIRK, ESDIRK };
+
+    Family family;
+    int stages;
+    int order;
+    Matrix<> a;
+    Vector<> b, c;
+
+    ButcherTableau (Family _family, int _stages)
+      : family(_family), stages(_stages), order(0),
+        a(_stages, _stages), b(_stages), c(_stages)
+    {
+      if (stages < 1)
+        throw std::invalid_argument("ButcherTableau: need at least one stage");
+      if (!precomputed())
+        collocation();
+    }
+
+  private:
+    using cplx = std::complex<double>;
+
+    void set (const double * pa, const double * pb, const double * pc)
+    {
+      for (int i = 0; i < stages; i++)
+        {
+          for (int j = 0; j < stages; j++)
+            a(i,j) = pa[i*stages+j];
+          b(i) = pb[i];
+          c(i) = pc[i];
+        }
+    }
+
+    // coefficients to 21 digits, rationals as quotients
+    bool precomputed ()
+    {
+      static constexpr double gauss1a[] = { 0.5 }, gauss1b[] = { 1 }, gauss1c[] = { 0.5 };
+      static constexpr double gauss2a[] = { 0.25, -3.86751345948128822546e-2,
+                                            5.38675134594812882255e-1, 0.25 };
+      static constexpr double gauss2b[] = { 0.5, 0.5 };
+      static constexpr double gauss2c[] = { 2.11324865405187117745e-1, 7.88675134594812882255e-1 };
+      static constexpr double gauss3a[] = { 5.0/36, -3.59766675249389034564e-2, 9.78944401530832604958e-3,
+                                            3.00263194980864592438e-1, 2.0/9, -2.24854172030868146602e-2,
+                                            2.67988333762469451728e-1, 4.80421111969383347901e-1, 5.0/36 };
+      static constexpr double gauss3b[] = { 5.0/18, 4.0/9, 5.0/18 };
+      static constexpr double gauss3c[] = { 1.12701665379258311482e-1, 0.5, 8.87298334620741688518e-1 };
+
+      static constexpr double radau1a[] = { 1 }, radau1b[] = { 1 }, radau1c[] = { 1 };
+      static constexpr double radau2a[] = { 5.0/12, -1.0/12, 0.75, 0.25 };
+      static constexpr double radau2b[] = { 0.75, 0.25 };
+      static constexpr double radau2c[] = { 1.0/3, 1 };
+      static constexpr double radau3a[] = { 1.96815477223660425868e-1, -6.55354258501983881085e-2, 2.37709743482201524204e-2,
+                                            3.94424314739087276997e-1, 2.92073411665228463021e-1, -4.15487521259979301982e-2,
+                                            3.76403062700467275050e-1, 5.12485826188421613839e-1, 1.0/9 };
+      static constexpr double radau3b[] = { 3.76403062700467275050e-1, 5.12485826188421613839e-1, 1.0/9 };
+      static constexpr double radau3c[] = { 1.55051025721682190180e-1, 6.44948974278317809820e-1, 1 };
+
+      static constexpr double lobatto2a[] = { 0.5, -0.5, 0.5, 0.5 };
+      static constexpr double lobatto2b[] = { 0.5, 0.5 };
+      static constexpr double lobatto2c[] = { 0, 1 };
+      static constexpr double lobatto3a[] = { 1.0/6, -1.0/3, 1.0/6,
+                                              1.0/6, 5.0/12, -1.0/12,
+                                              1.0/6, 2.0/3, 1.0/6 };
+      static constexpr double lobatto3b[] = { 1.0/6, 2.0/3, 1.0/6 };
+      static constexpr double lobatto3c[] = { 0, 0.5, 1 };
+
+      // Alexander (1977), L-stable, gamma = 1-1/sqrt(2) and the root of
+      // 6 g^3 - 18 g^2 + 9 g - 1 = 0 in (1/6, 1/2)
+      static constexpr double sdirk2a[] = { 2.92893218813452475599e-1, 0,
+                                            7.07106781186547524401e-1, 2.92893218813452475599e-1 };
+      static constexpr double sdirk2b[] = { 7.07106781186547524401e-1, 2.92893218813452475599e-1 };
+      static constexpr double sdirk2c[] = { 2.92893218813452475599e-1, 1 };
+      static constexpr double sdirk3a[] = { 4.35866521508458999416e-1, 0, 0,
+                                            2.82066739245770500292e-1, 4.35866521508458999416e-1, 0,
+                                            1.20849664917601007034, -6.44363170684469069752e-1, 4.35866521508458999416e-1 };
+      static constexpr double sdirk3b[] = { 1.20849664917601007034, -6.44363170684469069752e-1, 4.35866521508458999416e-1 };
+      static constexpr double sdirk3c[] = { 4.35866521508458999416e-1, 7.17933260754229499708e-1, 1 };
+
+      // TR-BDF2 (Bank et al. 1985), trapezoidal rule to 2-sqrt(2), then BDF2
+      static constexpr double esdirk3a[] = { 0, 0, 0,
+                                             2.92893218813452475599e-1, 2.92893218813452475599e-1, 0,
+                                             3.53553390593273762200e-1, 3.53553390593273762200e-1, 2.92893218813452475599e-1 };
+      static constexpr double esdirk3b[] = { 3.53553390593273762200e-1, 3.53553390593273762200e-1, 2.92893218813452475599e-1 };
+      static constexpr double esdirk3c[] = { 0, 5.85786437626904951198e-1, 1 };
+
+      switch (family)
+        {
+        case GAUSS:
+          order = 2*stages;
+          if (stages == 1) set (gauss1a, gauss1b, gauss1c);
+          else if (stages == 2) set (gauss2a, gauss2b, gauss2c);
+          else if (stages == 3) set (gauss3a, gauss3b, gauss3c);
+          else return false;
+          return true;
+        case RADAU_IIA:
+          order = 2*stages-1;
+          if (stages == 1) set (radau1a, radau1b, radau1c);
+          else if (stages == 2) set (radau2a, radau2b, radau2c);
+          else if (stages == 3) set (radau3a, radau3b, radau3c);
+          else return false;
+          return true;
+        case LOBATTO_IIIC:
+          if (stages < 2)
+            throw std::invalid_argument("ButcherTableau: Lobatto IIIC needs at least 2 stages");
+          order = 2*stages-2;
+          if (stages == 2) set (lobatto2a, lobatto2b, lobatto2c);
+          else if (stages == 3) set (lobatto3a, lobatto3b, lobatto3c);
+          else return false;
+          return true;
+        case SDIRK:
+          order = stages;
+          if (stages == 2) set (sdirk2a, sdirk2b, sdirk2c);
+          else if (stages == 3) set (sdirk3a, sdirk3b, sdirk3c);
+          else throw std::invalid_argument("ButcherTableau: SDIRK with "+std::to_string(stages)
+                                           +" stages not available, use 2 or 3");
+          return true;
+        case ESDIRK:
+          order = 2;
+          if (stages == 3) set (esdirk3a, esdirk3b, esdirk3c);
+          else throw std::invalid_argument("ButcherTableau: ESDIRK with "+std::to_string(stages)
+                                           +" stages not available, use 3");
+          return true;
+        }
+      return false;
+    }
+
+
+    // Gauss, Radau IIA and Lobatto IIIC for any number of stages. The nodes
+    // are eigenvalues of Jacobi matrices (Golub-Welsch), the coefficients
+    // integrals of Lagrange polynomials by Gauss quadrature, avoiding the
+    // Vandermonde inverse of computeABfromC.
+    void collocation ()
+    {
+      int s = stages;
+      std::vector<double> nodes;
+      if (family == GAUSS)
+        nodes = jacobiNodes (s, 0, 0);
+      else if (family == RADAU_IIA)
+        {
+          nodes = jacobiNodes (s-1, 1, 0);
+          nodes.push_back (1);
+        }
+      else
+        {
+          nodes = jacobiNodes (s-2, 1, 1);
+          nodes.insert (nodes.begin(), 0);
+          nodes.push_back (1);
+        }
+      for (int i = 0; i < s; i++)
+        c(i) = nodes[i];
+
+      // Gauss-Legendre rule on [0,1], exact up to degree 2s-1
+      std::vector<double> qx = jacobiNodes (s, 0, 0), qw(s);
+      for (int q = 0; q < s; q++)
+        {
+          double x = 2*qx[q]-1, p0 = 1, p1 = x;
+          for (int k = 1; k < s; k++)
+            {
+              double p2 = ((2*k+1)*x*p1 - k*p0) / (k+1);
+              p0 = p1;
+              p1 = p2;
+            }
+          double dp = (s == 1) ? 1 : s*(x*p1-p0)/(x*x-1);
+          qw[q] = 1 / ((1-x*x)*dp*dp);
+        }
+
+      // integral of the Lagrange polynomial j on nodes [first, s) over [0, t]
+      auto integral = [&] (int first, int j, double t)
+      {
+        double sum = 0;
+        for (int q = 0; q < s; q++)
+          {
+            double l = 1, tq = t*qx[q];
+            for (int m = first; m < s; m++)
+              if (m != j) l *= (tq-c(m)) / (c(j)-c(m));
+            sum += qw[q] * l;
+          }
+        return t*sum;
+      };
+
+      for (int j = 0; j < s; j++)
+        b(j) = integral (0, j, 1);
+
+      if (family != LOBATTO_IIIC)
+        {
+          for (int i = 0; i < s; i++)
+            for (int j = 0; j < s; j++)
+              a(i,j) = integral (0, j, c(i));
+          return;
+        }
+
+      // Lobatto IIIC: a_i1 = b_1 and C(s-1), the remaining columns integrate
+      // the Lagrange polynomials on c_2 ... c_s up to the part of column 1
+      for (int i = 0; i < s; i++)
+        {
+          a(i,0) = b(0);
+          for (int j = 1; j < s; j++)
+            {
+              double l0 = 1;
+              for (int m = 1; m < s; m++)
+                if (m != j) l0 *= (0-c(m)) / (c(j)-c(m));
+              a(i,j) = integral (1, j, c(i)) - b(0)*l0;
+            }
+        }
+    }
+
+
+    // zeros of the Jacobi polynomial P_n^(alpha,beta) mapped to [0,1], ascending
+    static std::vector<double> jacobiNodes (int n, double alpha, double beta)
+    {
+      if (n <= 0) return { };
+      std::vector<cplx> jac(n*n, 0.0);
+      for (int k = 0; k < n; k++)
+        {
+          double ab = 2*k+alpha+beta;
+          jac[k*n+k] = (k == 0) ? (beta-alpha)/(alpha+beta+2)
+                                : (beta*beta-alpha*alpha) / (ab*(ab+2));
+          if (k > 0)
+            {
+              double off = std::sqrt (4*k*(k+alpha)*(k+beta)*(k+alpha+beta)
+                                      / (ab*ab*(ab+1)*(ab-1)));
+              jac[k*n+k-1] = jac[(k-1)*n+k] = off;
+            }
+        }
+      std::vector<double> nodes;
+      for (cplx ev : eigenvaluesQR (n, jac))
+        nodes.push_back (0.5*(ev.real()+1));
+      std::sort (nodes.begin(), nodes.end());
+      return nodes;
+    }
+
+
+    // eigenvalues of a small matrix by the shifted QR algorithm
+    static std::vector<cplx> eigenvaluesQR (int n, std::vector<cplx> h)
+    {
+      double norm = 0;
+      for (cplx v : h) norm = std::max(norm, std::abs(v));
+      if (norm == 0) norm = 1;
+
+      std::vector<cplx> ev;
+      std::vector<cplx> q(n*n), v(n);
+      int m = n, iter = 0;
+      while (m > 0)
+        {
+          double off = 0;
+          for (int j = 0; j < m-1; j++)
+            off += std::norm (h[(m-1)*n+j]);
+          if (m == 1 || std::sqrt(off) < 1e-15 * norm)
+            {
+              ev.push_back (h[(m-1)*n+m-1]);
+              m--;
+              iter = 0;
+              continue;
+            }
+          if (++iter > 1000)
+            throw std::runtime_error("ButcherTableau: QR iteration did not converge");
+
+          // Wilkinson shift, sometimes perturbed against cycling
+          cplx a11 = h[(m-2)*n+m-2], a12 = h[(m-2)*n+m-1], a21 = h[(m-1)*n+m-2], a22 = h[(m-1)*n+m-1];
+          cplx disc = std::sqrt ((a11-a22)*(a11-a22)/4.0 + a12*a21);
+          cplx l1 = (a11+a22)/2.0 + disc, l2 = (a11+a22)/2.0 - disc;
+          cplx mu = (std::abs(l1-a22) < std::abs(l2-a22)) ? l1 : l2;
+          if (iter % 20 == 0) mu += cplx(0.5, 0.25) * std::sqrt(off);
+
+          // H - mu = QR by Householder reflections, H = RQ + mu
+          for (int i = 0; i < m; i++)
+            for (int j = 0; j < m; j++)
+              q[i*n+j] = (i == j) ? 1.0 : 0.0;
+          for (int i = 0; i < m; i++)
+            h[i*n+i] -= mu;
+          for (int k = 0; k < m-1; k++)
+            {
+              double xnorm = 0;
+              for (int i = k; i < m; i++) xnorm += std::norm (h[i*n+k]);
+              xnorm = std::sqrt(xnorm);
+              if (xnorm == 0) continue;
+              cplx x0 = h[k*n+k];
+              cplx alpha = (std::abs(x0) > 0 ? -x0/std::abs(x0) : cplx(-1)) * xnorm;
+              double vnorm = 0;
+              for (int i = k; i < m; i++)
+                {
+                  v[i] = h[i*n+k] - (i == k ? alpha : 0.0);
+                  vnorm += std::norm (v[i]);
+                }
+              if (vnorm == 0) continue;
+              // rows of H and columns of Q
+              for (int j = 0; j < m; j++)
+                {
+                  cplx s = 0;
+                  for (int i = k; i < m; i++) s += std::conj(v[i]) * h[i*n+j];
+                  s *= 2/vnorm;
+                  for (int i = k; i < m; i++) h[i*n+j] -= s * v[i];
+                }
+              for (int i = 0; i < m; i++)
+                {
+                  cplx s = 0;
+                  for (int j = k; j < m; j++) s += q[i*n+j] * v[j];
+                  s *= 2/vnorm;
+                  for (int j = k; j < m; j++) q[i*n+j] -= s * std::conj(v[j]);
+                }
+            }
+          // H = R Q + mu on the active block
+          std::vector<cplx> rq(m*m, 0.0);
+          for (int i = 0; i < m; i++)
+            for (int j = 0; j < m; j++)
+              for (int k = i; k < m; k++)
+                rq[i*m+j] += h[i*n+k] * q[k*n+j];
+          for (int i = 0; i < m; i++)
+            for (int j = 0; j < m; j++)
+              h[i*n+j] = rq[i*m+j] + (i == j ? mu : 0.0);
+        }
+      return ev;
+    }
+  };
+
+
+  // the tableau of a family with the given number of stages, computed once
+  // and shared by all users
+  inline const ButcherTableau & Tableau (ButcherTableau::Family family, int stages)
+  {
+    static std::mutex mutex;
+    static std::map<std::pair<int,int>, std::unique_ptr<ButcherTableau>> cache;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto & entry = cache[{ int(family), stages }];
+    if (!entry)
+      entry = std::make_unique<ButcherTableau>(family, stages);
+    return *entry;
+  }
+
+}
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef COLORED_JACOBIAN_HPP
+#define COLORED_JACOBIAN_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "autodiff.hpp"
+#include "nonlinfunc.hpp"
+
+namespace ASC_ode
+{
+
+  // Jacobians with a known sparsity pattern from few directional derivatives
+  // (Curtis, Powell, Reid 1974): columns without a common row get the same
+  // color, one derivative in the sum of the unit vectors of a color gives
+  // all their entries. Instead of dimX evaluations the Jacobian costs one
+  // per color, for a spring lattice a few times D * neighbors.
+  class ColoredJacobian
+  {
+    std::shared_ptr<const SparsityPattern> m_pattern;
+    std::vector<size_t> m_color;              // color of every column
+    size_t m_numcolors = 0;
+    // the columns of every color, and for every column its entries
+    std::vector<size_t> m_colorfirst, m_colorcols;
+    std::vector<size_t> m_colfirst, m_entries, m_entryrows;
+
+    // transposed pattern: the rows and positions of every column
+    void transpose ()
+    {
+      auto & p = *m_pattern;
+      size_t nc = p.cols();
+      m_colfirst.assign(nc+1, 0);
+      for (size_t k = 0; k < p.nnz(); k++)
+        m_colfirst[p.col(k)+1]++;
+      for (size_t j = 0; j < nc; j++)
+        m_colfirst[j+1] += m_colfirst[j];
+      m_entries.resize(p.nnz());
+      m_entryrows.resize(p.nnz());
+      std::vector<size_t> fill(m_colfirst.begin(), m_colfirst.end()-1);
+      for (size_t i = 0; i < p.rows(); i++)
+        for (size_t k = p.first(i); k < p.next(i); k++)
+          {
+            size_t pos = fill[p.col(k)]++;
+            m_entries[pos] = k;
+            m_entryrows[pos] = i;
+          }
+    }
+
+    // the columns of every color
+    void groupColors ()
+    {
+      size_t nc = m_pattern->cols();
+      m_colorfirst.assign(m_numcolors+1, 0);
+      for (size_t j = 0; j < nc; j++)
+        m_colorfirst[m_color[j]+1]++;
+      for (size_t c = 0; c < m_numcolors; c++)
+        m_colorfirst[c+1] += m_colorfirst[c];
+      m_colorcols.resize(nc);
+      std::vector<size_t> fill(m_colorfirst.begin(), m_colorfirst.end()-1);
+      for (size_t j = 0; j < nc; j++)
+        m_colorcols[fill[m_color[j]]++] = j;
+    }
+
+  public:
+    ColoredJacobian (std::shared_ptr<const SparsityPattern> pattern)
+      : m_pattern(pattern)
+    {
+      auto & p = *pattern;
+      size_t nc = p.cols();
+      transpose();
+
+      // greedy coloring in the order of the columns, a dense pattern needs
+      // a color per column
+      constexpr size_t none = std::numeric_limits<size_t>::max();
+      m_color.assign(nc, none);
+      if (p.isDense())
+        for (size_t j = 0; j < nc; j++)
+          m_color[j] = j;
+      else
+        {
+          std::vector<size_t> forbidden(nc+1, none);  // color -> column it is forbidden for
+          for (size_t j = 0; j < nc; j++)
+            {
+              for (size_t e = m_colfirst[j]; e < m_colfirst[j+1]; e++)
+                {
+                  size_t i = m_entryrows[e];
+                  for (size_t k = p.first(i); k < p.next(i); k++)
+                    if (m_color[p.col(k)] != none)
+                      forbidden[m_color[p.col(k)]] = j;
+                }
+              size_t c = 0;
+              while (forbidden[c] == j) c++;
+              m_color[j] = c;
+            }
+        }
+      for (size_t j = 0; j < nc; j++)
+        m_numcolors = std::max(m_numcolors, m_color[j]+1);
+      groupColors();
+    }
+
+    // keeps the colors of coloring for a pattern contained in its one,
+    // e.g. after entries were removed, and saves the greedy coloring
+    ColoredJacobian (std::shared_ptr<const SparsityPattern> pattern,
+                     const ColoredJacobian & coloring)
+      : m_pattern(pattern), m_color(coloring.m_color), m_numcolors(coloring.m_numcolors)
+    {
+      if (pattern->rows() != coloring.pattern().rows() || pattern->cols() != coloring.pattern().cols())
+        throw std::invalid_argument("ColoredJacobian: pattern does not fit the coloring");
+      transpose();
+      groupColors();
+    }
+
+    const SparsityPattern & pattern () const { return *m_pattern; }
+    std::shared_ptr<const SparsityPattern> sharedPattern () const { return m_pattern; }
+    size_t numColors () const { return m_numcolors; }
+    size_t color (size_t j) const { return m_color[j]; }
+
+    // forward mode AD of func(VectorView<AutoDiff<K>> x, VectorView<AutoDiff<K>> f),
+    // K colors per evaluation. df has the pattern of the coloring.
+    template <size_t K = 8, typename F>
+    void evaluateAD (F && func, VectorView<double> x, SparseMatrix & df) const
+    {
+      auto & p = *m_pattern;
+      Vector<AutoDiff<K>> xad(p.cols()), fad(p.rows());
+      for (size_t c0 = 0; c0 < m_numcolors; c0 += K)
+        {
+          size_t c1 = std::min(c0+K, m_numcolors);
+          for (size_t j = 0; j < p.cols(); j++)
+            xad(j) = AutoDiff<K>(x(j));
+          for (size_t j = m_colorfirst[c0]; j < m_colorfirst[c1]; j++)
+            {
+              size_t col = m_colorcols[j];
+              xad(col).deriv()[m_color[col]-c0] = 1;
+            }
+
+          func (xad, fad);
+
+          for (size_t j = m_colorfirst[c0]; j < m_colorfirst[c1]; j++)
+            {
+              size_t col = m_colorcols[j];
+              for (size_t e = m_colfirst[col]; e < m_colfirst[col+1]; e++)
+                df.value(m_entries[e]) = fad(m_entryrows[e]).deriv()[m_color[col]-c0];
+            }
+        }
+    }
+
+    // forward differences of func.evaluate, all columns of a color are
+    // perturbed at once
+    void evaluateFD (const NonlinearFunction & func, VectorView<double> x, SparseMatrix & df) const
+    {
+      auto & p = *m_pattern;
+      Vector<> f0(p.rows()), f1(p.rows()), xh(p.cols()), h(p.cols());
+      func.evaluate(x, f0);
+      xh = x;
+      double sqrteps = std::sqrt(std::numeric_limits<double>::epsilon());
+      for (size_t c = 0; c < m_numcolors; c++)
+        {
+          for (size_t j = m_colorfirst[c]; j < m_colorfirst[c+1]; j++)
+            {
+              size_t col = m_colorcols[j];
+              xh(col) = x(col) + sqrteps * std::max(1.0, std::fabs(x(col)));
+              h(col) = xh(col) - x(col);    // the step as represented
+            }
+
+          func.evaluate(xh, f1);
+
+          for (size_t j = m_colorfirst[c]; j < m_colorfirst[c+1]; j++)
+            {
+              size_t col = m_colorcols[j];
+              for (size_t e = m_colfirst[col]; e < m_colfirst[col+1]; e++)
+                {
+                  size_t i = m_entryrows[e];
+                  df.value(m_entries[e]) = (f1(i) - f0(i)) / h(col);
+                }
+              xh(col) = x(col);
+            }
+        }
+    }
+  };
+
+
+  // func with its Jacobian by colored finite differences, for functions
+  // with a known pattern but without derivative
+  class ColoredFDFunction : public NonlinearFunction
+  {
+    std::shared_ptr<NonlinearFunction> m_func;
+    ColoredJacobian m_coloring;
+  public:
+    ColoredFDFunction (std::shared_ptr<NonlinearFunction> func, SparsityPattern pattern)
+      : m_func(func), m_coloring(std::make_shared<const SparsityPattern>(std::move(pattern)))
+    {
+      if (m_coloring.pattern().rows() != func->dimF() || m_coloring.pattern().cols() != func->dimX())
+        throw std::invalid_argument("ColoredFDFunction: pattern does not fit the function");
+    }
+
+    ColoredFDFunction (std::shared_ptr<NonlinearFunction> func)
+      : ColoredFDFunction(func, func->sparsity()) { }
+
+    const ColoredJacobian & coloring () const { return m_coloring; }
+
+    size_t dimX() const override { return m_func->dimX(); }
+    size_t dimF() const override { return m_func->dimF(); }
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      m_func->evaluate(x, f);
+    }
+    void evaluateBatch (MatrixView<double> X, MatrixView<double> F) const override
+    {
+      m_func->evaluateBatch(X, F);
+    }
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      SparseMatrix jac(m_coloring.sharedPattern());
+      m_coloring.evaluateFD(*m_func, x, jac);
+      jac.toDense(df);
+    }
+    SparsityPattern sparsity () const override { return m_coloring.pattern(); }
+    void evaluateDerivSparse (VectorView<double> x, SparseMatrix & df) const override
+    {
+      m_coloring.evaluateFD(*m_func, x, df);
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef EXPLICITRK_HPP
+#define EXPLICITRK_HPP
+
+#include <stdexcept>
+
+#include "timestepper.hpp"
+
+namespace ASC_ode
+{
+
+  // explicit Runge-Kutta from a Butcher tableau, a strictly lower triangular
+  class ExplicitRungeKutta : public TimeStepper
+  {
+    Matrix<> m_a;
+    Vector<> m_b, m_c;
+    int m_stages;
+    size_t m_n;
+    Vector<> m_k, m_ystage;
+  public:
+    ExplicitRungeKutta(std::shared_ptr<NonlinearFunction> rhs,
+      const Matrix<> &a, const Vector<> &b, const Vector<> &c)
+    : TimeStepper(rhs), m_a(a), m_b(b), m_c(c),
+      m_stages(c.size()), m_n(rhs->dimX()), m_k(m_stages*m_n), m_ystage(m_n)
+    {
+      for (int i = 0; i < m_stages; i++)
+        for (int j = i; j < m_stages; j++)
+          if (a(i,j) != 0)
+            throw std::invalid_argument("ExplicitRungeKutta: a must be strictly lower triangular");
+    }
+
+    void doStep(double tau, VectorView<double> y) override
+    {
+      ASC_ODE_STATS_ADD(steps, 1);
+      ASC_ODE_STATS_ADD(function_evals, m_stages);
+      for (int i = 0; i < m_stages; i++)
+        {
+          m_ystage = y;
+          for (int j = 0; j < i; j++)
+            if (m_a(i,j) != 0)
+              m_ystage += tau * m_a(i,j) * m_k.range(j*m_n, (j+1)*m_n);
+          this->m_rhs->evaluate(m_ystage, m_k.range(i*m_n, (i+1)*m_n));
+        }
+      for (int j = 0; j < m_stages; j++)
+        if (m_b(j) != 0)
+          y += tau * m_b(j) * m_k.range(j*m_n, (j+1)*m_n);
+    }
+  };
+
+
+  // low-storage Runge-Kutta in Williamson's 2N form:
+  //   dy = A_i dy + tau f(y),  y += B_i dy
+  // The storage does not grow with the stages, but it is three registers
+  // y, dy and f, not two: evaluate overwrites its result and cannot add
+  // f(y) into the scaled dy.
+  class LowStorageRungeKutta : public TimeStepper
+  {
+    Vector<> m_A, m_B;
+    Vector<> m_dy, m_f;
+  public:
+    LowStorageRungeKutta(std::shared_ptr<NonlinearFunction> rhs,
+                         const Vector<> &A, const Vector<> &B)
+      : TimeStepper(rhs), m_A(A), m_B(B), m_dy(rhs->dimX()), m_f(rhs->dimF())
+    {
+      if (A.size() != B.size() || A(0) != 0)
+        throw std::invalid_argument("LowStorageRungeKutta: needs A(0) = 0 and as many A as B");
+    }
+
+    void doStep(double tau, VectorView<double> y) override
+    {
+      ASC_ODE_STATS_ADD(steps, 1);
+      ASC_ODE_STATS_ADD(function_evals, m_A.size());
+      for (size_t i = 0; i < m_A.size(); i++)
+        {
+          this->m_rhs->evaluate(y, m_f);
+          if (i == 0)
+            m_dy = tau * m_f;
+          else
+            {
+              m_dy *= m_A(i);
+              m_dy += tau * m_f;
+            }
+          y += m_B(i) * m_dy;
+        }
+    }
+  };
+
+
+
+  // classical fourth order method
+  inline std::shared_ptr<ExplicitRungeKutta> RK4 (std::shared_ptr<NonlinearFunction> rhs)
+  {
+    Matrix<> a(4, 4);
+    a = 0.0;
+    a(1,0) = 0.5;
+    a(2,1) = 0.5;
+    a(3,2) = 1;
+    Vector<> b = { 1.0/6, 1.0/3, 1.0/3, 1.0/6 };
+    Vector<> c = { 0, 0.5, 0.5, 1 };
+    return std::make_shared<ExplicitRungeKutta>(rhs, a, b, c);
+  }
+
+  // Shu, Osher (1988): third order, strong stability preserving with CFL 1
+  inline std::shared_ptr<ExplicitRungeKutta> SSPRK3 (std::shared_ptr<NonlinearFunction> rhs)
+  {
+    Matrix<> a(3, 3);
+    a = 0.0;
+    a(1,0) = 1;
+    a(2,0) = 0.25; a(2,1) = 0.25;
+    Vector<> b = { 1.0/6, 1.0/6, 2.0/3 };
+    Vector<> c = { 0, 1, 0.5 };
+    return std::make_shared<ExplicitRungeKutta>(rhs, a, b, c);
+  }
+
+  // Dormand, Prince (1980): the fifth order solution of RK5(4)7M
+  inline std::shared_ptr<ExplicitRungeKutta> DormandPrince5 (std::shared_ptr<NonlinearFunction> rhs)
+  {
+    Matrix<> a(7, 7);
+    a = 0.0;
+    a(1,0) = 1.0/5;
+    a(2,0) = 3.0/40;        a(2,1) = 9.0/40;
+    a(3,0) = 44.0/45;       a(3,1) = -56.0/15;       a(3,2) = 32.0/9;
+    a(4,0) = 19372.0/6561;  a(4,1) = -25360.0/2187;  a(4,2) = 64448.0/6561;  a(4,3) = -212.0/729;
+    a(5,0) = 9017.0/3168;   a(5,1) = -355.0/33;      a(5,2) = 46732.0/5247;  a(5,3) = 49.0/176;
+    a(5,4) = -5103.0/18656;
+    a(6,0) = 35.0/384;      a(6,2) = 500.0/1113;     a(6,3) = 125.0/192;     a(6,4) = -2187.0/6784;
+    a(6,5) = 11.0/84;
+    Vector<> b = { 35.0/384, 0, 500.0/1113, 125.0/192, -2187.0/6784, 11.0/84, 0 };
+    Vector<> c = { 0, 1.0/5, 3.0/10, 4.0/5, 8.0/9, 1, 1 };
+    return std::make_shared<ExplicitRungeKutta>(rhs, a, b, c);
+  }
+
+  // Verner (1978): the sixth order solution of the 6(5) pair used in DVERK
+  inline std::shared_ptr<ExplicitRungeKutta> Verner6 (std::shared_ptr<NonlinearFunction> rhs)
+  {
+    Matrix<> a(8, 8);
+    a = 0.0;
+    a(1,0) = 1.0/6;
+    a(2,0) = 4.0/75;          a(2,1) = 16.0/75;
+    a(3,0) = 5.0/6;           a(3,1) = -8.0/3;         a(3,2) = 5.0/2;
+    a(4,0) = -165.0/64;       a(4,1) = 55.0/6;         a(4,2) = -425.0/64;      a(4,3) = 85.0/96;
+    a(5,0) = 12.0/5;          a(5,1) = -8;             a(5,2) = 4015.0/612;     a(5,3) = -11.0/36;
+    a(5,4) = 88.0/255;
+    a(6,0) = -8263.0/15000;   a(6,1) = 124.0/75;       a(6,2) = -643.0/680;     a(6,3) = -81.0/250;
+    a(6,4) = 2484.0/10625;
+    a(7,0) = 3501.0/1720;     a(7,1) = -300.0/43;      a(7,2) = 297275.0/52632; a(7,3) = -319.0/2322;
+    a(7,4) = 24068.0/84065;   a(7,6) = 3850.0/26703;
+    Vector<> b = { 3.0/40, 0, 875.0/2244, 23.0/72, 264.0/1955, 0, 125.0/11592, 43.0/616 };
+    Vector<> c = { 0, 1.0/6, 4.0/15, 2.0/3, 5.0/6, 1, 1.0/15, 1 };
+    return std::make_shared<ExplicitRungeKutta>(rhs, a, b, c);
+  }
+
+
+  // Williamson (1980): three stages, third order
+  inline std::shared_ptr<LowStorageRungeKutta> Williamson3 (std::shared_ptr<NonlinearFunction> rhs)
+  {
+    Vector<> A = { 0, -5.0/9, -153.0/128 };
+    Vector<> B = { 1.0/3, 15.0/16, 8.0/15 };
+    return std::make_shared<LowStorageRungeKutta>(rhs, A, B);
+  }
+
+  // Carpenter, Kennedy (1994): five stages, fourth order
+  inline std::shared_ptr<LowStorageRungeKutta> CarpenterKennedy4 (std::shared_ptr<NonlinearFunction> rhs)
+  {
+    Vector<> A = { 0,
+                   -567301805773.0/1357537059087,
+                   -2404267990393.0/2016746695238,
+                   -3550918686646.0/2091501179385,
+                   -1275806237668.0/842570457699 };
+    Vector<> B = { 1432997174477.0/9575080441755,
+                   5161836677717.0/13612068292357,
+                   1720146321549.0/2090206949498,
+                   3134564353537.0/4481467310338,
+                   2277821191437.0/14882151754819 };
+    return std::make_shared<LowStorageRungeKutta>(rhs, A, B);
+  }
+
+}
+
+#endif
@@ -0,0 +1,309 @@
+#ifndef EXPONENTIAL_HPP
+#define EXPONENTIAL_HPP
+
+#include <cmath>
+#include <algorithm>
+
+#include "timestepper.hpp"
+
+namespace ASC_ode
+{
+
+  // exp(a) by scaling and squaring with a Taylor polynomial
+  inline Matrix<> MatrixExponential (MatrixView<double> a)
+  {
+    size_t n = a.rows();
+    double norm1 = 0;       // max row sum
+    for (size_t i = 0; i < n; i++)
+      {
+        double sum = 0;
+        for (size_t j = 0; j < n; j++)
+          sum += std::fabs (a(i,j));
+        norm1 = std::max(norm1, sum);
+      }
+
+    int squarings = 0;
+    while (norm1 > 0.5)
+      {
+        norm1 /= 2;
+        squarings++;
+      }
+    double scale = std::ldexp (1.0, -squarings);
+
+    // sum_k (a/2^s)^k / k!, the remainder is below 0.5^19/19!
+    Matrix<> as(n, n), term(n, n), expa(n, n);
+    for (size_t i = 0; i < n; i++)
+      for (size_t j = 0; j < n; j++)
+        {
+          as(i,j) = scale * a(i,j);
+          term(i,j) = (i == j) ? 1.0 : 0.0;
+          expa(i,j) = term(i,j);
+        }
+    for (int k = 1; k <= 18; k++)
+      {
+        term = term * as;
+        term *= 1.0/k;
+        expa += term;
+      }
+
+    for (int s = 0; s < squarings; s++)
+      expa = expa * expa;
+    return expa;
+  }
+
+
+  // [ phi_0(a), phi_1(a), ..., phi_p(a) ] as n x (p+1)n matrix, the top
+  // block row of exp of the augmented matrix [[a, I, 0], [0, 0, I], [0, 0, 0]]
+  inline Matrix<> PhiFunctions (MatrixView<double> a, int p)
+  {
+    size_t n = a.rows();
+    size_t N = (p+1)*n;
+    Matrix<> aug(N, N);
+    aug = 0.0;
+    for (size_t i = 0; i < n; i++)
+      for (size_t j = 0; j < n; j++)
+        aug(i,j) = a(i,j);
+    for (int k = 0; k < p; k++)
+      for (size_t i = 0; i < n; i++)
+        aug(k*n+i, (k+1)*n+i) = 1;
+
+    Matrix<> expaug = MatrixExponential (aug);
+    Matrix<> phi(n, N);
+    for (size_t i = 0; i < n; i++)
+      for (size_t j = 0; j < N; j++)
+        phi(i,j) = expaug(i,j);
+    return phi;
+  }
+
+
+  // phi_k(tau a) v approximated in the Krylov space of dimension m
+  inline void PhiKrylov (MatrixView<double> a, double tau, VectorView<double> v,
+                         int k, size_t m, VectorView<double> res)
+  {
+    size_t n = a.rows();
+    m = std::min(m, n);
+    Matrix<> basis(m+1, n);
+    Matrix<> h(m+1, m);
+    h = 0.0;
+
+    double beta = norm(v);
+    res = 0.0;
+    if (beta == 0) return;
+    for (size_t i = 0; i < n; i++)
+      basis(0,i) = v(i) / beta;
+
+    // Arnoldi with modified Gram-Schmidt, stops early on invariant subspaces
+    size_t dim = m;
+    Vector<> w(n);
+    for (size_t j = 0; j < m; j++)
+      {
+        for (size_t i = 0; i < n; i++)
+          {
+            double sum = 0;
+            for (size_t l = 0; l < n; l++)
+              sum += a(i,l) * basis(j,l);
+            w(i) = sum;
+          }
+        for (size_t l = 0; l <= j; l++)
+          {
+            double hij = 0;
+            for (size_t i = 0; i < n; i++)
+              hij += basis(l,i) * w(i);
+            h(l,j) = hij;
+            for (size_t i = 0; i < n; i++)
+              w(i) -= hij * basis(l,i);
+          }
+        h(j+1,j) = norm(w);
+        if (h(j+1,j) < 1e-12 * beta)
+          {
+            dim = j+1;
+            break;
+          }
+        for (size_t i = 0; i < n; i++)
+          basis(j+1,i) = w(i) / h(j+1,j);
+      }
+
+    Matrix<> th(dim, dim);
+    for (size_t i = 0; i < dim; i++)
+      for (size_t j = 0; j < dim; j++)
+        th(i,j) = tau * h(i,j);
+    Matrix<> phi = PhiFunctions (th, k);
+
+    // res = beta V phi_k(tau H) e_1
+    for (size_t j = 0; j < dim; j++)
+      {
+        double c = beta * phi(j, k*dim);
+        for (size_t i = 0; i < n; i++)
+          res(i) += c * basis(j,i);
+      }
+  }
+
+
+
+  // exponential (Rosenbrock-)Euler  y += tau phi_1(tau J) f(y), J = f'(y).
+  // Exact for linear autonomous systems. With krylovdim > 0 the action of
+  // phi_1 is approximated in a Krylov space, otherwise computed densely.
+  class ExponentialEuler : public TimeStepper
+  {
+    size_t m_krylovdim;
+    Vector<> m_f, m_phif;
+    Matrix<> m_jac;
+  public:
+    ExponentialEuler (std::shared_ptr<NonlinearFunction> rhs, size_t krylovdim = 0)
+      : TimeStepper(rhs), m_krylovdim(krylovdim), m_f(rhs->dimF()), m_phif(rhs->dimF()),
+        m_jac(rhs->dimF(), rhs->dimX()) { }
+
+    void doStep (double tau, VectorView<double> y) override
+    {
+      ASC_ODE_STATS_ADD(steps, 1);
+      ASC_ODE_STATS_ADD(function_evals, 1);
+      ASC_ODE_STATS_ADD(jacobian_evals, 1);
+      m_rhs->evaluate (y, m_f);
+      m_rhs->evaluateDeriv (y, m_jac);
+
+      if (m_krylovdim > 0)
+        PhiKrylov (m_jac, tau, m_f, 1, m_krylovdim, m_phif);
+      else
+        {
+          ASC_ODE_STATS_ADD(factorizations, 1);
+          Matrix<> taujac = m_jac;
+          taujac *= tau;
+          Matrix<> phi = PhiFunctions (taujac, 1);
+          size_t n = y.size();
+          m_phif = phi.cols(n, 2*n) * m_f;
+        }
+      y += tau * m_phif;
+    }
+  };
+
+
+
+  // exponential time differencing for the semi-linear y' = A y + N(y)
+  // (Cox, Matthews 2002): ETD2RK for order 2, ETDRK4 for order 4.
+  // The phi functions of tau A and tau A/2 are computed once per step size.
+  class ETDRungeKutta : public TimeStepper
+  {
+    Matrix<> m_a;
+    std::shared_ptr<NonlinearFunction> m_nonlin;
+    int m_order;
+    size_t m_n;
+    double m_tau = 0;
+    Matrix<> m_phi, m_phihalf;       // phi_0..3 (tau A), phi_0..1 (tau A/2)
+    Vector<> m_nu, m_na, m_nb, m_nc, m_ya, m_yb, m_yc;
+  public:
+    ETDRungeKutta (const Matrix<> & a, std::shared_ptr<NonlinearFunction> nonlin, int order = 4)
+      : TimeStepper(std::make_shared<MatVecFunc>(a, 1) + nonlin),
+        m_a(a), m_nonlin(nonlin), m_order(order), m_n(a.rows()),
+        m_nu(m_n), m_na(m_n), m_nb(m_n), m_nc(m_n), m_ya(m_n), m_yb(m_n), m_yc(m_n)
+    {
+      if (order != 2 && order != 4)
+        throw std::invalid_argument("ETDRungeKutta: order must be 2 or 4");
+    }
+
+    void doStep (double tau, VectorView<double> y) override
+    {
+      ASC_ODE_STATS_ADD(steps, 1);
+      if (tau != m_tau)
+        {
+          ASC_ODE_STATS_ADD(factorizations, 1);
+          Matrix<> ta = m_a;
+          ta *= tau;
+          m_phi = PhiFunctions (ta, 3);
+          ta *= 0.5;
+          m_phihalf = PhiFunctions (ta, 1);
+          m_tau = tau;
+        }
+      size_t n = m_n;
+      auto phi = [&] (int k) { return m_phi.cols(k*n, (k+1)*n); };
+      auto phihalf = [&] (int k) { return m_phihalf.cols(k*n, (k+1)*n); };
+
+      ASC_ODE_STATS_ADD(function_evals, m_order == 2 ? 2 : 4);
+      m_nonlin->evaluate (y, m_nu);
+
+      if (m_order == 2)
+        {
+          // a = e^{hA} u + h phi_1 N(u),  u+ = a + h phi_2 (N(a) - N(u))
+          m_ya = phi(0) * y;
+          m_ya += tau * (phi(1) * m_nu);
+          m_nonlin->evaluate (m_ya, m_na);
+          for (size_t i = 0; i < n; i++)
+            m_na(i) -= m_nu(i);
+          y = m_ya;
+          y += tau * (phi(2) * m_na);
+          return;
+        }
+
+      m_ya = phihalf(0) * y;
+      m_ya += tau/2 * (phihalf(1) * m_nu);
+      m_nonlin->evaluate (m_ya, m_na);
+
+      m_yb = phihalf(0) * y;
+      m_yb += tau/2 * (phihalf(1) * m_na);
+      m_nonlin->evaluate (m_yb, m_nb);
+
+      m_yc = phihalf(0) * m_ya;
+      for (size_t i = 0; i < n; i++)
+        m_nc(i) = 2*m_nb(i) - m_nu(i);
+      m_yc += tau/2 * (phihalf(1) * m_nc);
+      m_nonlin->evaluate (m_yc, m_nc);
+
+      // u+ = e^{hA} u + h [ (phi1-3phi2+4phi3) N(u) + (2phi2-4phi3) (N(a)+N(b))
+      //                     + (4phi3-phi2) N(c) ]
+      for (size_t i = 0; i < n; i++)
+        {
+          m_ya(i) = -3*m_nu(i) + 2*m_na(i) + 2*m_nb(i) - m_nc(i);
+          m_yb(i) = 4*(m_nu(i) - m_na(i) - m_nb(i) + m_nc(i));
+        }
+      m_yc = phi(0) * y;
+      m_yc += tau * (phi(1) * m_nu);
+      m_yc += tau * (phi(2) * m_ya);
+      m_yc += tau * (phi(3) * m_yb);
+      y = m_yc;
+    }
+  };
+
+
+
+  // y' = A y + b with constant A, b: precomputes exp(tau A) and
+  // tau phi_1(tau A) b once per step size, a step is a single mat-vec.
+  // A and b are taken as Jacobian and value of rhs at 0.
+  class LinearExponential : public TimeStepper
+  {
+    Matrix<> m_a, m_exp;
+    Vector<> m_b, m_shift, m_y;
+    double m_tau = 0;
+  public:
+    LinearExponential (std::shared_ptr<NonlinearFunction> rhs)
+      : TimeStepper(rhs), m_a(rhs->dimF(), rhs->dimX()), m_exp(rhs->dimF(), rhs->dimX()),
+        m_b(rhs->dimF()), m_shift(rhs->dimF()), m_y(rhs->dimF())
+    {
+      Vector<> zero(rhs->dimX());
+      zero = 0.0;
+      rhs->evaluate (zero, m_b);
+      rhs->evaluateDeriv (zero, m_a);
+    }
+
+    void doStep (double tau, VectorView<double> y) override
+    {
+      ASC_ODE_STATS_ADD(steps, 1);
+      if (tau != m_tau)
+        {
+          ASC_ODE_STATS_ADD(factorizations, 1);
+          size_t n = m_a.rows();
+          Matrix<> ta = m_a;
+          ta *= tau;
+          Matrix<> phi = PhiFunctions (ta, 1);
+          m_exp = phi.cols(0, n);
+          m_shift = phi.cols(n, 2*n) * m_b;
+          m_shift *= tau;
+          m_tau = tau;
+        }
+      m_y = m_exp * y;
+      y = m_y;
+      y += m_shift;
+    }
+  };
+
+}
+
+#endif
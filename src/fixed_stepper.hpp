@@ -0,0 +1,253 @@
+#ifndef FIXED_STEPPER_HPP
+#define FIXED_STEPPER_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+#include <vector.hpp>
+
+#include "solver_stats.hpp"
+
+// Time steppers for tiny systems with the dimension N known at compile time.
+// The rhs is any callable f(const Vec<N>& x, Vec<N>& fx), the Jacobian
+// df(const Vec<N>& x, SmallMatrix<N>& j). All storage is on the stack and
+// all loops have fixed bounds, no virtual calls and no allocations.
+
+namespace ASC_ode
+{
+  namespace fixed
+  {
+    using nanoblas::Vec;
+
+    template <size_t N>
+    class SmallMatrix
+    {
+      double m_data[N*N];
+    public:
+      SmallMatrix () { }
+      SmallMatrix (double s) { for (size_t i = 0; i < N*N; i++) m_data[i] = s; }
+      double & operator() (size_t i, size_t j) { return m_data[i*N+j]; }
+      double operator() (size_t i, size_t j) const { return m_data[i*N+j]; }
+    };
+
+
+    // solves a x = b in place (x overwrites b), Gaussian elimination with
+    // partial pivoting, a is overwritten
+    template <size_t N>
+    void SolveInPlace (SmallMatrix<N> & a, Vec<N> & b)
+    {
+      for (size_t k = 0; k < N; k++)
+        {
+          size_t p = k;
+          for (size_t i = k+1; i < N; i++)
+            if (std::fabs(a(i,k)) > std::fabs(a(p,k))) p = i;
+          if (a(p,k) == 0)
+            throw std::domain_error("fixed::SolveInPlace: singular matrix");
+          if (p != k)
+            {
+              for (size_t j = k; j < N; j++) std::swap (a(k,j), a(p,j));
+              std::swap (b(k), b(p));
+            }
+          double inv = 1.0 / a(k,k);
+          for (size_t i = k+1; i < N; i++)
+            {
+              double l = a(i,k) * inv;
+              for (size_t j = k+1; j < N; j++)
+                a(i,j) -= l * a(k,j);
+              b(i) -= l * b(k);
+            }
+        }
+      for (size_t k = N; k-- > 0; )
+        {
+          double sum = b(k);
+          for (size_t j = k+1; j < N; j++)
+            sum -= a(k,j) * b(j);
+          b(k) = sum / a(k,k);
+        }
+    }
+
+
+    // forward differences, for rhs without an analytic Jacobian
+    template <size_t N, typename F>
+    class NumericJacobian
+    {
+      F m_f;
+    public:
+      NumericJacobian (F f) : m_f(f) { }
+      void operator() (const Vec<N> & x, SmallMatrix<N> & j) const
+      {
+        Vec<N> f0, f1, xh = x;
+        m_f (x, f0);
+        for (size_t k = 0; k < N; k++)
+          {
+            double eps = 1e-8 * (1 + std::fabs(x(k)));
+            xh(k) = x(k) + eps;
+            m_f (xh, f1);
+            xh(k) = x(k);
+            for (size_t i = 0; i < N; i++)
+              j(i,k) = (f1(i) - f0(i)) / eps;
+          }
+      }
+    };
+
+
+    // solves x - c - tau f(x) = 0, x holds the initial guess
+    template <size_t N, typename F, typename DF>
+    void NewtonSolver (const F & f, const DF & df, const Vec<N> & c, double tau, Vec<N> & x,
+                       double tol = 1e-10, int maxsteps = 10)
+    {
+      Vec<N> res;
+      SmallMatrix<N> jac;
+      ASC_ODE_STATS_ADD(newton_solves, 1);
+
+      double err = 0;
+      for (int it = 0; it < maxsteps; it++)
+        {
+          ASC_ODE_STATS_ADD(function_evals, 1);
+          f (x, res);
+          err = 0;
+          for (size_t i = 0; i < N; i++)
+            {
+              res(i) = x(i) - c(i) - tau * res(i);
+              err += res(i) * res(i);
+            }
+          err = std::sqrt(err);
+          if (err < tol)
+            {
+              ASC_ODE_STATS_MAX(newton_max_iterations, it);
+              return;
+            }
+
+          ASC_ODE_STATS_ADD(jacobian_evals, 1);
+          df (x, jac);
+          for (size_t i = 0; i < N; i++)
+            for (size_t j = 0; j < N; j++)
+              jac(i,j) = (i == j ? 1.0 : 0.0) - tau * jac(i,j);
+          ASC_ODE_STATS_ADD(factorizations, 1);
+          SolveInPlace (jac, res);
+          x -= res;
+          ASC_ODE_STATS_ADD(newton_iterations, 1);
+        }
+
+      ASC_ODE_STATS_ADD(newton_failures, 1);
+      std::ostringstream msg;
+      msg << "Newton did not converge: residual " << err << " after " << maxsteps
+          << " iterations (tol " << tol << ", dim " << N << ")";
+      throw std::domain_error(msg.str());
+    }
+
+
+    template <size_t N, typename F>
+    class ExplicitEuler
+    {
+      F m_f;
+    public:
+      ExplicitEuler (F f) : m_f(f) { }
+
+      void doStep (double tau, Vec<N> & y) const
+      {
+        ASC_ODE_STATS_ADD(steps, 1);
+        ASC_ODE_STATS_ADD(function_evals, 1);
+        Vec<N> fy;
+        m_f (y, fy);
+        for (size_t i = 0; i < N; i++)
+          y(i) += tau * fy(i);
+      }
+    };
+
+    template <size_t N, typename F>
+    class ImprovedEuler
+    {
+      F m_f;
+    public:
+      ImprovedEuler (F f) : m_f(f) { }
+
+      void doStep (double tau, Vec<N> & y) const
+      {
+        ASC_ODE_STATS_ADD(steps, 1);
+        ASC_ODE_STATS_ADD(function_evals, 2);
+        Vec<N> fy, ymid;
+        m_f (y, fy);
+        for (size_t i = 0; i < N; i++)
+          ymid(i) = y(i) + 0.5 * tau * fy(i);
+        m_f (ymid, fy);
+        for (size_t i = 0; i < N; i++)
+          y(i) += tau * fy(i);
+      }
+    };
+
+    template <size_t N, typename F, typename DF = NumericJacobian<N,F>>
+    class ImplicitEuler
+    {
+      F m_f;
+      DF m_df;
+    public:
+      ImplicitEuler (F f, DF df) : m_f(f), m_df(df) { }
+      ImplicitEuler (F f) : m_f(f), m_df(f) { }
+
+      void doStep (double tau, Vec<N> & y) const
+      {
+        ASC_ODE_STATS_ADD(steps, 1);
+        Vec<N> yold = y;
+        NewtonSolver (m_f, m_df, yold, tau, y);
+      }
+    };
+
+    template <size_t N, typename F, typename DF = NumericJacobian<N,F>>
+    class CrankNicolson
+    {
+      F m_f;
+      DF m_df;
+    public:
+      CrankNicolson (F f, DF df) : m_f(f), m_df(df) { }
+      CrankNicolson (F f) : m_f(f), m_df(f) { }
+
+      // y_new - (y + tau/2 f(y)) - tau/2 f(y_new) = 0
+      void doStep (double tau, Vec<N> & y) const
+      {
+        ASC_ODE_STATS_ADD(steps, 1);
+        ASC_ODE_STATS_ADD(function_evals, 1);
+        Vec<N> c;
+        m_f (y, c);
+        for (size_t i = 0; i < N; i++)
+          c(i) = y(i) + 0.5 * tau * c(i);
+        NewtonSolver (m_f, m_df, c, 0.5*tau, y);
+      }
+    };
+
+
+    // N cannot be deduced from a lambda, e.g.  auto s = MakeCrankNicolson<2>(f, df);
+    template <size_t N, typename F>
+    auto MakeExplicitEuler (F f) { return ExplicitEuler<N,F>(f); }
+
+    template <size_t N, typename F>
+    auto MakeImprovedEuler (F f) { return ImprovedEuler<N,F>(f); }
+
+    template <size_t N, typename F>
+    auto MakeImplicitEuler (F f) { return ImplicitEuler<N,F>(f); }
+
+    template <size_t N, typename F, typename DF>
+    auto MakeImplicitEuler (F f, DF df) { return ImplicitEuler<N,F,DF>(f, df); }
+
+    template <size_t N, typename F>
+    auto MakeCrankNicolson (F f) { return CrankNicolson<N,F>(f); }
+
+    template <size_t N, typename F, typename DF>
+    auto MakeCrankNicolson (F f, DF df) { return CrankNicolson<N,F,DF>(f, df); }
+
+
+    // steps equidistant steps on [0, tend]
+    template <size_t N, typename Stepper>
+    void SolveODE (const Stepper & stepper, double tend, int steps, Vec<N> & y)
+    {
+      double tau = tend / steps;
+      for (int i = 0; i < steps; i++)
+        stepper.doStep (tau, y);
+    }
+  }
+}
+
+#endif
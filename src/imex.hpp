@@ -0,0 +1,277 @@
+#ifndef IMEX_HPP
+#define IMEX_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "timestepper.hpp"
+
+namespace ASC_ode
+{
+
+  // stage equation  Y_u - tau fimp(Y)_u = rhs_u  for the components u of
+  // Y that are not known in advance, the others are fixed in y. Only the
+  // block of the unknowns is assembled and factorized.
+  class IMEXStageFunction : public NonlinearFunction
+  {
+    std::shared_ptr<NonlinearFunction> m_fimp;
+    std::vector<size_t> m_unknowns;
+    std::shared_ptr<const SparsityPattern> m_fullpattern;
+    SparsityPattern m_pattern;
+    std::vector<size_t> m_fullpos;     // entry of fimp for every entry, nnz if none
+    Vector<> m_y, m_rhs;
+    double m_tau = 0;
+  public:
+    IMEXStageFunction (std::shared_ptr<NonlinearFunction> fimp,
+                       std::shared_ptr<const SparsityPattern> fullpattern,
+                       std::vector<size_t> unknowns)
+      : m_fimp(fimp), m_unknowns(std::move(unknowns)), m_fullpattern(fullpattern),
+        m_y(fimp->dimX()), m_rhs(fimp->dimX())
+    {
+      auto & p = *m_fullpattern;
+      constexpr size_t none = std::numeric_limits<size_t>::max();
+      std::vector<size_t> local(p.cols(), none);
+      for (size_t k = 0; k < m_unknowns.size(); k++)
+        local[m_unknowns[k]] = k;
+
+      // identity plus the unknown columns of fimp in the unknown rows
+      std::vector<size_t> first(1, 0), colind;
+      std::vector<std::pair<size_t,size_t>> row;
+      for (size_t k = 0; k < m_unknowns.size(); k++)
+        {
+          size_t i = m_unknowns[k];
+          row.assign(1, { k, p.nnz() });
+          for (size_t e = p.first(i); e < p.next(i); e++)
+            if (local[p.col(e)] == k)
+              row[0].second = e;
+            else if (local[p.col(e)] != none)
+              row.emplace_back(local[p.col(e)], e);
+          std::sort (row.begin(), row.end());
+          for (auto [j, e] : row)
+            {
+              colind.push_back(j);
+              m_fullpos.push_back(e);
+            }
+          first.push_back(colind.size());
+        }
+      size_t n = m_unknowns.size();
+      m_pattern = SparsityPattern(n, n, std::move(first), std::move(colind));
+    }
+
+    const std::vector<size_t> & unknowns () const { return m_unknowns; }
+
+    // y holds the known components, rhs the right hand side
+    void set (VectorView<double> y, VectorView<double> rhs, double tau)
+    {
+      m_y = y;
+      m_rhs = rhs;
+      m_tau = tau;
+    }
+
+    size_t dimX() const override { return m_unknowns.size(); }
+    size_t dimF() const override { return m_unknowns.size(); }
+
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      Vector<> y(m_y), fy(m_y.size());
+      for (size_t k = 0; k < m_unknowns.size(); k++)
+        y(m_unknowns[k]) = x(k);
+      m_fimp->evaluate(y, fy);
+      for (size_t k = 0; k < m_unknowns.size(); k++)
+        f(k) = x(k) - m_rhs(m_unknowns[k]) - m_tau * fy(m_unknowns[k]);
+    }
+
+    SparsityPattern sparsity () const override { return m_pattern; }
+
+    void evaluateDerivSparse (VectorView<double> x, SparseMatrix & df) const override
+    {
+      Vector<> y(m_y);
+      for (size_t k = 0; k < m_unknowns.size(); k++)
+        y(m_unknowns[k]) = x(k);
+      SparseMatrix jac(m_fullpattern);
+      m_fimp->evaluateDerivSparse(y, jac);
+
+      auto & p = df.pattern();
+      for (size_t i = 0; i < p.rows(); i++)
+        for (size_t e = p.first(i); e < p.next(i); e++)
+          {
+            double val = (p.col(e) == i) ? 1.0 : 0.0;
+            if (m_fullpos[e] < jac.nnz())
+              val -= m_tau * jac.value(m_fullpos[e]);
+            df.value(e) = val;
+          }
+    }
+
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      SparseMatrix jac(m_pattern);
+      evaluateDerivSparse(x, jac);
+      jac.toDense(df);
+    }
+  };
+
+
+  // IMEX Runge-Kutta for y' = fexp(y) + fimp(y): fexp is treated with
+  // the explicit tableau (ae, be), fimp with the diagonally implicit
+  // tableau (ai, bi). Newton only sees fimp, one stage at a time.
+  //
+  // With a sparse fimp, stage components whose row of fimp depends only
+  // on known components are computed directly, level by level (for
+  // y = (x, v) with stiff springs: v, then x of the masses without stiff
+  // springs). Newton solves for the rest, e.g. the masses of the stiff
+  // springs and joints. The levels and the stage equation follow the
+  // pattern of fimp, they are set up again when its sparsityVersion()
+  // changes, e.g. when springs break.
+  class IMEXRungeKutta : public TimeStepper
+  {
+    std::shared_ptr<NonlinearFunction> m_fexp, m_fimp;
+    Matrix<> m_ae, m_ai;
+    Vector<> m_be, m_bi;
+    int m_stages;
+    size_t m_n;
+    std::shared_ptr<NonlinearFunction> m_equ;
+    std::shared_ptr<Parameter> m_tau;
+    std::shared_ptr<ConstantFunction> m_yrhs;
+    Vector<> m_kexp, m_kimp, m_ystage;
+    // stage components computed directly, level by level, and the stage
+    // equation of the rest; no stage function if nothing can be left out
+    std::vector<std::vector<size_t>> m_levels;
+    std::shared_ptr<IMEXStageFunction> m_stage;
+    size_t m_version;
+    Vector<> m_rhs, m_fy;
+  public:
+    IMEXRungeKutta (std::shared_ptr<NonlinearFunction> fexp,
+                    std::shared_ptr<NonlinearFunction> fimp,
+                    const Matrix<> & ae, const Vector<> & be,
+                    const Matrix<> & ai, const Vector<> & bi)
+      : TimeStepper(fexp + fimp), m_fexp(fexp), m_fimp(fimp),
+        m_ae(ae), m_ai(ai), m_be(be), m_bi(bi),
+        m_stages(be.size()), m_n(fimp->dimX()),
+        m_tau(std::make_shared<Parameter>(0.0)),
+        m_kexp(m_stages*m_n), m_kimp(m_stages*m_n), m_ystage(m_n),
+        m_rhs(m_n), m_fy(m_n)
+    {
+      // stage equation  Y - tau a_ii fimp(Y) = yold + explicit terms
+      m_yrhs = std::make_shared<ConstantFunction>(m_n);
+      auto ynew = std::make_shared<IdentityFunction>(m_n);
+      m_equ = ynew - m_yrhs - m_tau * m_fimp;
+
+      setup();
+    }
+
+    void doStep (double tau, VectorView<double> y) override
+    {
+      ASC_ODE_STATS_ADD(steps, 1);
+      for (int i = 0; i < m_stages; i++)
+        {
+          m_ystage = y;
+          for (int j = 0; j < i; j++)
+            {
+              m_ystage += tau * m_ae(i,j) * m_kexp.range(j*m_n, (j+1)*m_n);
+              m_ystage += tau * m_ai(i,j) * m_kimp.range(j*m_n, (j+1)*m_n);
+            }
+
+          // the known part of the stage is the initial guess
+          if (m_ai(i,i) != 0 && m_fimp->sparsityVersion() != m_version)
+            setup();
+          if (m_ai(i,i) != 0 && m_stage)
+            solveReducedStage (tau * m_ai(i,i));
+          else if (m_ai(i,i) != 0)
+            {
+              m_yrhs->set (m_ystage);
+              m_tau->set (tau * m_ai(i,i));
+              NewtonSolver (m_equ, m_ystage);
+            }
+
+          ASC_ODE_STATS_ADD(function_evals, 2);
+          m_fexp->evaluate (m_ystage, m_kexp.range(i*m_n, (i+1)*m_n));
+          m_fimp->evaluate (m_ystage, m_kimp.range(i*m_n, (i+1)*m_n));
+        }
+
+      for (int j = 0; j < m_stages; j++)
+        {
+          y += tau * m_be(j) * m_kexp.range(j*m_n, (j+1)*m_n);
+          y += tau * m_bi(j) * m_kimp.range(j*m_n, (j+1)*m_n);
+        }
+    }
+
+  private:
+    // levels of directly computed components and the stage equation of
+    // the rest, from the current pattern of fimp
+    void setup ()
+    {
+      m_version = m_fimp->sparsityVersion();
+      m_levels.clear();
+      m_stage = nullptr;
+      auto pattern = m_fimp->sharedSparsity();
+      if (pattern->isDense()) return;
+
+      // every level costs an evaluation of fimp per stage
+      constexpr size_t maxlevels = 4;
+      std::vector<bool> known(m_n, false);
+      while (m_levels.size() < maxlevels)
+        {
+          std::vector<size_t> level;
+          for (size_t i = 0; i < m_n; i++)
+            {
+              if (known[i]) continue;
+              bool direct = true;
+              for (size_t e = pattern->first(i); e < pattern->next(i) && direct; e++)
+                direct = known[pattern->col(e)];
+              if (direct) level.push_back(i);
+            }
+          if (level.empty()) break;
+          for (size_t i : level) known[i] = true;
+          m_levels.push_back(std::move(level));
+        }
+      if (m_levels.empty()) return;
+
+      std::vector<size_t> unknowns;
+      for (size_t i = 0; i < m_n; i++)
+        if (!known[i]) unknowns.push_back(i);
+      m_stage = std::make_shared<IMEXStageFunction>(m_fimp, pattern, std::move(unknowns));
+    }
+
+    // m_ystage - taui fimp(m_ystage) = rhs, rhs is m_ystage on entry
+    void solveReducedStage (double taui)
+    {
+      m_rhs = m_ystage;
+      for (auto & level : m_levels)
+        {
+          ASC_ODE_STATS_ADD(function_evals, 1);
+          m_fimp->evaluate (m_ystage, m_fy);
+          for (size_t k : level)
+            m_ystage(k) = m_rhs(k) + taui * m_fy(k);
+        }
+
+      auto & unknowns = m_stage->unknowns();
+      if (unknowns.empty()) return;
+      Vector<> xu(unknowns.size());
+      for (size_t k = 0; k < unknowns.size(); k++)
+        xu(k) = m_ystage(unknowns[k]);
+      m_stage->set (m_ystage, m_rhs, taui);
+      NewtonSolver (m_stage, xu);
+      for (size_t k = 0; k < unknowns.size(); k++)
+        m_ystage(unknowns[k]) = xu(k);
+    }
+  };
+
+
+  // Ascher, Ruuth, Spiteri (1997), scheme (2,3,2): L-stable, second order
+  inline std::shared_ptr<IMEXRungeKutta> ARS232 (std::shared_ptr<NonlinearFunction> fexp,
+                                                 std::shared_ptr<NonlinearFunction> fimp)
+  {
+    double gamma = 1 - 1/std::sqrt(2.0);
+    double delta = -2*std::sqrt(2.0)/3;
+    Matrix<> ae { { 0, 0, 0 }, { gamma, 0, 0 }, { delta, 1-delta, 0 } };
+    Matrix<> ai { { 0, 0, 0 }, { 0, gamma, 0 }, { 0, 1-gamma, gamma } };
+    Vector<> b { 0, 1-gamma, gamma };
+    return std::make_shared<IMEXRungeKutta>(fexp, fimp, ae, b, ai, b);
+  }
+
+}
+
+#endif
@@ -5,6 +5,8 @@
 #include <matrix.hpp>
 #include <inverse.hpp>
 
+#include "butcher.hpp"
+
 namespace ASC_ode {
   using namespace nanoblas;
 
@@ -20,12 +22,53 @@ namespace ASC_ode {
     int m_stages;
     int m_n;
     Vector<> m_k, m_y;
+
+    // predictor: k_i = u'(t + c_i tau) of the collocation polynomial u of
+    // the previous step, whose derivative interpolates its k_j at c_j
+    StepHistory m_history;
+    Vector<> m_kprev;
+    Matrix<> m_extrap;
+    double m_extraptheta = 0;
+
+    void predictStages(double tau)
+    {
+      double theta = tau / m_history.tau();
+      if (theta != m_extraptheta)
+        {
+          bool distinct = true;
+          for (int i = 0; i < m_stages; i++)
+            for (int j = 0; j < i; j++)
+              if (m_c(i) == m_c(j)) distinct = false;
+
+          for (int i = 0; i < m_stages; i++)
+            for (int j = 0; j < m_stages; j++)
+              {
+                // without distinct nodes the last stage is kept
+                double w = (j == m_stages-1) ? 1 : 0;
+                if (distinct)
+                  {
+                    w = 1;
+                    for (int m = 0; m < m_stages; m++)
+                      if (m != j)
+                        w *= (1 + m_c(i)*theta - m_c(m)) / (m_c(j) - m_c(m));
+                  }
+                m_extrap(i,j) = w;
+              }
+          m_extraptheta = theta;
+        }
+
+      m_k = 0.0;
+      for (int i = 0; i < m_stages; i++)
+        for (int j = 0; j < m_stages; j++)
+          m_k.range(i*m_n, (i+1)*m_n) += m_extrap(i,j) * m_kprev.range(j*m_n, (j+1)*m_n);
+    }
   public:
     ImplicitRungeKutta(std::shared_ptr<NonlinearFunction> rhs,
       const Matrix<> &a, const Vector<> &b, const Vector<> &c) 
     : TimeStepper(rhs), m_a(a), m_b(b), m_c(c),
     m_tau(std::make_shared<Parameter>(0.0)),
-    m_stages(c.size()), m_n(rhs->dimX()), m_k(m_stages*m_n), m_y(m_stages*m_n)
+    m_stages(c.size()), m_n(rhs->dimX()), m_k(m_stages*m_n), m_y(m_stages*m_n),
+    m_history(rhs->dimX()), m_kprev(m_stages*m_n), m_extrap(m_stages, m_stages)
     {
       auto multiple_rhs = make_shared<MultipleFunc>(rhs, m_stages);
       m_yold = std::make_shared<ConstantFunction>(m_stages*m_n);
@@ -33,16 +76,106 @@ namespace ASC_ode {
       m_equ = knew - Compose(multiple_rhs, m_yold+m_tau*std::make_shared<MatVecFunc>(a, m_n));
     }
 
+    // e.g. ImplicitRungeKutta(rhs, Tableau(ButcherTableau::RADAU_IIA, 3))
+    ImplicitRungeKutta(std::shared_ptr<NonlinearFunction> rhs, const ButcherTableau & tableau)
+      : ImplicitRungeKutta(rhs, tableau.a, tableau.b, tableau.c) { }
+
     void doStep(double tau, VectorView<double> y) override
     {
+      ASC_ODE_STATS_ADD(steps, 1);
       for (int j = 0; j < m_stages; j++)
         m_y.range(j*m_n, (j+1)*m_n) = y;
       m_yold->set(m_y);
 
       m_tau->set(tau);
-      m_k = 0.0;  
+      if (m_predictor && m_history.continues(y))
+        predictStages(tau);
+      else
+        m_k = 0.0;
       NewtonSolver(m_equ, m_k);
 
+      for (int j = 0; j < m_stages; j++)
+        y += tau * m_b(j) * m_k.range(j*m_n, (j+1)*m_n);
+      m_kprev = m_k;
+      m_history.store(m_y.range(0, m_n), y, tau);
+    }
+
+    // stage sensitivities dk from (Newton Jacobian) dk_i = f_y(Y_i) s + f_p(Y_i),
+    // Y_i = y + tau sum_j a_ij k_j,  s_new = s + tau sum_j b_j dk_j
+    void doStepSensitivity(double tau, VectorView<double> y, MatrixView<double> s) override
+    {
+      auto rhs = parameterizedRhs();
+      size_t n = m_n, np = s.cols();
+      Matrix<> jacinv(m_stages*n, m_stages*n), rhsk(m_stages*n, np), dk(m_stages*n, np);
+      Matrix<> fy(n, n);
+      Vector<> ystage(n);
+
+      ASC_ODE_STATS_ADD(steps, 1);
+      for (int j = 0; j < m_stages; j++)
+        m_y.range(j*m_n, (j+1)*m_n) = y;
+      m_yold->set(m_y);
+
+      m_tau->set(tau);
+      m_k = 0.0;
+      NewtonSolver(m_equ, m_k, jacinv);
+
+      ASC_ODE_STATS_ADD(jacobian_evals, m_stages);
+      for (int i = 0; i < m_stages; i++)
+        {
+          ystage = y;
+          for (int j = 0; j < m_stages; j++)
+            ystage += tau * m_a(i,j) * m_k.range(j*m_n, (j+1)*m_n);
+          auto rhsi = rhsk.rows(i*n, (i+1)*n);
+          rhs->evaluateParamDeriv(ystage, rhsi);
+          rhs->evaluateDeriv(ystage, fy);
+          rhsi += fy * s;
+        }
+      dk = jacinv * rhsk;
+
+      for (int j = 0; j < m_stages; j++)
+        {
+          y += tau * m_b(j) * m_k.range(j*m_n, (j+1)*m_n);
+          s += tau * m_b(j) * dk.rows(j*n, (j+1)*n);
+        }
+    }
+
+    // mu = J^-T (tau b_j lambda)_j,  lambda_old = lambda + sum_i f_y(Y_i)^T mu_i
+    void doStepAdjoint(double tau, VectorView<double> y, VectorView<double> lambda,
+                       VectorView<double> grad) override
+    {
+      auto rhs = parameterizedRhs();
+      size_t n = m_n;
+      Matrix<> jacinv(m_stages*n, m_stages*n);
+      Matrix<> fy(n, n);
+      Vector<> w(m_stages*n), mu(m_stages*n), ystage(n), tmp(n), lambdaold(n);
+
+      ASC_ODE_STATS_ADD(steps, 1);
+      for (int j = 0; j < m_stages; j++)
+        m_y.range(j*m_n, (j+1)*m_n) = y;
+      m_yold->set(m_y);
+
+      m_tau->set(tau);
+      m_k = 0.0;
+      NewtonSolver(m_equ, m_k, jacinv);
+
+      for (int j = 0; j < m_stages; j++)
+        w.range(j*n, (j+1)*n) = tau * m_b(j) * lambda;
+      MultTrans(jacinv, w, mu);
+
+      lambdaold = lambda;
+      ASC_ODE_STATS_ADD(jacobian_evals, m_stages);
+      for (int i = 0; i < m_stages; i++)
+        {
+          ystage = y;
+          for (int j = 0; j < m_stages; j++)
+            ystage += tau * m_a(i,j) * m_k.range(j*m_n, (j+1)*m_n);
+          rhs->evaluateDeriv(ystage, fy);
+          MultTrans(fy, mu.range(i*n, (i+1)*n), tmp);
+          lambdaold += tmp;
+          rhs->addParamDerivTrans(ystage, mu.range(i*n, (i+1)*n), grad);
+        }
+      lambda = lambdaold;
+
       for (int j = 0; j < m_stages; j++)
         y += tau * m_b(j) * m_k.range(j*m_n, (j+1)*m_n);
     }
@@ -54,18 +187,19 @@ namespace ASC_ode {
 
 
 
-Matrix<double> Gauss2a { { 0.25, 0.25 - sqrt(3)/6 }, { 0.25 + sqrt(3)/6, 0.25 } };
-Vector<> Gauss2b { 0.5, 0.5 };
-Vector<> Gauss2c { 0.5 - sqrt(3)/6, 0.5 + sqrt(3)/6 };
+// from the tableau registry
+inline const Matrix<double> & Gauss2a = Tableau(ButcherTableau::GAUSS, 2).a;
+inline const Vector<> & Gauss2b = Tableau(ButcherTableau::GAUSS, 2).b;
+inline const Vector<> & Gauss2c = Tableau(ButcherTableau::GAUSS, 2).c;
 
 
-Vector<> Gauss3c { 0.5 - sqrt(15)/10, 0.5, 0.5+sqrt(15)/10 };
+inline const Vector<> & Gauss3c = Tableau(ButcherTableau::GAUSS, 3).c;
 
 
 // codes from Numerical Recipes, https://numerical.recipes/book.html
 
 // Gauss integration on [0,1]
-void GaussLegendre(VectorView<> x, VectorView<> w)
+inline void GaussLegendre(VectorView<> x, VectorView<> w)
 // Given the lower and upper limits of integration x1 and x2, this routine returns arrays x[0..n-1]
 // and w[0..n-1] of length n, containing the abscissas and weights of the Gauss-Legendre n-point
 // quadrature formula.
@@ -104,7 +238,7 @@ void GaussLegendre(VectorView<> x, VectorView<> w)
   }
 
 
-void GaussJacobi (VectorView<> x, VectorView<> w, const double alf, const double bet)
+inline void GaussJacobi (VectorView<> x, VectorView<> w, const double alf, const double bet)
 // Given alf and bet, the parameters ˛ and ˇ of the Jacobi polynomials, this routine returns
 // arrays x[0..n-1] and w[0..n-1] containing the abscissas and weights of the n-point GaussJacobi quadrature formula. The largest abscissa is returned in x[0], the smallest in x[n-1].
 {
@@ -178,7 +312,7 @@ void GaussJacobi (VectorView<> x, VectorView<> w, const double alf, const double
 /*
   given Runge-Kutta nodes c, compute the coefficients a and b
 */
-auto computeABfromC (const Vector<> & c)
+inline auto computeABfromC (const Vector<> & c)
 {
   int s = c.size();
   Matrix<> M(s, s);
@@ -211,7 +345,7 @@ auto computeABfromC (const Vector<> & c)
 }
   
 
-void GaussRadau (VectorView<> x, VectorView<> w)
+inline void GaussRadau (VectorView<> x, VectorView<> w)
 {
   GaussJacobi (x.range(0, x.size()-1),
                w.range(0, w.size()-1), 1, 0);
@@ -3,10 +3,13 @@
 
 #include <cstddef>
 #include <memory>
+#include <mutex>
 
 #include <vector.hpp>
 #include <matrix.hpp>
 
+#include "sparsity.hpp"
+
 namespace ASC_ode
 {
   using namespace nanoblas;
@@ -19,6 +22,117 @@ namespace ASC_ode
     virtual size_t dimF() const = 0;
     virtual void evaluate (VectorView<double> x, VectorView<double> f) const = 0;
     virtual void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const = 0;
+
+    // many states at once: the columns of X (dimX x n) are the states, the
+    // columns of F (dimF x n) the results. Rows are contiguous, so a
+    // component of all states can be processed in one vectorized loop.
+    virtual void evaluateBatch (MatrixView<double> X, MatrixView<double> F) const
+    {
+      Vector<> x(dimX()), f(dimF());
+      for (size_t j = 0; j < X.cols(); j++)
+        {
+          x = X.col(j);
+          evaluate(x, f);
+          F.col(j) = f;
+        }
+    }
+
+    // f and its Jacobian at once, worth overriding if both share work
+    virtual void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                                    MatrixView<double> df) const
+    {
+      evaluate(x, f);
+      evaluateDeriv(x, df);
+    }
+
+    // for a diagonal Jacobian: its diagonal at x in d, returns true.
+    // Affine maps like the Newmark predictors are diagonal, composing with
+    // them scales rows or columns instead of multiplying matrices.
+    virtual bool evaluateDiagDeriv (VectorView<double> x, VectorView<double> d) const
+    {
+      return false;
+    }
+
+    // structurally nonzero entries of the Jacobian, dense unless overridden
+    virtual SparsityPattern sparsity () const
+    {
+      return SparsityPattern::Dense(dimF(), dimX());
+    }
+
+    // counts the changes of sparsity(), e.g. when springs break or contacts
+    // appear, for caches of the pattern. Combined functions add the versions
+    // of their parts, which only grow.
+    virtual size_t sparsityVersion () const { return 0; }
+
+    // sparsity() for the Jacobians of this function, shared by all of them
+    // and set up again only when sparsityVersion() changed
+    std::shared_ptr<const SparsityPattern> sharedSparsity () const
+    {
+      size_t version = sparsityVersion();
+      std::lock_guard<std::mutex> guard(m_patterncache.mutex);
+      if (!m_patterncache.pattern || m_patterncache.version != version)
+        {
+          m_patterncache.pattern = std::make_shared<const SparsityPattern>(sparsity());
+          m_patterncache.version = version;
+        }
+      return m_patterncache.pattern;
+    }
+
+    // the Jacobian in compressed storage, df has the pattern sparsity().
+    // Patterns depending on the state (e.g. contacts) may have changed
+    // since df was set up, entries outside its pattern are dropped.
+    // The default picks the entries from the dense Jacobian.
+    virtual void evaluateDerivSparse (VectorView<double> x, SparseMatrix & df) const
+    {
+      Matrix<> dense(dimF(), dimX());
+      evaluateDeriv(x, dense);
+      df.fromDense(dense);
+    }
+
+  private:
+    // copies of a function start without a pattern
+    struct PatternCache
+    {
+      std::mutex mutex;
+      std::shared_ptr<const SparsityPattern> pattern;
+      size_t version = 0;
+      PatternCache () = default;
+      PatternCache (const PatternCache &) { }
+      PatternCache & operator= (const PatternCache &) { return *this; }
+    };
+    mutable PatternCache m_patterncache;
+  };
+
+
+  // y = a^T x
+  inline void MultTrans (MatrixView<double> a, VectorView<double> x, VectorView<double> y)
+  {
+    y = 0.0;
+    for (size_t i = 0; i < a.rows(); i++)
+      for (size_t j = 0; j < a.cols(); j++)
+        y(j) += a(i,j) * x(i);
+  }
+
+
+  // f(x; p) which also provides the derivative by its parameters p,
+  // needed for forward and adjoint sensitivities
+  class ParameterizedFunction : public NonlinearFunction
+  {
+  public:
+    virtual size_t numParams() const = 0;
+    // df has dimension dimF x numParams
+    virtual void evaluateParamDeriv (VectorView<double> x, MatrixView<double> df) const = 0;
+
+    // g += df^T w, worth overriding for many parameters
+    virtual void addParamDerivTrans (VectorView<double> x, VectorView<double> w,
+                                     VectorView<double> g) const
+    {
+      Matrix<> df(dimF(), numParams());
+      Vector<> tmp(numParams());
+      evaluateParamDeriv (x, df);
+      MultTrans (df, w, tmp);
+      g += tmp;
+    }
   };
 
 
@@ -33,12 +147,26 @@ namespace ASC_ode
     {
       f = x;
     }
+    void evaluateBatch (MatrixView<double> X, MatrixView<double> F) const override
+    {
+      F = X;
+    }
 
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
       df = 0.0;
       df.diag() = 1.0;
     }
+    bool evaluateDiagDeriv (VectorView<double> x, VectorView<double> d) const override
+    {
+      d = 1.0;
+      return true;
+    }
+    SparsityPattern sparsity () const override { return SparsityPattern::Diagonal(m_n); }
+    void evaluateDerivSparse (VectorView<double> x, SparseMatrix & df) const override
+    {
+      df = 1.0;
+    }
   };
 
   class DiagMatrixFunction : public NonlinearFunction
@@ -55,6 +183,11 @@ namespace ASC_ode
       for (size_t i = 0; i < m_val.size(); i++)
         f(i) = m_val(i) * x(i);
     }
+    void evaluateBatch (MatrixView<double> X, MatrixView<double> F) const override
+    {
+      for (size_t i = 0; i < m_val.size(); i++)
+        F.row(i) = m_val(i) * X.row(i);
+    }
 
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
@@ -62,6 +195,17 @@ namespace ASC_ode
       for (size_t i = 0; i < m_val.size(); i++)
         df(i,i) = m_val(i);
     }
+    bool evaluateDiagDeriv (VectorView<double> x, VectorView<double> d) const override
+    {
+      d = m_val;
+      return true;
+    }
+    SparsityPattern sparsity () const override { return SparsityPattern::Diagonal(m_val.size()); }
+    void evaluateDerivSparse (VectorView<double> x, SparseMatrix & df) const override
+    {
+      for (size_t i = 0; i < m_val.size(); i++)
+        df.value(i) = m_val(i);
+    }
   };
 
   class ConstantFunction : public NonlinearFunction
@@ -78,10 +222,22 @@ namespace ASC_ode
     {
       f = m_val;
     }
+    void evaluateBatch (MatrixView<double> X, MatrixView<double> F) const override
+    {
+      for (size_t i = 0; i < m_val.size(); i++)
+        F.row(i) = m_val(i);
+    }
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
       df = 0.0;
     }
+    bool evaluateDiagDeriv (VectorView<double> x, VectorView<double> d) const override
+    {
+      d = 0.0;
+      return true;
+    }
+    SparsityPattern sparsity () const override { return SparsityPattern(dimF(), dimX()); }
+    void evaluateDerivSparse (VectorView<double> x, SparseMatrix & df) const override { }
   };
 
   
@@ -106,6 +262,14 @@ namespace ASC_ode
       m_fb->evaluate(x, tmp);
       f += m_facb*tmp;
     }
+    void evaluateBatch (MatrixView<double> X, MatrixView<double> F) const override
+    {
+      m_fa->evaluateBatch(X, F);
+      F *= m_faca;
+      Matrix<double> tmp(dimF(), X.cols());
+      m_fb->evaluateBatch(X, tmp);
+      F += m_facb*tmp;
+    }
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
       m_fa->evaluateDeriv(x, df);
@@ -114,6 +278,44 @@ namespace ASC_ode
       m_fb->evaluateDeriv(x, tmp);
       df += m_facb*tmp;
     }
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      m_fa->evaluateWithDeriv(x, f, df);
+      f *= m_faca;
+      df *= m_faca;
+      Vector<> tmpf(dimF());
+      Matrix<double> tmp(dimF(), dimX());
+      m_fb->evaluateWithDeriv(x, tmpf, tmp);
+      f += m_facb*tmpf;
+      df += m_facb*tmp;
+    }
+    bool evaluateDiagDeriv (VectorView<double> x, VectorView<double> d) const override
+    {
+      Vector<> tmp(d.size());
+      if (!m_fa->evaluateDiagDeriv(x, d) || !m_fb->evaluateDiagDeriv(x, tmp))
+        return false;
+      d *= m_faca;
+      d += m_facb*tmp;
+      return true;
+    }
+    SparsityPattern sparsity () const override
+    {
+      return Union(*m_fa->sharedSparsity(), *m_fb->sharedSparsity());
+    }
+    size_t sparsityVersion () const override
+    {
+      return m_fa->sparsityVersion() + m_fb->sparsityVersion();
+    }
+    void evaluateDerivSparse (VectorView<double> x, SparseMatrix & df) const override
+    {
+      SparseMatrix jaca(m_fa->sharedSparsity()), jacb(m_fb->sharedSparsity());
+      m_fa->evaluateDerivSparse(x, jaca);
+      m_fb->evaluateDerivSparse(x, jacb);
+      df = 0.0;
+      df.add(m_faca, jaca);
+      df.add(m_facb, jacb);
+    }
   };
 
 
@@ -152,12 +354,37 @@ namespace ASC_ode
       m_fa->evaluate(x, f);
       f *= m_fac->get();
    }
+    void evaluateBatch (MatrixView<double> X, MatrixView<double> F) const override
+    {
+      m_fa->evaluateBatch(X, F);
+      F *= m_fac->get();
+    }
 
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
       m_fa->evaluateDeriv(x, df);
       df *= m_fac->get();
     }
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      m_fa->evaluateWithDeriv(x, f, df);
+      f *= m_fac->get();
+      df *= m_fac->get();
+    }
+    bool evaluateDiagDeriv (VectorView<double> x, VectorView<double> d) const override
+    {
+      if (!m_fa->evaluateDiagDeriv(x, d)) return false;
+      d *= m_fac->get();
+      return true;
+    }
+    SparsityPattern sparsity () const override { return *m_fa->sharedSparsity(); }
+    size_t sparsityVersion () const override { return m_fa->sparsityVersion(); }
+    void evaluateDerivSparse (VectorView<double> x, SparseMatrix & df) const override
+    {
+      m_fa->evaluateDerivSparse(x, df);
+      df *= m_fac->get();
+    }
   };
 
   inline auto operator* (std::shared_ptr<Parameter> parama, 
@@ -178,6 +405,60 @@ namespace ASC_ode
   class ComposeFunction : public NonlinearFunction
   {
     std::shared_ptr<NonlinearFunction> m_fa, m_fb;
+
+    // chain rule, f = fa(fb(x)) only if withf. The inner function is
+    // evaluated once, a diagonal factor scales columns or rows of the other.
+    void chainRule (VectorView<double> x, VectorView<double> f, MatrixView<double> df,
+                    bool withf) const
+    {
+      Vector<> tmp(m_fb->dimF());
+      if (m_fb->dimF() == m_fb->dimX())
+        {
+          Vector<> d(m_fb->dimF());
+          if (m_fb->evaluateDiagDeriv(x, d))
+            {
+              m_fb->evaluate (x, tmp);
+              bool zero = true;
+              for (size_t j = 0; j < d.size(); j++)
+                if (d(j) != 0) zero = false;
+              if (withf && zero)
+                m_fa->evaluate (tmp, f);
+              else if (withf)
+                m_fa->evaluateWithDeriv (tmp, f, df);
+              else if (!zero)
+                m_fa->evaluateDeriv (tmp, df);
+              if (zero)
+                df = 0.0;
+              else
+                for (size_t j = 0; j < d.size(); j++)
+                  df.col(j) *= d(j);
+              return;
+            }
+        }
+
+      Matrix<double> jacb(m_fb->dimF(), m_fb->dimX());
+      m_fb->evaluateWithDeriv (x, tmp, jacb);
+      if (m_fa->dimF() == m_fa->dimX())
+        {
+          Vector<> d(m_fa->dimF());
+          if (m_fa->evaluateDiagDeriv(tmp, d))
+            {
+              if (withf)
+                m_fa->evaluate (tmp, f);
+              df = jacb;
+              for (size_t i = 0; i < d.size(); i++)
+                df.row(i) *= d(i);
+              return;
+            }
+        }
+
+      Matrix<double> jaca(m_fa->dimF(), m_fa->dimX());
+      if (withf)
+        m_fa->evaluateWithDeriv (tmp, f, jaca);
+      else
+        m_fa->evaluateDeriv (tmp, jaca);
+      df = jaca*jacb;
+    }
   public:
     ComposeFunction (std::shared_ptr<NonlinearFunction> fa,
                      std::shared_ptr<NonlinearFunction> fb)
@@ -191,18 +472,50 @@ namespace ASC_ode
       m_fb->evaluate (x, tmp);
       m_fa->evaluate (tmp, f);
     }
+    void evaluateBatch (MatrixView<double> X, MatrixView<double> F) const override
+    {
+      Matrix<double> tmp(m_fb->dimF(), X.cols());
+      m_fb->evaluateBatch (X, tmp);
+      m_fa->evaluateBatch (tmp, F);
+    }
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
+      chainRule (x, VectorView<double>(0, nullptr), df, false);
+    }
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      chainRule (x, f, df, true);
+    }
+    bool evaluateDiagDeriv (VectorView<double> x, VectorView<double> d) const override
+    {
+      if (m_fb->dimF() != m_fb->dimX()) return false;
+      Vector<> tmp(m_fb->dimF()), db(m_fb->dimF());
+      if (!m_fb->evaluateDiagDeriv(x, db)) return false;
+      m_fb->evaluate (x, tmp);
+      if (!m_fa->evaluateDiagDeriv(tmp, d)) return false;
+      for (size_t i = 0; i < d.size(); i++)
+        d(i) *= db(i);
+      return true;
+    }
+    SparsityPattern sparsity () const override
+    {
+      return Product(*m_fa->sharedSparsity(), *m_fb->sharedSparsity());
+    }
+    size_t sparsityVersion () const override
+    {
+      return m_fa->sparsityVersion() + m_fb->sparsityVersion();
+    }
+    void evaluateDerivSparse (VectorView<double> x, SparseMatrix & df) const override
+    {
+      if (df.nnz() == 0) return;     // e.g. a constant inner function
       Vector<> tmp(m_fb->dimF());
       m_fb->evaluate (x, tmp);
 
-      Matrix<double> jaca(m_fa->dimF(), m_fa->dimX());
-      Matrix<double> jacb(m_fb->dimF(), m_fb->dimX());
-
-      m_fb->evaluateDeriv(x, jacb);
-      m_fa->evaluateDeriv(tmp, jaca);
-
-      df = jaca*jacb;
+      SparseMatrix jaca(m_fa->sharedSparsity()), jacb(m_fb->sharedSparsity());
+      m_fb->evaluateDerivSparse(x, jacb);
+      m_fa->evaluateDerivSparse(tmp, jaca);
+      Multiply(jaca, jacb, df);
     }
   };
   
@@ -233,12 +546,34 @@ namespace ASC_ode
       f = 0.0;
       m_fa->evaluate(x.range(m_firstx, m_nextx), f.range(m_firstf, m_nextf));
     }
+    void evaluateBatch (MatrixView<double> X, MatrixView<double> F) const override
+    {
+      F = 0.0;
+      m_fa->evaluateBatch(X.rows(m_firstx, m_nextx), F.rows(m_firstf, m_nextf));
+    }
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
       df = 0;
       m_fa->evaluateDeriv(x.range(m_firstx, m_nextx),
                         df.rows(m_firstf, m_nextf).cols(m_firstx, m_nextx));
     }
+    SparsityPattern sparsity () const override
+    {
+      return Embed(*m_fa->sharedSparsity(), m_dimf, m_dimx, m_firstf, m_firstx);
+    }
+    size_t sparsityVersion () const override { return m_fa->sparsityVersion(); }
+    // the embedded pattern keeps the order of the entries: df with the
+    // shared pattern gets them copied, others (e.g. set up before the one
+    // of fa changed) by row and column
+    void evaluateDerivSparse (VectorView<double> x, SparseMatrix & df) const override
+    {
+      SparseMatrix jac(m_fa->sharedSparsity());
+      m_fa->evaluateDerivSparse(x.range(m_firstx, m_nextx), jac);
+      if (df.sharedPattern() == sharedSparsity() && jac.sharedPattern() == m_fa->sharedSparsity())
+        std::copy (jac.values(), jac.values()+jac.nnz(), df.values());
+      else
+        df.assignBlock (jac, m_firstf, m_firstx);
+    }
   };
 
   
@@ -257,11 +592,30 @@ namespace ASC_ode
       f = 0.0;
       f.range(m_first, m_next) = x.range(m_first, m_next);
     }
+    void evaluateBatch (MatrixView<double> X, MatrixView<double> F) const override
+    {
+      F = 0.0;
+      F.rows(m_first, m_next) = X.rows(m_first, m_next);
+    }
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
       df = 0.0;
       df.diag().range(m_first, m_next) = 1;
     }
+    bool evaluateDiagDeriv (VectorView<double> x, VectorView<double> d) const override
+    {
+      d = 0.0;
+      d.range(m_first, m_next) = 1.0;
+      return true;
+    }
+    SparsityPattern sparsity () const override
+    {
+      return SparsityPattern::Diagonal(m_size, m_size, m_first, m_next);
+    }
+    void evaluateDerivSparse (VectorView<double> x, SparseMatrix & df) const override
+    {
+      df = 1.0;
+    }
   };
 
   
@@ -285,6 +639,12 @@ namespace ASC_ode
         func->evaluate(x.range(i*fdimx, (i+1)*fdimx),
                        f.range(i*fdimf, (i+1)*fdimf));
     }
+    virtual void evaluateBatch (MatrixView<double> X, MatrixView<double> F) const override
+    {
+      for (size_t i = 0; i < num; i++)
+        func->evaluateBatch(X.rows(i*fdimx, (i+1)*fdimx),
+                            F.rows(i*fdimf, (i+1)*fdimf));
+    }
     virtual void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
       df = 0.0;
@@ -292,8 +652,129 @@ namespace ASC_ode
         func->evaluateDeriv(x.range(i*fdimx, (i+1)*fdimx),
                             df.rows(i*fdimf, (i+1)*fdimf).cols(i*fdimx, (i+1)*fdimx));
     }
+    virtual SparsityPattern sparsity () const override
+    {
+      return BlockDiagonal(*func->sharedSparsity(), num);
+    }
+    virtual size_t sparsityVersion () const override { return func->sparsityVersion(); }
+    // block i has the entries i*nnz ... (i+1)*nnz-1 of the shared pattern,
+    // other patterns (e.g. from before the one of func changed) are filled
+    // by row and column
+    virtual void evaluateDerivSparse (VectorView<double> x, SparseMatrix & df) const override
+    {
+      SparseMatrix jac(func->sharedSparsity());
+      for (size_t i = 0; i < num; i++)
+        {
+          func->evaluateDerivSparse(x.range(i*fdimx, (i+1)*fdimx), jac);
+          if (df.sharedPattern() == sharedSparsity() && jac.sharedPattern() == func->sharedSparsity())
+            std::copy (jac.values(), jac.values()+jac.nnz(), df.values()+i*jac.nnz());
+          else
+            df.assignBlock (jac, i*fdimf, i*fdimx);
+        }
+    }
+  };
+
+
+  // y' = (v, a(x)) for y = (x, v). Without velocity the first block is 0,
+  // e.g. for the explicit part of a splitting. The parameters are the ones
+  // of a, if it is a ParameterizedFunction.
+  class FirstOrderFunction : public ParameterizedFunction
+  {
+    std::shared_ptr<NonlinearFunction> m_acc;
+    std::shared_ptr<ParameterizedFunction> m_pacc;
+    bool m_velocity;
+    size_t m_n;
+  public:
+    FirstOrderFunction (std::shared_ptr<NonlinearFunction> acc, bool velocity)
+      : m_acc(acc), m_pacc(std::dynamic_pointer_cast<ParameterizedFunction>(acc)),
+        m_velocity(velocity), m_n(acc->dimX()) { }
+
+    size_t dimX() const override { return 2*m_n; }
+    size_t dimF() const override { return 2*m_n; }
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      if (m_velocity)
+        f.range(0, m_n) = x.range(m_n, 2*m_n);
+      else
+        f.range(0, m_n) = 0.0;
+      m_acc->evaluate(x.range(0, m_n), f.range(m_n, 2*m_n));
+    }
+    void evaluateBatch (MatrixView<double> X, MatrixView<double> F) const override
+    {
+      if (m_velocity)
+        F.rows(0, m_n) = X.rows(m_n, 2*m_n);
+      else
+        F.rows(0, m_n) = 0.0;
+      m_acc->evaluateBatch(X.rows(0, m_n), F.rows(m_n, 2*m_n));
+    }
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      df = 0.0;
+      if (m_velocity)
+        df.rows(0, m_n).cols(m_n, 2*m_n).diag() = 1.0;
+      m_acc->evaluateDeriv(x.range(0, m_n), df.rows(m_n, 2*m_n).cols(0, m_n));
+    }
+    // the identity block (rows 0 ... n-1) comes before the entries of a
+    SparsityPattern sparsity () const override
+    {
+      return pattern(*m_acc->sharedSparsity());
+    }
+    SparsityPattern pattern (const SparsityPattern & accpattern) const
+    {
+      auto acc = Embed(accpattern, 2*m_n, 2*m_n, m_n, 0);
+      if (!m_velocity) return acc;
+      std::vector<size_t> first(2*m_n+1), colind;
+      for (size_t i = 0; i < m_n; i++)
+        {
+          first[i] = i;
+          colind.push_back(m_n+i);
+        }
+      for (size_t i = m_n; i <= 2*m_n; i++)
+        first[i] = m_n + acc.first(i);
+      for (size_t k = 0; k < acc.nnz(); k++)
+        colind.push_back(acc.col(k));
+      return SparsityPattern(2*m_n, 2*m_n, std::move(first), std::move(colind));
+    }
+    size_t sparsityVersion () const override { return m_acc->sparsityVersion(); }
+    // by position for the shared pattern, else by row and column (e.g. the
+    // pattern of a changed since df was set up)
+    void evaluateDerivSparse (VectorView<double> x, SparseMatrix & df) const override
+    {
+      SparseMatrix jac(m_acc->sharedSparsity());
+      m_acc->evaluateDerivSparse(x.range(0, m_n), jac);
+      size_t offset = m_velocity ? m_n : 0;
+      if (df.sharedPattern() == sharedSparsity() && jac.sharedPattern() == m_acc->sharedSparsity())
+        {
+          std::fill (df.values(), df.values()+offset, 1.0);
+          std::copy (jac.values(), jac.values()+jac.nnz(), df.values()+offset);
+          return;
+        }
+      for (size_t i = 0; i < m_n && m_velocity; i++)
+        df.value(df.pattern().first(i)) = 1.0;
+      df.assignBlock (jac, m_n, 0);
+    }
+
+    size_t numParams() const override { return m_pacc ? m_pacc->numParams() : 0; }
+    void evaluateParamDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      df = 0.0;
+      if (m_pacc)
+        m_pacc->evaluateParamDeriv(x.range(0, m_n), df.rows(m_n, 2*m_n));
+    }
+    void addParamDerivTrans (VectorView<double> x, VectorView<double> w,
+                             VectorView<double> g) const override
+    {
+      if (m_pacc)
+        m_pacc->addParamDerivTrans(x.range(0, m_n), w.range(m_n, 2*m_n), g);
+    }
   };
 
+  inline std::shared_ptr<NonlinearFunction> FirstOrderSystem (std::shared_ptr<NonlinearFunction> acc,
+                                                              bool velocity = true)
+  {
+    return std::make_shared<FirstOrderFunction>(acc, velocity);
+  }
+
 
   class MatVecFunc : public NonlinearFunction
   {
@@ -311,6 +792,14 @@ namespace ASC_ode
       MatrixView<double> mf(m_a.rows(), m_n, m_n, f.data());
       mf = m_a * mx;
     }
+    virtual void evaluateBatch (MatrixView<double> X, MatrixView<double> F) const override
+    {
+      F = 0.0;
+      for (size_t i = 0; i < m_a.rows(); i++)
+        for (size_t k = 0; k < m_a.cols(); k++)
+          for (size_t l = 0; l < m_n; l++)
+            F.row(i*m_n+l) += m_a(i,k) * X.row(k*m_n+l);
+    }
     virtual void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
       df = 0.0;
@@ -318,6 +807,31 @@ namespace ASC_ode
         for (size_t j = 0; j < m_a.cols(); j++)
           df.rows(i*m_n, (i+1)*m_n).cols(j*m_n, (j+1)*m_n).diag() = m_a(i,j);
     }
+    // the blocks a_ij I for the nonzero a_ij
+    virtual SparsityPattern sparsity () const override
+    {
+      size_t rows = m_a.rows()*m_n;
+      std::vector<size_t> first(rows+1), colind;
+      for (size_t i = 0; i < m_a.rows(); i++)
+        for (size_t l = 0; l < m_n; l++)
+          {
+            first[i*m_n+l] = colind.size();
+            for (size_t j = 0; j < m_a.cols(); j++)
+              if (m_a(i,j) != 0)
+                colind.push_back(j*m_n+l);
+          }
+      first[rows] = colind.size();
+      return SparsityPattern(rows, m_a.cols()*m_n, std::move(first), std::move(colind));
+    }
+    virtual void evaluateDerivSparse (VectorView<double> x, SparseMatrix & df) const override
+    {
+      size_t k = 0;
+      for (size_t i = 0; i < m_a.rows(); i++)
+        for (size_t l = 0; l < m_n; l++)
+          for (size_t j = 0; j < m_a.cols(); j++)
+            if (m_a(i,j) != 0)
+              df.value(k++) = m_a(i,j);
+    }
   };
 
 }
@@ -0,0 +1,228 @@
+#ifndef PARAREAL_HPP
+#define PARAREAL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "timestepper.hpp"
+
+namespace ASC_ode
+{
+
+  // fixed set of worker threads, run() distributes tasks and waits for all
+  class ThreadPool
+  {
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_start, m_done;
+    std::function<void(size_t,size_t)> m_task;
+    size_t m_ntasks = 0;
+    std::atomic<size_t> m_next{0};
+    size_t m_running = 0;
+    size_t m_generation = 0;
+    bool m_stop = false;
+    std::exception_ptr m_error;    // first exception of the current run
+
+    void worker (size_t thread)
+    {
+      size_t generation = 0;
+      while (true)
+        {
+          {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_start.wait (lock, [&] { return m_stop || m_generation != generation; });
+            if (m_stop) return;
+            generation = m_generation;
+          }
+          // after an exception no further tasks are started
+          for (size_t task; (task = m_next++) < m_ntasks; )
+            try
+              {
+                m_task (task, thread);
+              }
+            catch (...)
+              {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_error) m_error = std::current_exception();
+                m_next = m_ntasks;
+              }
+          {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_running == 0)
+              m_done.notify_all();
+          }
+        }
+    }
+
+  public:
+    ThreadPool (size_t nthreads)
+    {
+      for (size_t i = 0; i < nthreads; i++)
+        m_threads.emplace_back ([this, i] { worker(i); });
+    }
+
+    ~ThreadPool()
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+      }
+      m_start.notify_all();
+      for (auto & t : m_threads) t.join();
+    }
+
+    size_t size() const { return m_threads.size(); }
+
+    // calls task(i, thread) for i < ntasks. If a task throws, the
+    // running tasks are finished and the first exception is rethrown.
+    void run (size_t ntasks, std::function<void(size_t,size_t)> task)
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_task = task;
+      m_ntasks = ntasks;
+      m_next = 0;
+      m_error = nullptr;
+      m_running = m_threads.size();
+      m_generation++;
+      m_start.notify_all();
+      m_done.wait (lock, [&] { return m_running == 0; });
+      if (m_error)
+        std::rethrow_exception (std::exchange (m_error, nullptr));
+    }
+  };
+
+
+
+  class PararealOptions
+  {
+  public:
+    size_t slices = 16;
+    int coarsesteps = 1;       // per slice
+    int finesteps = 100;       // per slice
+    double tol = 1e-8;         // on the relative change of the slice values
+    int maxiterations = 0;     // 0: slices, where Parareal equals the fine solver
+    size_t threads = 0;        // 0: hardware concurrency
+  };
+
+  class PararealReport
+  {
+  public:
+    int iterations = 0;
+    bool converged = false;
+    std::vector<double> changes;    // per iteration
+    double walltime = 0;            // seconds
+    double finetime = 0;            // one fine slice, averaged
+    double serialtime = 0;          // estimated fine solve without Parareal
+    double speedup = 0;
+  };
+
+
+  // Parareal for y' = f(y) on [0, tend]: the coarse stepper propagates
+  // sequentially, the fine one all slices in parallel. The factories are
+  // called once per thread, the steppers (and right hand sides) they
+  // create must not share mutable state.
+  inline PararealReport
+  SolveODE_Parareal (std::function<std::shared_ptr<TimeStepper>()> coarse,
+                     std::function<std::shared_ptr<TimeStepper>()> fine,
+                     double tend, VectorView<double> y, PararealOptions opts = PararealOptions())
+  {
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+
+    size_t nslices = opts.slices;
+    size_t nthreads = opts.threads ? opts.threads : std::max(1u, std::thread::hardware_concurrency());
+    int maxit = opts.maxiterations ? opts.maxiterations : int(nslices);
+    size_t n = y.size();
+    double dT = tend / nslices;
+
+    auto coarsestepper = coarse();
+    std::vector<std::shared_ptr<TimeStepper>> finesteppers;
+    for (size_t i = 0; i < nthreads; i++)
+      finesteppers.push_back (fine());
+
+    // u(i) value at T_i, g(i) coarse and f(i) fine propagation of u(i)
+    Matrix<> u(nslices+1, n), g(nslices, n), f(nslices, n);
+    Vector<> tmp(n);
+
+    auto propagate = [&] (TimeStepper & stepper, int steps, size_t slice, MatrixView<double> res)
+    {
+      VectorView<double> r = res.row(slice);
+      r = u.row(slice);
+      for (int s = 0; s < steps; s++)
+        stepper.doStep (dT/steps, r);
+    };
+
+    u.row(0) = y;
+    for (size_t i = 0; i < nslices; i++)
+      {
+        propagate (*coarsestepper, opts.coarsesteps, i, g);
+        u.row(i+1) = g.row(i);
+      }
+
+    PararealReport report;
+    ThreadPool pool(nthreads);
+    std::vector<double> slicetime(nslices, 0.0);
+    size_t nfine = 0;
+    double totalfine = 0;
+
+    // after iteration k the first k+1 slice values are exact
+    for (int k = 0; k < maxit; k++)
+      {
+        size_t first = k;
+        pool.run (nslices-first, [&] (size_t task, size_t thread)
+        {
+          auto t0 = clock::now();
+          propagate (*finesteppers[thread], opts.finesteps, first+task, f);
+          slicetime[first+task] = std::chrono::duration<double>(clock::now()-t0).count();
+        });
+        for (size_t i = first; i < nslices; i++)
+          totalfine += slicetime[i];
+        nfine += nslices-first;
+
+        // sequential correction  u_{i+1} = G(u_i^new) + F(u_i^old) - G(u_i^old)
+        // slice first starts from an exact value, its fine result is final
+        double change = 0, scale = 0;
+        for (size_t i = first; i < nslices; i++)
+          {
+            tmp = g.row(i);
+            if (i > first)
+              propagate (*coarsestepper, opts.coarsesteps, i, g);
+            for (size_t j = 0; j < n; j++)
+              {
+                double unew = g(i,j) + f(i,j) - tmp(j);
+                change = std::max(change, std::fabs (unew - u(i+1,j)));
+                scale = std::max(scale, std::fabs (unew));
+                u(i+1,j) = unew;
+              }
+          }
+        report.iterations = k+1;
+        report.changes.push_back (scale > 0 ? change/scale : change);
+        if (report.changes.back() < opts.tol || first+1 == nslices)
+          {
+            report.converged = true;
+            break;
+          }
+      }
+
+    y = u.row(nslices);
+
+    report.walltime = std::chrono::duration<double>(clock::now()-start).count();
+    report.finetime = nfine ? totalfine / nfine : 0;
+    report.serialtime = report.finetime * nslices;
+    report.speedup = report.walltime > 0 ? report.serialtime / report.walltime : 0;
+    return report;
+  }
+
+}
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef ROSENBROCK_HPP
+#define ROSENBROCK_HPP
+
+#include <cmath>
+#include <stdexcept>
+
+#include "timestepper.hpp"
+
+namespace ASC_ode
+{
+
+  // Rosenbrock (linearly implicit Runge-Kutta) method in the form of
+  // Hairer-Wanner (IV.7.25), which needs no products with the Jacobian:
+  //   (I/(tau gamma) - J) U_i = f(y + sum_j a_ij U_j) + sum_j c_ij/tau U_j
+  //   y_new = y + sum_i m_i U_i
+  // J = f'(y) is evaluated and LU factorized once per step, the stages
+  // share the factors and only solve.
+  class Rosenbrock : public TimeStepper
+  {
+    double m_gamma;
+    Matrix<> m_a, m_c;
+    Vector<> m_m;
+    int m_stages;
+    size_t m_n;
+    Matrix<> m_jac;
+    Vector<> m_u, m_ystage, m_f;
+  public:
+    Rosenbrock(std::shared_ptr<NonlinearFunction> rhs, double gamma,
+               const Matrix<> &a, const Matrix<> &c, const Vector<> &m)
+      : TimeStepper(rhs), m_gamma(gamma), m_a(a), m_c(c), m_m(m),
+        m_stages(m.size()), m_n(rhs->dimX()), m_jac(m_n, m_n),
+        m_u(m_stages*m_n), m_ystage(m_n), m_f(m_n)
+    {
+      if (gamma <= 0)
+        throw std::invalid_argument("Rosenbrock: gamma must be positive");
+    }
+
+    void doStep(double tau, VectorView<double> y) override
+    {
+      ASC_ODE_STATS_ADD(steps, 1);
+      {
+        ASC_ODE_STATS_TIMER(time_jacobian);
+        ASC_ODE_STATS_ADD(jacobian_evals, 1);
+        this->m_rhs->evaluateDeriv(y, m_jac);
+      }
+      m_jac *= -1.0;
+      for (size_t i = 0; i < m_n; i++)
+        m_jac(i,i) += 1.0 / (tau*m_gamma);
+      ASC_ODE_STATS_ADD(factorizations, 1);
+      auto lu = [&]
+      {
+        ASC_ODE_STATS_TIMER(time_factorization);
+        return LapackLU(m_jac);
+      }();
+
+      for (int i = 0; i < m_stages; i++)
+        {
+          m_ystage = y;
+          for (int j = 0; j < i; j++)
+            if (m_a(i,j) != 0)
+              m_ystage += m_a(i,j) * m_u.range(j*m_n, (j+1)*m_n);
+          {
+            ASC_ODE_STATS_TIMER(time_function);
+            ASC_ODE_STATS_ADD(function_evals, 1);
+            this->m_rhs->evaluate(m_ystage, m_f);
+          }
+          for (int j = 0; j < i; j++)
+            if (m_c(i,j) != 0)
+              m_f += (m_c(i,j)/tau) * m_u.range(j*m_n, (j+1)*m_n);
+          auto ui = m_u.range(i*m_n, (i+1)*m_n);
+          ui = m_f;
+          lu.solve(ui);
+        }
+
+      for (int i = 0; i < m_stages; i++)
+        if (m_m(i) != 0)
+          y += m_m(i) * m_u.range(i*m_n, (i+1)*m_n);
+    }
+  };
+
+
+
+  // Verwer, Spee, Blom, Hundsdorfer (1999): second order, L-stable,
+  // also of order two with an approximate Jacobian (W-method)
+  inline std::shared_ptr<Rosenbrock> ROS2 (std::shared_ptr<NonlinearFunction> rhs)
+  {
+    double gamma = 1 + 1/std::sqrt(2.0);
+    Matrix<> a(2, 2), c(2, 2);
+    a = 0.0;
+    c = 0.0;
+    a(1,0) = 1/gamma;
+    c(1,0) = -2/gamma;
+    Vector<> m = { 1.5/gamma, 0.5/gamma };
+    return std::make_shared<Rosenbrock>(rhs, gamma, a, c, m);
+  }
+
+  // Lang, Verwer (2001): third order, A-stable, no order reduction for
+  // parabolic problems
+  inline std::shared_ptr<Rosenbrock> ROS3P (std::shared_ptr<NonlinearFunction> rhs)
+  {
+    double gamma = 0.5 + std::sqrt(3.0)/6;
+    Matrix<> a(3, 3), c(3, 3);
+    a = 0.0;
+    c = 0.0;
+    a(1,0) = 1/gamma;
+    a(2,0) = 1/gamma;
+    c(1,0) = -1.607695154586736;
+    c(2,0) = -3.464101615137755;
+    c(2,1) = -1.732050807568877;
+    Vector<> m = { 2, 0.5773502691896258, 0.4226497308103742 };
+    return std::make_shared<Rosenbrock>(rhs, gamma, a, c, m);
+  }
+
+  // Hairer, Wanner: the fourth order method of RODAS, stiffly accurate
+  // and L-stable
+  inline std::shared_ptr<Rosenbrock> RODAS4 (std::shared_ptr<NonlinearFunction> rhs)
+  {
+    Matrix<> a(6, 6), c(6, 6);
+    a = 0.0;
+    c = 0.0;
+    a(1,0) = 1.544;
+    a(2,0) = 0.9466785280815826;  a(2,1) = 0.2557011698983284;
+    a(3,0) = 3.314825187068521;   a(3,1) = 2.896124015972201;   a(3,2) = 0.9986419139977817;
+    a(4,0) = 1.221224509226641;   a(4,1) = 6.019134481288629;   a(4,2) = 12.53708332932087;
+    a(4,3) = -0.6878860361058950;
+    for (int j = 0; j < 4; j++)
+      a(5,j) = a(4,j);
+    a(5,4) = 1;
+
+    c(1,0) = -5.6688;
+    c(2,0) = -2.430093356833875;  c(2,1) = -0.2063599157091915;
+    c(3,0) = -0.1073529058151375; c(3,1) = -9.594562251023355;  c(3,2) = -20.47028614809616;
+    c(4,0) = 7.496443313967647;   c(4,1) = -10.24680431464352;  c(4,2) = -33.99990352819905;
+    c(4,3) = 11.70890893206160;
+    c(5,0) = 8.083246795921522;   c(5,1) = -7.981132988064893;  c(5,2) = -31.52159432874371;
+    c(5,3) = 16.31930543123136;   c(5,4) = -6.058818238834054;
+
+    // stiffly accurate: y_new is the last stage value plus U_6
+    Vector<> m(6);
+    for (int j = 0; j < 5; j++)
+      m(j) = a(5,j);
+    m(5) = 1;
+    return std::make_shared<Rosenbrock>(rhs, 0.25, a, c, m);
+  }
+
+}
+
+#endif
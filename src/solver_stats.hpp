@@ -0,0 +1,91 @@
+#ifndef SOLVER_STATS_HPP
+#define SOLVER_STATS_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+
+// Counters and timers of the solvers, collected per thread.
+// Without ASC_ODE_STATS defined all instrumentation compiles to nothing.
+
+namespace ASC_ode
+{
+  class SolverStats
+  {
+  public:
+    size_t function_evals = 0;       // residual / right hand side evaluations
+    size_t jacobian_evals = 0;
+    size_t factorizations = 0;
+    size_t newton_solves = 0;
+    size_t newton_iterations = 0;
+    size_t newton_max_iterations = 0; // maximum over all solves
+    size_t newton_failures = 0;
+    size_t linear_iterations = 0;    // iterative linear solvers
+    size_t steps = 0;
+    size_t rejected_steps = 0;
+    size_t alloc_bytes = 0;          // work memory allocated by the solvers
+
+    double time_function = 0;        // seconds
+    double time_jacobian = 0;
+    double time_factorization = 0;
+    double time_linear = 0;          // iterative linear solvers
+
+    void reset() { *this = SolverStats(); }
+
+    double newtonIterationsPerSolve() const
+    {
+      return newton_solves ? double(newton_iterations) / newton_solves : 0.0;
+    }
+  };
+
+  inline std::ostream & operator<< (std::ostream & ost, const SolverStats & s)
+  {
+    ost << "function evaluations : " << s.function_evals << " (" << s.time_function << " s)" << std::endl
+        << "jacobian evaluations : " << s.jacobian_evals << " (" << s.time_jacobian << " s)" << std::endl
+        << "factorizations       : " << s.factorizations << " (" << s.time_factorization << " s)" << std::endl
+        << "newton solves        : " << s.newton_solves << ", iterations " << s.newton_iterations
+        << " (avg " << s.newtonIterationsPerSolve() << ", max " << s.newton_max_iterations << ")"
+        << ", failures " << s.newton_failures << std::endl
+        << "linear iterations    : " << s.linear_iterations << " (" << s.time_linear << " s)" << std::endl
+        << "steps                : " << s.steps << ", rejected " << s.rejected_steps << std::endl
+        << "allocated bytes      : " << s.alloc_bytes << std::endl;
+    return ost;
+  }
+
+  inline SolverStats & solverStats()
+  {
+    static thread_local SolverStats stats;
+    return stats;
+  }
+
+  // adds the lifetime of the object to a timer
+  class StatsTimer
+  {
+    double & m_time;
+    std::chrono::steady_clock::time_point m_start;
+  public:
+    StatsTimer (double & time) : m_time(time), m_start(std::chrono::steady_clock::now()) { }
+    ~StatsTimer()
+    {
+      m_time += std::chrono::duration<double>(std::chrono::steady_clock::now()-m_start).count();
+    }
+  };
+}
+
+
+#ifdef ASC_ODE_STATS
+#define ASC_ODE_STATS_ADD(field, n) (ASC_ode::solverStats().field += (n))
+#define ASC_ODE_STATS_MAX(field, n) \
+  (ASC_ode::solverStats().field = std::max<size_t>(ASC_ode::solverStats().field, (n)))
+#define ASC_ODE_STATS_CONCAT_(a, b) a##b
+#define ASC_ODE_STATS_CONCAT(a, b) ASC_ODE_STATS_CONCAT_(a, b)
+#define ASC_ODE_STATS_TIMER(field) \
+  ASC_ode::StatsTimer ASC_ODE_STATS_CONCAT(stats_timer_, __LINE__) (ASC_ode::solverStats().field)
+#else
+#define ASC_ODE_STATS_ADD(field, n) ((void)0)
+#define ASC_ODE_STATS_MAX(field, n) ((void)0)
+#define ASC_ODE_STATS_TIMER(field) ((void)0)
+#endif
+
+#endif
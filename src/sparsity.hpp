@@ -0,0 +1,548 @@
+#ifndef SPARSITY_HPP
+#define SPARSITY_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <matrix.hpp>
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+  // structurally nonzero entries of a matrix in compressed row storage,
+  // the column indices of every row are sorted. A dense pattern stores no
+  // indices, entry k is (k / cols, k % cols).
+  class SparsityPattern
+  {
+    size_t m_rows = 0, m_cols = 0;
+    bool m_dense = false;
+    std::vector<size_t> m_first;     // row i has the entries m_first[i] ... m_first[i+1]-1
+    std::vector<size_t> m_colind;
+  public:
+    // no entries
+    SparsityPattern (size_t rows = 0, size_t cols = 0)
+      : m_rows(rows), m_cols(cols), m_first(rows+1, 0) { }
+
+    // compressed row storage, first has rows+1 entries
+    SparsityPattern (size_t rows, size_t cols,
+                     std::vector<size_t> first, std::vector<size_t> colind)
+      : m_rows(rows), m_cols(cols), m_first(std::move(first)), m_colind(std::move(colind))
+    {
+      if (m_first.size() != rows+1 || m_first.back() != m_colind.size())
+        throw std::invalid_argument("SparsityPattern: inconsistent row pointers");
+      for (size_t i = 0; i < rows; i++)
+        for (size_t k = m_first[i]; k < m_first[i+1]; k++)
+          if (m_colind[k] >= cols || (k > m_first[i] && m_colind[k] <= m_colind[k-1]))
+            throw std::invalid_argument("SparsityPattern: column indices must be sorted and in range");
+    }
+
+    // from the column indices of every row, unsorted and repeated ones allowed
+    SparsityPattern (size_t cols, const std::vector<std::vector<size_t>> & rowcols)
+      : m_rows(rowcols.size()), m_cols(cols), m_first(1, 0)
+    {
+      std::vector<size_t> row;
+      for (auto & r : rowcols)
+        {
+          row = r;
+          std::sort (row.begin(), row.end());
+          row.erase (std::unique (row.begin(), row.end()), row.end());
+          if (!row.empty() && row.back() >= cols)
+            throw std::invalid_argument("SparsityPattern: column index out of range");
+          m_colind.insert (m_colind.end(), row.begin(), row.end());
+          m_first.push_back (m_colind.size());
+        }
+    }
+
+    static SparsityPattern Dense (size_t rows, size_t cols)
+    {
+      SparsityPattern p(0, cols);
+      p.m_rows = rows;
+      p.m_dense = true;
+      p.m_first.clear();
+      return p;
+    }
+
+    // entries (i,i) for first <= i < next
+    static SparsityPattern Diagonal (size_t rows, size_t cols, size_t first, size_t next)
+    {
+      std::vector<size_t> rowfirst(rows+1), colind;
+      for (size_t i = 0; i < rows; i++)
+        {
+          rowfirst[i] = colind.size();
+          if (i >= first && i < next && i < cols)
+            colind.push_back(i);
+        }
+      rowfirst[rows] = colind.size();
+      return SparsityPattern(rows, cols, std::move(rowfirst), std::move(colind));
+    }
+
+    static SparsityPattern Diagonal (size_t n) { return Diagonal(n, n, 0, n); }
+
+    size_t rows () const { return m_rows; }
+    size_t cols () const { return m_cols; }
+    size_t nnz () const { return m_dense ? m_rows*m_cols : m_colind.size(); }
+    bool isDense () const { return m_dense || nnz() == m_rows*m_cols; }
+
+    // the entries of row i are first(i) ... next(i)-1
+    size_t first (size_t i) const { return m_dense ? i*m_cols : m_first[i]; }
+    size_t next (size_t i) const { return m_dense ? (i+1)*m_cols : m_first[i+1]; }
+    size_t col (size_t k) const { return m_dense ? k % m_cols : m_colind[k]; }
+
+    bool operator== (const SparsityPattern & p) const
+    {
+      if (m_rows != p.m_rows || m_cols != p.m_cols || nnz() != p.nnz())
+        return false;
+      if (isDense()) return true;
+      for (size_t i = 0; i < m_rows; i++)
+        if (first(i) != p.first(i)) return false;
+      for (size_t k = 0; k < nnz(); k++)
+        if (col(k) != p.col(k)) return false;
+      return true;
+    }
+
+    // index of (i,j) in the compressed storage, nnz() if not in the pattern
+    size_t position (size_t i, size_t j) const
+    {
+      if (m_dense) return i*m_cols+j;
+      auto begin = m_colind.begin()+m_first[i], end = m_colind.begin()+m_first[i+1];
+      auto it = std::lower_bound (begin, end, j);
+      return (it != end && *it == j) ? size_t(it-m_colind.begin()) : nnz();
+    }
+  };
+
+
+  // pattern of a + b
+  inline SparsityPattern Union (const SparsityPattern & a, const SparsityPattern & b)
+  {
+    if (a.rows() != b.rows() || a.cols() != b.cols())
+      throw std::invalid_argument("Union: patterns of different shape");
+    if (a.isDense() || b.isDense())
+      return SparsityPattern::Dense(a.rows(), a.cols());
+
+    std::vector<size_t> first(a.rows()+1), colind;
+    for (size_t i = 0; i < a.rows(); i++)
+      {
+        first[i] = colind.size();
+        size_t ka = a.first(i), kb = b.first(i);
+        while (ka < a.next(i) || kb < b.next(i))
+          {
+            if (kb == b.next(i) || (ka < a.next(i) && a.col(ka) < b.col(kb)))
+              colind.push_back(a.col(ka++));
+            else if (ka == a.next(i) || b.col(kb) < a.col(ka))
+              colind.push_back(b.col(kb++));
+            else
+              {
+                colind.push_back(a.col(ka++));
+                kb++;
+              }
+          }
+      }
+    first[a.rows()] = colind.size();
+    return SparsityPattern(a.rows(), a.cols(), std::move(first), std::move(colind));
+  }
+
+
+  // pattern of a * b
+  inline SparsityPattern Product (const SparsityPattern & a, const SparsityPattern & b)
+  {
+    if (a.cols() != b.rows())
+      throw std::invalid_argument("Product: patterns do not match");
+    size_t rows = a.rows(), cols = b.cols();
+
+    // with a dense factor the rows are all empty or all the same
+    if (a.isDense() || b.isDense())
+      {
+        std::vector<bool> used(cols, false);
+        if (b.isDense())
+          used.assign(cols, a.nnz() > 0);
+        else
+          for (size_t k = 0; k < b.nnz(); k++)
+            used[b.col(k)] = true;
+        std::vector<size_t> rowcols;
+        for (size_t j = 0; j < cols; j++)
+          if (used[j]) rowcols.push_back(j);
+        bool allrows = true;
+        for (size_t i = 0; i < rows; i++)
+          if (a.first(i) == a.next(i)) allrows = false;
+        if (allrows && rowcols.size() == cols)
+          return SparsityPattern::Dense(rows, cols);
+
+        std::vector<size_t> first(rows+1), colind;
+        for (size_t i = 0; i < rows; i++)
+          {
+            first[i] = colind.size();
+            if (a.first(i) != a.next(i))
+              colind.insert(colind.end(), rowcols.begin(), rowcols.end());
+          }
+        first[rows] = colind.size();
+        return SparsityPattern(rows, cols, std::move(first), std::move(colind));
+      }
+
+    std::vector<size_t> first(rows+1), colind, row;
+    std::vector<bool> marked(cols, false);
+    for (size_t i = 0; i < rows; i++)
+      {
+        first[i] = colind.size();
+        row.clear();
+        for (size_t ka = a.first(i); ka < a.next(i); ka++)
+          {
+            size_t r = a.col(ka);
+            for (size_t kb = b.first(r); kb < b.next(r); kb++)
+              if (!marked[b.col(kb)])
+                {
+                  marked[b.col(kb)] = true;
+                  row.push_back(b.col(kb));
+                }
+          }
+        std::sort (row.begin(), row.end());
+        for (size_t j : row) marked[j] = false;
+        colind.insert (colind.end(), row.begin(), row.end());
+      }
+    first[rows] = colind.size();
+    return SparsityPattern(rows, cols, std::move(first), std::move(colind));
+  }
+
+
+  // a placed at (firstrow, firstcol) of a rows x cols matrix. The
+  // compressed entries keep their order.
+  inline SparsityPattern Embed (const SparsityPattern & a, size_t rows, size_t cols,
+                                size_t firstrow, size_t firstcol)
+  {
+    if (firstrow+a.rows() > rows || firstcol+a.cols() > cols)
+      throw std::invalid_argument("Embed: pattern does not fit");
+    if (a.isDense() && a.rows() == rows && a.cols() == cols)
+      return a;
+
+    std::vector<size_t> first(rows+1), colind;
+    colind.reserve(a.nnz());
+    for (size_t i = 0; i < rows; i++)
+      {
+        first[i] = colind.size();
+        if (i >= firstrow && i < firstrow+a.rows())
+          for (size_t k = a.first(i-firstrow); k < a.next(i-firstrow); k++)
+            colind.push_back(firstcol + a.col(k));
+      }
+    first[rows] = colind.size();
+    return SparsityPattern(rows, cols, std::move(first), std::move(colind));
+  }
+
+
+  // num copies of a along the diagonal, copy b has the compressed
+  // entries b*a.nnz() ... (b+1)*a.nnz()-1
+  inline SparsityPattern BlockDiagonal (const SparsityPattern & a, size_t num)
+  {
+    if (num == 1) return a;
+    size_t rows = num*a.rows(), cols = num*a.cols();
+    std::vector<size_t> first(rows+1), colind;
+    colind.reserve(num*a.nnz());
+    for (size_t b = 0; b < num; b++)
+      for (size_t i = 0; i < a.rows(); i++)
+        {
+          first[b*a.rows()+i] = colind.size();
+          for (size_t k = a.first(i); k < a.next(i); k++)
+            colind.push_back(b*a.cols() + a.col(k));
+        }
+    first[rows] = colind.size();
+    return SparsityPattern(rows, cols, std::move(first), std::move(colind));
+  }
+
+
+
+  // values on a sparsity pattern, matrices of the same structure share it
+  class SparseMatrix
+  {
+    std::shared_ptr<const SparsityPattern> m_pattern;
+    std::vector<double> m_val;
+  public:
+    SparseMatrix () : m_pattern(std::make_shared<SparsityPattern>()) { }
+    SparseMatrix (SparsityPattern pattern)
+      : m_pattern(std::make_shared<const SparsityPattern>(std::move(pattern))),
+        m_val(m_pattern->nnz(), 0.0) { }
+    SparseMatrix (std::shared_ptr<const SparsityPattern> pattern)
+      : m_pattern(pattern), m_val(pattern->nnz(), 0.0) { }
+
+    const SparsityPattern & pattern () const { return *m_pattern; }
+    std::shared_ptr<const SparsityPattern> sharedPattern () const { return m_pattern; }
+    size_t rows () const { return m_pattern->rows(); }
+    size_t cols () const { return m_pattern->cols(); }
+    size_t nnz () const { return m_val.size(); }
+
+    double & value (size_t k) { return m_val[k]; }
+    double value (size_t k) const { return m_val[k]; }
+    double * values () { return m_val.data(); }
+    const double * values () const { return m_val.data(); }
+
+    // entry (i,j), zero outside the pattern
+    double operator() (size_t i, size_t j) const
+    {
+      size_t k = m_pattern->position(i, j);
+      return k < nnz() ? m_val[k] : 0.0;
+    }
+
+    SparseMatrix & operator= (double s)
+    {
+      std::fill (m_val.begin(), m_val.end(), s);
+      return *this;
+    }
+
+    SparseMatrix & operator*= (double s)
+    {
+      for (auto & v : m_val) v *= s;
+      return *this;
+    }
+
+    // this += s b, entries of b outside the pattern of this are dropped
+    // (e.g. b has the pattern of a function whose contacts changed)
+    void add (double s, const SparseMatrix & b)
+    {
+      auto & pa = *m_pattern, & pb = b.pattern();
+      if (pa.rows() != pb.rows() || pa.cols() != pb.cols())
+        throw std::invalid_argument("SparseMatrix::add: matrices of different shape");
+      if (m_pattern == b.m_pattern)
+        {
+          for (size_t k = 0; k < nnz(); k++)
+            m_val[k] += s * b.m_val[k];
+          return;
+        }
+      for (size_t i = 0; i < pa.rows(); i++)
+        {
+          size_t ka = pa.first(i);
+          for (size_t kb = pb.first(i); kb < pb.next(i); kb++)
+            {
+              while (ka < pa.next(i) && pa.col(ka) < pb.col(kb)) ka++;
+              if (ka < pa.next(i) && pa.col(ka) == pb.col(kb))
+                m_val[ka] += s * b.m_val[kb];
+            }
+        }
+    }
+
+    // this = b on the pattern of this: entries missing in b are zero,
+    // entries of b outside the pattern are dropped
+    void assign (const SparseMatrix & b)
+    {
+      auto & pa = *m_pattern, & pb = b.pattern();
+      if (pa.rows() != pb.rows() || pa.cols() != pb.cols())
+        throw std::invalid_argument("SparseMatrix::assign: matrices of different shape");
+      if (pa == pb)
+        m_val = b.m_val;
+      else
+        assignBlock (b, 0, 0);
+    }
+
+    // the same for the block starting at (firstrow, firstcol) of the size
+    // of b, by row and column: the patterns need not fit
+    void assignBlock (const SparseMatrix & b, size_t firstrow, size_t firstcol)
+    {
+      auto & pa = *m_pattern, & pb = b.pattern();
+      if (firstrow+pb.rows() > pa.rows() || firstcol+pb.cols() > pa.cols())
+        throw std::invalid_argument("SparseMatrix::assignBlock: block does not fit");
+      size_t nextcol = firstcol+pb.cols();
+      for (size_t i = 0; i < pb.rows(); i++)
+        {
+          size_t r = firstrow+i, kb = pb.first(i);
+          for (size_t ka = pa.first(r); ka < pa.next(r); ka++)
+            {
+              size_t c = pa.col(ka);
+              if (c < firstcol || c >= nextcol) continue;
+              while (kb < pb.next(i) && firstcol+pb.col(kb) < c) kb++;
+              m_val[ka] = (kb < pb.next(i) && firstcol+pb.col(kb) == c) ? b.m_val[kb] : 0.0;
+            }
+        }
+    }
+
+    // picks the entries of the pattern from a dense matrix
+    void fromDense (MatrixView<double> d)
+    {
+      auto & p = *m_pattern;
+      for (size_t i = 0; i < p.rows(); i++)
+        for (size_t k = p.first(i); k < p.next(i); k++)
+          m_val[k] = d(i, p.col(k));
+    }
+
+    void toDense (MatrixView<double> d) const
+    {
+      auto & p = *m_pattern;
+      d = 0.0;
+      for (size_t i = 0; i < p.rows(); i++)
+        for (size_t k = p.first(i); k < p.next(i); k++)
+          d(i, p.col(k)) = m_val[k];
+    }
+  };
+
+
+  // c = a * b, entries outside the pattern of c are dropped as in add
+  inline void Multiply (const SparseMatrix & a, const SparseMatrix & b, SparseMatrix & c)
+  {
+    auto & pa = a.pattern(), & pb = b.pattern(), & pc = c.pattern();
+    if (pa.cols() != pb.rows() || pc.rows() != pa.rows() || pc.cols() != pb.cols())
+      throw std::invalid_argument("Multiply: matrices do not match");
+
+    // position of column j in the current row of c
+    std::vector<size_t> pos(pc.cols(), pc.nnz());
+    c = 0.0;
+    for (size_t i = 0; i < pc.rows(); i++)
+      {
+        for (size_t k = pc.first(i); k < pc.next(i); k++)
+          pos[pc.col(k)] = k;
+        for (size_t ka = pa.first(i); ka < pa.next(i); ka++)
+          {
+            double aik = a.value(ka);
+            if (aik == 0) continue;
+            size_t r = pa.col(ka);
+            for (size_t kb = pb.first(r); kb < pb.next(r); kb++)
+              {
+                size_t k = pos[pb.col(kb)];
+                if (k < pc.nnz())
+                  c.value(k) += aik * b.value(kb);
+              }
+          }
+        for (size_t k = pc.first(i); k < pc.next(i); k++)
+          pos[pc.col(k)] = pc.nnz();
+      }
+  }
+
+
+  // LU factors of a square sparse matrix in compressed rows, a Q = L U
+  // with the column permutation Q from partial pivoting. The rows are
+  // eliminated one after the other against the rows before, the pivot of
+  // a row is its largest entry in a column not used yet. The diagonal is
+  // preferred if it is within a factor 10 of it, this keeps the fill-in
+  // of (nearly) symmetric patterns low. Zero diagonals as of joints are
+  // fine, there is no reordering.
+  class SparseLU
+  {
+    size_t m_n;
+    std::vector<size_t> m_lfirst, m_lcol;     // L(i, m_lcol[k]) for m_lfirst[i] <= k < m_lfirst[i+1]
+    std::vector<double> m_lval;
+    std::vector<size_t> m_ufirst, m_ucol;     // the same for U (of a Q), the pivot first
+    std::vector<double> m_uval;
+    std::vector<size_t> m_pivcol;             // column of the pivot of row i
+  public:
+    SparseLU (const SparseMatrix & a)
+      : m_n(a.rows()), m_lfirst(1, 0), m_ufirst(1, 0), m_pivcol(a.rows())
+    {
+      auto & p = a.pattern();
+      if (p.cols() != m_n)
+        throw std::invalid_argument("SparseLU: matrix is not square");
+
+      const size_t none = m_n;
+      std::vector<size_t> step(m_n, none);    // row in which column j became the pivot
+      std::vector<double> w(m_n, 0.0);        // current row, scattered
+      std::vector<bool> used(m_n, false);
+      std::vector<size_t> cols, heap;
+      std::vector<size_t> colof;              // column of a of the entries of U
+      auto touch = [&] (size_t j)
+      {
+        if (used[j]) return;
+        used[j] = true;
+        cols.push_back(j);
+        if (step[j] != none)
+          {
+            heap.push_back(step[j]);
+            std::push_heap (heap.begin(), heap.end(), std::greater<size_t>());
+          }
+      };
+
+      for (size_t i = 0; i < m_n; i++)
+        {
+          for (size_t k = p.first(i); k < p.next(i); k++)
+            {
+              touch(p.col(k));
+              w[p.col(k)] = a.value(k);
+            }
+
+          // eliminate the pivot columns of the rows before, in their order,
+          // fill-in in pivot columns joins the heap
+          while (!heap.empty())
+            {
+              std::pop_heap (heap.begin(), heap.end(), std::greater<size_t>());
+              size_t r = heap.back();
+              heap.pop_back();
+              double l = w[m_pivcol[r]] / m_uval[m_ufirst[r]];
+              w[m_pivcol[r]] = 0;
+              if (l == 0) continue;
+              m_lcol.push_back(r);
+              m_lval.push_back(l);
+              for (size_t k = m_ufirst[r]+1; k < m_ufirst[r+1]; k++)
+                {
+                  touch(colof[k]);
+                  w[colof[k]] -= l * m_uval[k];
+                }
+            }
+
+          size_t piv = none;
+          double max = 0;
+          for (size_t j : cols)
+            if (step[j] == none && std::fabs(w[j]) > max)
+              {
+                piv = j;
+                max = std::fabs(w[j]);
+              }
+          if (piv == none)
+            throw std::domain_error("SparseLU: matrix is singular");
+          if (step[i] == none && std::fabs(w[i]) >= 0.1*max)
+            piv = i;
+
+          m_pivcol[i] = piv;
+          step[piv] = i;
+          colof.push_back(piv);
+          m_uval.push_back(w[piv]);
+          for (size_t j : cols)
+            if (step[j] == none && w[j] != 0)
+              {
+                colof.push_back(j);
+                m_uval.push_back(w[j]);
+              }
+          m_lfirst.push_back(m_lval.size());
+          m_ufirst.push_back(m_uval.size());
+
+          for (size_t j : cols)
+            {
+              w[j] = 0;
+              used[j] = false;
+            }
+          cols.clear();
+        }
+
+      // the columns of U in the order of the pivots
+      m_ucol.resize(colof.size());
+      for (size_t k = 0; k < colof.size(); k++)
+        m_ucol[k] = step[colof[k]];
+    }
+
+    // entries of L and U, the fill-in is nnz() - a.nnz()
+    size_t nnz () const { return m_lval.size() + m_uval.size(); }
+
+    // b = a^-1 b
+    void solve (VectorView<double> b) const
+    {
+      std::vector<double> z(m_n);
+      for (size_t i = 0; i < m_n; i++)
+        {
+          double sum = b(i);
+          for (size_t k = m_lfirst[i]; k < m_lfirst[i+1]; k++)
+            sum -= m_lval[k] * z[m_lcol[k]];
+          z[i] = sum;
+        }
+      for (size_t i = m_n; i-- > 0; )
+        {
+          double sum = z[i];
+          for (size_t k = m_ufirst[i]+1; k < m_ufirst[i+1]; k++)
+            sum -= m_uval[k] * z[m_ucol[k]];
+          z[i] = sum / m_uval[m_ufirst[i]];
+        }
+      for (size_t i = 0; i < m_n; i++)
+        b(m_pivcol[i]) = z[i];
+    }
+  };
+
+}
+
+#endif
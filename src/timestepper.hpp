@@ -3,21 +3,90 @@
 
 #include <functional>
 #include <exception>
+#include <stdexcept>
 
 #include "Newton.hpp"
 
 
 namespace ASC_ode
 {
+
+  // the last step of a one step method, for extrapolated initial guesses
+  // of Newton. It is only used if the next step continues from its end.
+  class StepHistory
+  {
+    Vector<> m_ystart, m_yend;
+    double m_tau = 0;
+    bool m_valid = false;
+  public:
+    StepHistory (size_t n) : m_ystart(n), m_yend(n) { }
+
+    bool continues (VectorView<double> y) const
+    {
+      if (!m_valid) return false;
+      for (size_t i = 0; i < y.size(); i++)
+        if (y(i) != m_yend(i)) return false;
+      return true;
+    }
+
+    void store (VectorView<double> ystart, VectorView<double> yend, double tau)
+    {
+      m_ystart = ystart;
+      m_yend = yend;
+      m_tau = tau;
+      m_valid = true;
+    }
+
+    // linear extrapolation y += tau/tau_prev (y - y_start), y continues
+    void extrapolate (double tau, VectorView<double> y) const
+    {
+      double theta = tau / m_tau;
+      for (size_t i = 0; i < y.size(); i++)
+        y(i) += theta * (y(i) - m_ystart(i));
+    }
+
+    void reset () { m_valid = false; }
+    double tau () const { return m_tau; }
+  };
+
   
   class TimeStepper
   { 
   protected:
     std::shared_ptr<NonlinearFunction> m_rhs;
+    bool m_predictor = true;
   public:
     TimeStepper(std::shared_ptr<NonlinearFunction> rhs) : m_rhs(rhs) {}
     virtual ~TimeStepper() = default;
     virtual void doStep(double tau, VectorView<double> y) = 0;
+
+    // implicit steppers extrapolate the Newton initial guess from the
+    // previous step, switched off they start from the old state
+    void setPredictor(bool predictor) { m_predictor = predictor; }
+    bool predictor() const { return m_predictor; }
+
+    // advances y together with its sensitivities s = dy/dp to the parameters
+    // of the rhs, a ParameterizedFunction. s has dimension dimX x numParams.
+    virtual void doStepSensitivity(double tau, VectorView<double> y, MatrixView<double> s)
+    {
+      throw std::runtime_error("time stepper does not support sensitivities");
+    }
+
+    // discrete adjoint: advances y, replaces lambda (adjoint of the new y)
+    // by the adjoint of the old y and adds (dy_new/dp)^T lambda to grad
+    virtual void doStepAdjoint(double tau, VectorView<double> y, VectorView<double> lambda,
+                               VectorView<double> grad)
+    {
+      throw std::runtime_error("time stepper does not support adjoints");
+    }
+
+    std::shared_ptr<ParameterizedFunction> parameterizedRhs() const
+    {
+      auto rhs = std::dynamic_pointer_cast<ParameterizedFunction>(m_rhs);
+      if (!rhs)
+        throw std::invalid_argument("sensitivities need a ParameterizedFunction as rhs");
+      return rhs;
+    }
   };
 
   class ExplicitEuler : public TimeStepper
@@ -29,9 +98,30 @@ namespace ASC_ode
 
     void doStep(double tau, VectorView<double> y) override
     {
+      ASC_ODE_STATS_ADD(steps, 1);
+      ASC_ODE_STATS_ADD(function_evals, 1);
       this->m_rhs->evaluate(y, m_vecf);
       y += tau * m_vecf;
     }
+
+    // lambda_old = lambda + tau f_y^T lambda
+    void doStepAdjoint(double tau, VectorView<double> y, VectorView<double> lambda,
+                       VectorView<double> grad) override
+    {
+      auto rhs = parameterizedRhs();
+      size_t n = y.size();
+      Matrix<> fy(n, n);
+      Vector<> w(n), tmp(n);
+
+      ASC_ODE_STATS_ADD(jacobian_evals, 1);
+      rhs->evaluateDeriv(y, fy);
+      w = tau * lambda;
+      rhs->addParamDerivTrans(y, w, grad);
+      MultTrans(fy, w, tmp);
+
+      doStep(tau, y);
+      lambda += tmp;
+    }
   };
 
   class ImplicitEuler : public TimeStepper
@@ -39,9 +129,11 @@ namespace ASC_ode
     std::shared_ptr<NonlinearFunction> m_equ;
     std::shared_ptr<Parameter> m_tau;
     std::shared_ptr<ConstantFunction> m_yold;
+    StepHistory m_history;
   public:
     ImplicitEuler(std::shared_ptr<NonlinearFunction> rhs) 
-    : TimeStepper(rhs), m_tau(std::make_shared<Parameter>(0.0)) 
+    : TimeStepper(rhs), m_tau(std::make_shared<Parameter>(0.0)),
+      m_history(rhs->dimX())
     {
       m_yold = std::make_shared<ConstantFunction>(rhs->dimX());
       auto ynew = std::make_shared<IdentityFunction>(rhs->dimX());
@@ -50,9 +142,51 @@ namespace ASC_ode
 
     void doStep(double tau, VectorView<double> y) override
     {
+      ASC_ODE_STATS_ADD(steps, 1);
       m_yold->set(y);
       m_tau->set(tau);
+      if (m_predictor && m_history.continues(y))
+        m_history.extrapolate(tau, y);
       NewtonSolver(m_equ, y);
+      m_history.store(m_yold->get(), y, tau);
+    }
+
+    // (I - tau f_y) s_new = s_old + tau f_p, with the Newton Jacobian
+    void doStepSensitivity(double tau, VectorView<double> y, MatrixView<double> s) override
+    {
+      auto rhs = parameterizedRhs();
+      size_t n = y.size();
+      Matrix<> jacinv(n, n), fp(n, s.cols());
+
+      ASC_ODE_STATS_ADD(steps, 1);
+      m_yold->set(y);
+      m_tau->set(tau);
+      NewtonSolver(m_equ, y, jacinv);
+
+      rhs->evaluateParamDeriv(y, fp);
+      fp *= tau;
+      fp += s;
+      s = jacinv * fp;
+    }
+
+    // lambda_old = (I - tau f_y)^-T lambda
+    void doStepAdjoint(double tau, VectorView<double> y, VectorView<double> lambda,
+                       VectorView<double> grad) override
+    {
+      auto rhs = parameterizedRhs();
+      size_t n = y.size();
+      Matrix<> jacinv(n, n);
+      Vector<> mu(n);
+
+      ASC_ODE_STATS_ADD(steps, 1);
+      m_yold->set(y);
+      m_tau->set(tau);
+      NewtonSolver(m_equ, y, jacinv);
+
+      MultTrans(jacinv, lambda, mu);
+      lambda = mu;
+      mu *= tau;
+      rhs->addParamDerivTrans(y, mu, grad);
     }
   };
 
@@ -66,12 +200,45 @@ namespace ASC_ode
 
       void doStep(double tau, VectorView<double> y) override
       {
-        
+        ASC_ODE_STATS_ADD(steps, 1);
+        ASC_ODE_STATS_ADD(function_evals, 2);
         this->m_rhs->evaluate(y, m_vecf);
         m_ytemp = y + 0.5 * tau * m_vecf;
         this->m_rhs->evaluate(m_ytemp, m_vecf);
         y += tau * m_vecf;
       }
+
+      // through the midpoint:  lambda_old = lambda + a + tau/2 f_y(y)^T a,
+      // a = tau f_y(y_mid)^T lambda
+      void doStepAdjoint(double tau, VectorView<double> y, VectorView<double> lambda,
+                         VectorView<double> grad) override
+      {
+        auto rhs = parameterizedRhs();
+        size_t n = y.size();
+        Matrix<> fy(n, n);
+        Vector<> w(n), a(n), tmp(n);
+
+        ASC_ODE_STATS_ADD(steps, 1);
+        ASC_ODE_STATS_ADD(function_evals, 1);
+        ASC_ODE_STATS_ADD(jacobian_evals, 2);
+        this->m_rhs->evaluate(y, m_vecf);
+        m_ytemp = y + 0.5 * tau * m_vecf;
+
+        w = tau * lambda;
+        rhs->evaluateDeriv(m_ytemp, fy);
+        MultTrans(fy, w, a);
+        rhs->addParamDerivTrans(m_ytemp, w, grad);
+
+        w = 0.5 * tau * a;
+        rhs->evaluateDeriv(y, fy);
+        MultTrans(fy, w, tmp);
+        rhs->addParamDerivTrans(y, w, grad);
+        lambda += a;
+        lambda += tmp;
+
+        this->m_rhs->evaluate(m_ytemp, m_vecf);
+        y += tau * m_vecf;
+      }
   };
 
   class CrankNicolson : public TimeStepper
@@ -81,11 +248,13 @@ namespace ASC_ode
     std::shared_ptr<Parameter> m_tau;
     std::shared_ptr<ConstantFunction> m_yold;
     std::shared_ptr<ConstantFunction> f_old;
+    StepHistory m_history;
   public:
     CrankNicolson(std::shared_ptr<NonlinearFunction> rhs)
     : TimeStepper(rhs)          
     , m_tau(std::make_shared<Parameter>(0.0))
     , m_vecf(rhs->dimF())
+    , m_history(rhs->dimX())
     {
       m_yold = std::make_shared<ConstantFunction>(rhs->dimX());
       f_old = std::make_shared<ConstantFunction>(rhs->dimF());
@@ -95,11 +264,73 @@ namespace ASC_ode
 
     void doStep(double tau, VectorView<double> y) override
     {
+      ASC_ODE_STATS_ADD(steps, 1);
+      ASC_ODE_STATS_ADD(function_evals, 1);
       m_yold->set(y);
       this->m_rhs->evaluate(y, m_vecf);
       f_old->set(m_vecf);
       m_tau->set(tau/2);
+      if (m_predictor && m_history.continues(y))
+        m_history.extrapolate(tau, y);
       NewtonSolver(m_equ, y);
+      m_history.store(m_yold->get(), y, tau);
+    }
+
+    // (I - tau/2 f_y(y_new)) s_new = s_old + tau/2 (f_y(y_old) s_old + f_p(y_old) + f_p(y_new))
+    void doStepSensitivity(double tau, VectorView<double> y, MatrixView<double> s) override
+    {
+      auto rhs = parameterizedRhs();
+      size_t n = y.size();
+      Matrix<> jacinv(n, n), fy(n, n), fp(n, s.cols()), fpnew(n, s.cols());
+
+      ASC_ODE_STATS_ADD(jacobian_evals, 1);
+      rhs->evaluateDeriv(y, fy);
+      rhs->evaluateParamDeriv(y, fp);
+      fp += fy * s;
+
+      ASC_ODE_STATS_ADD(steps, 1);
+      ASC_ODE_STATS_ADD(function_evals, 1);
+      m_yold->set(y);
+      this->m_rhs->evaluate(y, m_vecf);
+      f_old->set(m_vecf);
+      m_tau->set(tau/2);
+      NewtonSolver(m_equ, y, jacinv);
+
+      rhs->evaluateParamDeriv(y, fpnew);
+      fp += fpnew;
+      fp *= tau/2;
+      fp += s;
+      s = jacinv * fp;
+    }
+
+    // mu = (I - tau/2 f_y(y_new))^-T lambda,  lambda_old = mu + tau/2 f_y(y_old)^T mu
+    void doStepAdjoint(double tau, VectorView<double> y, VectorView<double> lambda,
+                       VectorView<double> grad) override
+    {
+      auto rhs = parameterizedRhs();
+      size_t n = y.size();
+      Matrix<> jacinv(n, n), fy(n, n);
+      Vector<> mu(n), tmp(n);
+
+      ASC_ODE_STATS_ADD(jacobian_evals, 1);
+      rhs->evaluateDeriv(y, fy);
+
+      ASC_ODE_STATS_ADD(steps, 1);
+      ASC_ODE_STATS_ADD(function_evals, 1);
+      m_yold->set(y);
+      this->m_rhs->evaluate(y, m_vecf);
+      f_old->set(m_vecf);
+      m_tau->set(tau/2);
+      NewtonSolver(m_equ, y, jacinv);
+
+      MultTrans(jacinv, lambda, mu);
+      mu *= tau/2;
+      rhs->addParamDerivTrans(m_yold->get(), mu, grad);
+      rhs->addParamDerivTrans(y, mu, grad);
+      MultTrans(fy, mu, tmp);
+      mu *= 2/tau;
+      lambda = mu;
+      lambda += tmp;
     }
   };
 }
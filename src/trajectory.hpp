@@ -0,0 +1,674 @@
+#ifndef TRAJECTORY_HPP
+#define TRAJECTORY_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <vector.hpp>
+
+#ifdef ASC_ODE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef ASC_ODE_HAVE_HDF5
+#include <hdf5.h>
+#endif
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+  // Chunked on-disk storage of trajectories x(t_i), fed sample by sample
+  // from the callback of SolveODE_Newmark / SolveODE_Alpha or from a
+  // loop over TimeStepper::doStep.
+  //
+  // native file layout:
+  //   header  : "ASCTRJ01", dim, chunksize, compression
+  //   chunks  : nsamples, nbytes, times[nsamples], payload[nbytes]
+  //   index   : (offset, firstsample) per chunk
+  //   footer  : nchunks, nsamples, "ASCTRJIX"
+
+  enum class Compression : uint32_t
+  {
+    NONE = 0,           // raw doubles
+    SHUFFLE = 1,        // xor-delta between samples + byte shuffle + run length
+    SHUFFLE_ZSTD = 2    // xor-delta between samples + byte shuffle + zstd
+  };
+
+  namespace trajectory_detail
+  {
+    inline constexpr char headerMagic[8] = { 'A','S','C','T','R','J','0','1' };
+    inline constexpr char footerMagic[8] = { 'A','S','C','T','R','J','I','X' };
+
+    // xor each sample with its predecessor and transpose bytes, such that
+    // the (mostly unchanged) sign/exponent bytes of all values end up
+    // next to each other
+    inline std::vector<uint8_t> shuffleDelta (const std::vector<double> & vals, size_t dim)
+    {
+      size_t n = vals.size();
+      std::vector<uint64_t> bits(n);
+      std::memcpy (bits.data(), vals.data(), n*sizeof(double));
+      for (size_t i = n; i-- > dim; )
+        bits[i] ^= bits[i-dim];
+
+      std::vector<uint8_t> out(n*sizeof(double));
+      for (size_t i = 0; i < n; i++)
+        for (size_t k = 0; k < sizeof(double); k++)
+          out[k*n+i] = uint8_t(bits[i] >> (8*k));
+      return out;
+    }
+
+    inline std::vector<double> unshuffleDelta (const std::vector<uint8_t> & in, size_t dim)
+    {
+      size_t n = in.size() / sizeof(double);
+      std::vector<uint64_t> bits(n, 0);
+      for (size_t i = 0; i < n; i++)
+        for (size_t k = 0; k < sizeof(double); k++)
+          bits[i] |= uint64_t(in[k*n+i]) << (8*k);
+      for (size_t i = dim; i < n; i++)
+        bits[i] ^= bits[i-dim];
+
+      std::vector<double> vals(n);
+      std::memcpy (vals.data(), bits.data(), n*sizeof(double));
+      return vals;
+    }
+
+    // byte-wise run length coding:
+    //   control c < 128  : c+1 literal bytes follow
+    //   control c >= 128 : the next byte is repeated c-125 times
+    inline std::vector<uint8_t> runLengthEncode (const std::vector<uint8_t> & in)
+    {
+      std::vector<uint8_t> out;
+      out.reserve (in.size()/4+16);
+      size_t i = 0, n = in.size();
+      while (i < n)
+        {
+          size_t run = 1;
+          while (i+run < n && run < 130 && in[i+run] == in[i]) run++;
+          if (run >= 3)
+            {
+              out.push_back (uint8_t(run+125));
+              out.push_back (in[i]);
+              i += run;
+              continue;
+            }
+
+          size_t start = i;
+          while (i < n && i-start < 128)
+            {
+              if (i+2 < n && in[i] == in[i+1] && in[i] == in[i+2]) break;
+              i++;
+            }
+          out.push_back (uint8_t(i-start-1));
+          out.insert (out.end(), in.begin()+start, in.begin()+i);
+        }
+      return out;
+    }
+
+    inline std::vector<uint8_t> runLengthDecode (const std::vector<uint8_t> & in, size_t size)
+    {
+      std::vector<uint8_t> out;
+      out.reserve (size);
+      size_t i = 0;
+      while (i < in.size())
+        {
+          uint8_t c = in[i++];
+          size_t len = c < 128 ? size_t(c)+1 : size_t(c)-125;
+          if (out.size()+len > size || i + (c < 128 ? len : 1) > in.size())
+            throw std::runtime_error("corrupt trajectory chunk");
+          if (c < 128)
+            {
+              out.insert (out.end(), in.begin()+i, in.begin()+i+len);
+              i += len;
+            }
+          else
+            out.insert (out.end(), len, in[i++]);
+        }
+      if (out.size() != size)
+        throw std::runtime_error("corrupt trajectory chunk");
+      return out;
+    }
+
+    inline std::vector<uint8_t> compress (const std::vector<double> & vals, size_t dim, Compression comp)
+    {
+      switch (comp)
+        {
+        case Compression::NONE:
+          {
+            std::vector<uint8_t> out(vals.size()*sizeof(double));
+            std::memcpy (out.data(), vals.data(), out.size());
+            return out;
+          }
+        case Compression::SHUFFLE:
+          return runLengthEncode (shuffleDelta (vals, dim));
+        case Compression::SHUFFLE_ZSTD:
+          {
+#ifdef ASC_ODE_HAVE_ZSTD
+            auto shuffled = shuffleDelta (vals, dim);
+            std::vector<uint8_t> out(ZSTD_compressBound(shuffled.size()));
+            size_t len = ZSTD_compress (out.data(), out.size(), shuffled.data(), shuffled.size(), 3);
+            if (ZSTD_isError(len))
+              throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(len));
+            out.resize (len);
+            return out;
+#else
+            throw std::invalid_argument("trajectory: compiled without zstd support");
+#endif
+          }
+        }
+      throw std::invalid_argument("trajectory: unknown compression");
+    }
+
+    inline std::vector<double> decompress (const std::vector<uint8_t> & in, size_t nvals, size_t dim, Compression comp)
+    {
+      switch (comp)
+        {
+        case Compression::NONE:
+          {
+            if (in.size() != nvals*sizeof(double))
+              throw std::runtime_error("corrupt trajectory chunk");
+            std::vector<double> vals(nvals);
+            std::memcpy (vals.data(), in.data(), nvals*sizeof(double));
+            return vals;
+          }
+        case Compression::SHUFFLE:
+          return unshuffleDelta (runLengthDecode (in, nvals*sizeof(double)), dim);
+        case Compression::SHUFFLE_ZSTD:
+          {
+#ifdef ASC_ODE_HAVE_ZSTD
+            std::vector<uint8_t> shuffled(nvals*sizeof(double));
+            size_t len = ZSTD_decompress (shuffled.data(), shuffled.size(), in.data(), in.size());
+            if (ZSTD_isError(len) || len != shuffled.size())
+              throw std::runtime_error("corrupt trajectory chunk");
+            return unshuffleDelta (shuffled, dim);
+#else
+            throw std::invalid_argument("trajectory: compiled without zstd support");
+#endif
+          }
+        }
+      throw std::invalid_argument("trajectory: unknown compression");
+    }
+
+    template <typename T>
+    void writePOD (std::ostream & ost, T val) { ost.write (reinterpret_cast<const char*>(&val), sizeof(T)); }
+
+    template <typename T>
+    T readPOD (std::istream & ist)
+    {
+      T val;
+      ist.read (reinterpret_cast<char*>(&val), sizeof(T));
+      if (!ist) throw std::runtime_error("trajectory: unexpected end of file");
+      return val;
+    }
+  }
+
+
+
+  // common front end: decimation and the solver callback
+  class TrajectorySink
+  {
+  protected:
+    size_t m_dim;
+    size_t m_decimate;
+    size_t m_counter = 0;
+  public:
+    TrajectorySink (size_t dim, size_t decimate)
+      : m_dim(dim), m_decimate(decimate ? decimate : 1) { }
+    virtual ~TrajectorySink() = default;
+
+    size_t dim() const { return m_dim; }
+
+    // every decimate-th call is stored
+    void add (double t, VectorView<double> x)
+    {
+      if (m_counter++ % m_decimate == 0)
+        store (t, x);
+    }
+
+    // to be passed to SolveODE_Newmark / SolveODE_Alpha
+    std::function<void(double,VectorView<double>)> callback()
+    {
+      return [this] (double t, VectorView<double> x) { add(t, x); };
+    }
+
+    virtual void close() = 0;
+  protected:
+    virtual void store (double t, VectorView<double> x) = 0;
+  };
+
+
+
+  class TrajectoryWriter : public TrajectorySink
+  {
+    std::ofstream m_file;
+    size_t m_chunksize;
+    Compression m_comp;
+    std::vector<double> m_times;
+    std::vector<double> m_values;
+    std::vector<std::pair<uint64_t,uint64_t>> m_index;   // (offset, firstsample)
+    size_t m_nsamples = 0;
+  public:
+    TrajectoryWriter (const std::string & filename, size_t dim,
+                      size_t chunksize = 256, size_t decimate = 1,
+                      Compression comp = Compression::SHUFFLE)
+      : TrajectorySink(dim, decimate),
+        m_file(filename, std::ios::binary | std::ios::trunc),
+        m_chunksize(chunksize ? chunksize : 1), m_comp(comp)
+    {
+      using namespace trajectory_detail;
+      if (!m_file)
+        throw std::runtime_error("cannot open trajectory file "+filename);
+      m_file.write (headerMagic, 8);
+      writePOD<uint64_t> (m_file, m_dim);
+      writePOD<uint64_t> (m_file, m_chunksize);
+      writePOD<uint32_t> (m_file, uint32_t(m_comp));
+      writePOD<uint32_t> (m_file, 0);
+      m_times.reserve (m_chunksize);
+      m_values.reserve (m_chunksize*m_dim);
+    }
+
+    ~TrajectoryWriter() override
+    {
+      try { close(); } catch (...) { }
+    }
+
+    size_t size() const { return m_nsamples; }
+
+    void close() override
+    {
+      using namespace trajectory_detail;
+      if (!m_file.is_open()) return;
+      flushChunk();
+      for (auto [offset, first] : m_index)
+        {
+          writePOD<uint64_t> (m_file, offset);
+          writePOD<uint64_t> (m_file, first);
+        }
+      writePOD<uint64_t> (m_file, m_index.size());
+      writePOD<uint64_t> (m_file, m_nsamples);
+      m_file.write (footerMagic, 8);
+      m_file.close();
+    }
+
+  protected:
+    void store (double t, VectorView<double> x) override
+    {
+      if (x.size() != m_dim)
+        throw std::invalid_argument("trajectory: dimension mismatch");
+      m_times.push_back (t);
+      for (size_t i = 0; i < m_dim; i++)
+        m_values.push_back (x(i));
+      m_nsamples++;
+      if (m_times.size() == m_chunksize)
+        flushChunk();
+    }
+
+  private:
+    void flushChunk()
+    {
+      using namespace trajectory_detail;
+      if (m_times.empty()) return;
+      auto payload = compress (m_values, m_dim, m_comp);
+
+      m_index.emplace_back (uint64_t(m_file.tellp()), uint64_t(m_nsamples-m_times.size()));
+      writePOD<uint64_t> (m_file, m_times.size());
+      writePOD<uint64_t> (m_file, payload.size());
+      m_file.write (reinterpret_cast<const char*>(m_times.data()), m_times.size()*sizeof(double));
+      m_file.write (reinterpret_cast<const char*>(payload.data()), payload.size());
+      if (!m_file)
+        throw std::runtime_error("trajectory: write failed");
+      m_times.clear();
+      m_values.clear();
+    }
+  };
+
+
+
+  // random access to samples of a file written by TrajectoryWriter,
+  // only the chunk containing the requested sample is decompressed
+  class TrajectoryReader
+  {
+    std::ifstream m_file;
+    size_t m_dim, m_chunksize, m_nsamples;
+    Compression m_comp;
+    std::vector<uint64_t> m_offsets;
+    std::vector<double> m_firsttimes;
+    size_t m_cached = size_t(-1);
+    uint64_t m_filesize = 0;
+    std::vector<double> m_times, m_values;
+  public:
+    TrajectoryReader (const std::string & filename)
+      : m_file(filename, std::ios::binary)
+    {
+      using namespace trajectory_detail;
+      if (!m_file)
+        throw std::runtime_error("cannot open trajectory file "+filename);
+
+      char magic[8];
+      m_file.read (magic, 8);
+      if (!m_file || std::memcmp (magic, headerMagic, 8) != 0)
+        throw std::runtime_error(filename+" is not a trajectory file");
+      m_dim = readPOD<uint64_t> (m_file);
+      m_chunksize = readPOD<uint64_t> (m_file);
+      m_comp = Compression(readPOD<uint32_t> (m_file));
+      readPOD<uint32_t> (m_file);
+
+      m_file.seekg (0, std::ios::end);
+      m_filesize = m_file.tellg();
+      m_file.seekg (-24, std::ios::end);
+      size_t nchunks = readPOD<uint64_t> (m_file);
+      m_nsamples = readPOD<uint64_t> (m_file);
+      m_file.read (magic, 8);
+      if (!m_file || std::memcmp (magic, footerMagic, 8) != 0)
+        throw std::runtime_error(filename+": trajectory file was not closed properly");
+      if (m_dim == 0 || m_chunksize == 0
+          || nchunks != (m_nsamples+m_chunksize-1) / m_chunksize
+          || 24+16*nchunks > m_filesize)
+        throw std::runtime_error(filename+": corrupt trajectory index");
+
+      m_file.seekg (-24-std::streamoff(16*nchunks), std::ios::end);
+      for (size_t i = 0; i < nchunks; i++)
+        {
+          m_offsets.push_back (readPOD<uint64_t> (m_file));
+          readPOD<uint64_t> (m_file);
+        }
+
+      // first time stamp of every chunk, for searching by time
+      for (auto offset : m_offsets)
+        {
+          if (offset+24 > m_filesize)
+            throw std::runtime_error(filename+": corrupt trajectory index");
+          m_file.seekg (offset+16);
+          m_firsttimes.push_back (readPOD<double> (m_file));
+        }
+    }
+
+    size_t size() const { return m_nsamples; }
+    size_t dim() const { return m_dim; }
+
+    double time (size_t i)
+    {
+      if (i >= m_nsamples)
+        throw std::out_of_range("trajectory: sample index out of range");
+      loadChunk (i / m_chunksize);
+      return m_times[i % m_chunksize];
+    }
+
+    void get (size_t i, VectorView<double> x)
+    {
+      if (i >= m_nsamples)
+        throw std::out_of_range("trajectory: sample index out of range");
+      loadChunk (i / m_chunksize);
+      size_t first = (i % m_chunksize) * m_dim;
+      for (size_t j = 0; j < m_dim; j++)
+        x(j) = m_values[first+j];
+    }
+
+    // index of the first sample with time >= t
+    size_t find (double t)
+    {
+      size_t chunk = 0;
+      while (chunk+1 < m_firsttimes.size() && m_firsttimes[chunk+1] <= t)
+        chunk++;
+      for (size_t i = chunk*m_chunksize; i < m_nsamples; i++)
+        if (time(i) >= t) return i;
+      return m_nsamples;
+    }
+
+  private:
+    void loadChunk (size_t chunk)
+    {
+      using namespace trajectory_detail;
+      if (chunk == m_cached) return;
+      if (chunk >= m_offsets.size())
+        throw std::out_of_range("trajectory: sample index out of range");
+
+      m_file.clear();
+      m_file.seekg (m_offsets[chunk]);
+      size_t n = readPOD<uint64_t> (m_file);
+      size_t nbytes = readPOD<uint64_t> (m_file);
+      // the last chunk may be partial, all others are full
+      size_t expected = std::min (m_chunksize, m_nsamples - chunk*m_chunksize);
+      if (n != expected || nbytes > m_filesize - m_offsets[chunk])
+        throw std::runtime_error("corrupt trajectory chunk");
+      m_times.resize (n);
+      m_file.read (reinterpret_cast<char*>(m_times.data()), n*sizeof(double));
+      std::vector<uint8_t> payload(nbytes);
+      m_file.read (reinterpret_cast<char*>(payload.data()), nbytes);
+      if (!m_file)
+        throw std::runtime_error("trajectory: unexpected end of file");
+      m_values = decompress (payload, n*m_dim, m_dim, m_comp);
+      m_cached = chunk;
+    }
+  };
+
+
+
+#ifdef ASC_ODE_HAVE_HDF5
+
+  // HDF5 backend: datasets "t" (n) and "x" (n x dim), chunked along time,
+  // with the shuffle + deflate filter pipeline. Readable by h5py & co.
+  class HDF5TrajectoryWriter : public TrajectorySink
+  {
+    hid_t m_file = -1, m_dsetx = -1, m_dsett = -1;
+    size_t m_chunksize;
+    size_t m_nsamples = 0;
+    std::vector<double> m_times, m_values;
+  public:
+    HDF5TrajectoryWriter (const std::string & filename, size_t dim,
+                          size_t chunksize = 256, size_t decimate = 1,
+                          int deflate = 4)
+      : TrajectorySink(dim, decimate), m_chunksize(chunksize ? chunksize : 1)
+    {
+      // the destructor does not run for a partly constructed writer
+      m_file = H5Fcreate (filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+      if (m_file < 0)
+        throw std::runtime_error("cannot create HDF5 file "+filename);
+
+      hsize_t dims[2] = { 0, dim };
+      hsize_t maxdims[2] = { H5S_UNLIMITED, dim };
+      hsize_t chunk[2] = { m_chunksize, dim };
+
+      hid_t space = H5Screate_simple (2, dims, maxdims);
+      hid_t plist = H5Pcreate (H5P_DATASET_CREATE);
+      H5Pset_chunk (plist, 2, chunk);
+      H5Pset_shuffle (plist);
+      if (deflate > 0) H5Pset_deflate (plist, deflate);
+      m_dsetx = H5Dcreate2 (m_file, "x", H5T_NATIVE_DOUBLE, space, H5P_DEFAULT, plist, H5P_DEFAULT);
+      H5Pclose (plist);
+      H5Sclose (space);
+
+      space = H5Screate_simple (1, dims, maxdims);
+      plist = H5Pcreate (H5P_DATASET_CREATE);
+      H5Pset_chunk (plist, 1, chunk);
+      m_dsett = H5Dcreate2 (m_file, "t", H5T_NATIVE_DOUBLE, space, H5P_DEFAULT, plist, H5P_DEFAULT);
+      H5Pclose (plist);
+      H5Sclose (space);
+
+      if (m_dsetx < 0 || m_dsett < 0)
+        {
+          closeHandles();
+          throw std::runtime_error("cannot create HDF5 datasets in "+filename);
+        }
+      m_times.reserve (m_chunksize);
+      m_values.reserve (m_chunksize*m_dim);
+    }
+
+    ~HDF5TrajectoryWriter() override
+    {
+      try { close(); } catch (...) { }
+    }
+
+    // stored samples, including the ones not yet flushed
+    size_t size() const { return m_nsamples + m_times.size(); }
+
+    void close() override
+    {
+      if (m_file < 0) return;
+      // the handles are released also if the last write fails
+      try { flushChunk(); }
+      catch (...) { closeHandles(); throw; }
+      closeHandles();
+    }
+
+  protected:
+    void store (double t, VectorView<double> x) override
+    {
+      if (x.size() != m_dim)
+        throw std::invalid_argument("trajectory: dimension mismatch");
+      m_times.push_back (t);
+      for (size_t i = 0; i < m_dim; i++)
+        m_values.push_back (x(i));
+      if (m_times.size() == m_chunksize)
+        flushChunk();
+    }
+
+  private:
+    void closeHandles()
+    {
+      if (m_dsetx >= 0) H5Dclose (m_dsetx);
+      if (m_dsett >= 0) H5Dclose (m_dsett);
+      if (m_file >= 0) H5Fclose (m_file);
+      m_file = m_dsetx = m_dsett = -1;
+    }
+
+    // append the buffered samples as one hyperslab, aligned with the
+    // dataset chunks
+    void flushChunk()
+    {
+      if (m_times.empty()) return;
+      hsize_t n = m_times.size();
+      hsize_t newdims[2] = { m_nsamples+n, m_dim };
+      hsize_t start[2] = { m_nsamples, 0 };
+      hsize_t count[2] = { n, m_dim };
+
+      H5Dset_extent (m_dsetx, newdims);
+      hid_t fspace = H5Dget_space (m_dsetx);
+      H5Sselect_hyperslab (fspace, H5S_SELECT_SET, start, nullptr, count, nullptr);
+      hid_t mspace = H5Screate_simple (2, count, nullptr);
+      herr_t errx = H5Dwrite (m_dsetx, H5T_NATIVE_DOUBLE, mspace, fspace, H5P_DEFAULT, m_values.data());
+      H5Sclose (mspace);
+      H5Sclose (fspace);
+
+      H5Dset_extent (m_dsett, newdims);
+      fspace = H5Dget_space (m_dsett);
+      H5Sselect_hyperslab (fspace, H5S_SELECT_SET, start, nullptr, count, nullptr);
+      mspace = H5Screate_simple (1, count, nullptr);
+      herr_t errt = H5Dwrite (m_dsett, H5T_NATIVE_DOUBLE, mspace, fspace, H5P_DEFAULT, m_times.data());
+      H5Sclose (mspace);
+      H5Sclose (fspace);
+
+      if (errx < 0 || errt < 0)
+        throw std::runtime_error("trajectory: HDF5 write failed");
+      m_nsamples += n;
+      m_times.clear();
+      m_values.clear();
+    }
+  };
+
+
+
+  // random access to samples of a file written by HDF5TrajectoryWriter,
+  // HDF5 reads (and caches) only the chunks of the requested samples
+  class HDF5TrajectoryReader
+  {
+    hid_t m_file = -1, m_dsetx = -1;
+    size_t m_dim = 0;
+    std::vector<double> m_times;
+  public:
+    HDF5TrajectoryReader (const std::string & filename)
+    {
+      m_file = H5Fopen (filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+      if (m_file < 0)
+        throw std::runtime_error("cannot open HDF5 file "+filename);
+
+      // all time stamps are read at once, for searching by time
+      hid_t dsett = H5Dopen2 (m_file, "t", H5P_DEFAULT);
+      m_dsetx = H5Dopen2 (m_file, "x", H5P_DEFAULT);
+      bool ok = dsett >= 0 && m_dsetx >= 0;
+      if (ok)
+        {
+          hsize_t dimsx[2], dimst[1];
+          hid_t space = H5Dget_space (m_dsetx);
+          ok = H5Sget_simple_extent_ndims (space) == 2;
+          if (ok) H5Sget_simple_extent_dims (space, dimsx, nullptr);
+          H5Sclose (space);
+          space = H5Dget_space (dsett);
+          ok = ok && H5Sget_simple_extent_ndims (space) == 1;
+          if (ok) H5Sget_simple_extent_dims (space, dimst, nullptr);
+          H5Sclose (space);
+          ok = ok && dimst[0] == dimsx[0];
+          if (ok)
+            {
+              m_dim = dimsx[1];
+              m_times.resize (dimst[0]);
+              ok = m_times.empty()
+                || H5Dread (dsett, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, m_times.data()) >= 0;
+            }
+        }
+      if (dsett >= 0) H5Dclose (dsett);
+      if (!ok)
+        {
+          if (m_dsetx >= 0) H5Dclose (m_dsetx);
+          H5Fclose (m_file);
+          throw std::runtime_error(filename+" is not a trajectory file");
+        }
+    }
+
+    ~HDF5TrajectoryReader()
+    {
+      H5Dclose (m_dsetx);
+      H5Fclose (m_file);
+    }
+
+    HDF5TrajectoryReader (const HDF5TrajectoryReader &) = delete;
+    HDF5TrajectoryReader & operator= (const HDF5TrajectoryReader &) = delete;
+
+    size_t size() const { return m_times.size(); }
+    size_t dim() const { return m_dim; }
+
+    double time (size_t i) const
+    {
+      if (i >= m_times.size())
+        throw std::out_of_range("trajectory: sample index out of range");
+      return m_times[i];
+    }
+
+    void get (size_t i, VectorView<double> x)
+    {
+      if (i >= m_times.size())
+        throw std::out_of_range("trajectory: sample index out of range");
+      hsize_t start[2] = { i, 0 };
+      hsize_t count[2] = { 1, m_dim };
+      std::vector<double> row(m_dim);
+      hid_t fspace = H5Dget_space (m_dsetx);
+      H5Sselect_hyperslab (fspace, H5S_SELECT_SET, start, nullptr, count, nullptr);
+      hid_t mspace = H5Screate_simple (2, count, nullptr);
+      herr_t err = H5Dread (m_dsetx, H5T_NATIVE_DOUBLE, mspace, fspace, H5P_DEFAULT, row.data());
+      H5Sclose (mspace);
+      H5Sclose (fspace);
+      if (err < 0)
+        throw std::runtime_error("trajectory: HDF5 read failed");
+      for (size_t j = 0; j < m_dim; j++)
+        x(j) = row[j];
+    }
+
+    // index of the first sample with time >= t
+    size_t find (double t) const
+    {
+      return std::lower_bound (m_times.begin(), m_times.end(), t) - m_times.begin();
+    }
+  };
+
+#endif
+
+}
+
+#endif